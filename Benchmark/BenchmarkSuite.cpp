@@ -0,0 +1,381 @@
+// BenchmarkSuite.cpp : Times the decoder on a fixed set of corpora.
+//
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "Benchmark.h"
+#include "BatchInflate.h"
+#include "Corpus.h"
+#include "Deflate.h"
+#include "GZip.h"
+#include "MappedFile.h"
+
+/* Bytes of each synthetic corpus by default. */
+#define SUITECORPUSSIZE (8 << 20)
+
+/* Sizes of the payloads of the -batch comparison. */
+#define SUITEPAYLOADMIN 1024
+#define SUITEPAYLOADMAX 20480
+
+/* Settings from the command line. */
+struct SuiteOptions
+{
+	size_t corpusSize;
+	int level;
+	int decodeMode;
+	int warmup;
+	int iterations;
+	int cpu;				/* -1 leaves the thread unpinned */
+	int batch;				/* payloads in the batch comparison, 0 for none */
+	int threads;			/* threads of the batch decoder */
+	int fullBuffer;			/* also time decoding into a buffer for the whole output */
+};
+
+/*
+* Compress size bytes of data at the given level, check that the decoder
+* gives them back, and time the decoder on it, printing one line of the
+* report.  Returns 0, or 1 if anything failed.
+*/
+static int run(const char *name, const unsigned char *data, size_t size, const struct SuiteOptions *options)
+{
+	/* Stored blocks add 5 bytes in 64K, so this is always enough. */
+	size_t capacity = size + size / 8 + 1024;
+	unsigned char *compressed = new unsigned char[capacity];
+	CMemorySink compressedSink(compressed, capacity);
+	TDeflate<CMemorySink> deflate(&compressedSink, options->level);
+	deflate.reset();
+	int error = deflate.compress(data, size, DEFLATEFINISH);
+	size_t compressedLength = (size_t)compressedSink.getBytesWritten();
+	if (error != 0)
+	{
+		printf("%-12s compression failed (%d)\n", name, error);
+		delete [] compressed;
+		return 1;
+	}
+
+	/* A benchmark of a decoder that is wrong would be worse than none. */
+	unsigned char *check = new unsigned char[size + 1];
+	CMemorySink checkSink(check, size + 1);
+	TLZ<CMemorySink> lz;
+	lz.setIO(&checkSink);
+	THuffman<CMemorySink> huff(&lz, &checkSink);
+	huff.setDecodeMode(options->decodeMode);
+	huff.decompress(compressed, compressedLength);
+	bool same = huff.error == 0 && checkSink.getBytesWritten() == (long long)size && memcmp(check, data, size) == 0;
+	delete [] check;
+	if (!same)
+	{
+		printf("%-12s decoded wrongly (%d)\n", name, huff.error);
+		delete [] compressed;
+		return 1;
+	}
+
+	CBenchmark benchmark(compressed, compressedLength);
+	struct BenchmarkResult result;
+	error = benchmark.measure(options->decodeMode, options->warmup, options->iterations, &result);
+	if (error == 0)
+	{
+		printf("%-12s %10zu %6.3f %9.1f %9.1f %7.1f %7.2f", name, size,
+			size > 0 ? (double)compressedLength / size : 0.0,
+			result.bestSpeed, result.meanSpeed, result.deviation, result.cyclesPerByte);
+#ifdef BENCHZLIB
+		struct BenchmarkResult zlib;
+		if (benchmark.measureZlib(options->warmup, options->iterations, &zlib) == 0)
+		{
+			printf(" %9.1f %7.2fx", zlib.meanSpeed, zlib.meanSpeed > 0 ? result.meanSpeed / zlib.meanSpeed : 0.0);
+		}
+#endif
+		printf("\n");
+	}
+	else
+	{
+		printf("%-12s decoding failed (%d)\n", name, error);
+	}
+
+	/* The same decode into a buffer for all of the output, which never
+	   slides, against the window's constant LZBUFFERSIZE bytes. */
+	if (error == 0 && options->fullBuffer && size < (size_t)INT_MAX - LZBUFFERSIZE)
+	{
+		int bufferSize = (int)size + MAXMATCH + COPYSLACK;
+		unsigned char *buffer = new unsigned char[bufferSize];
+		struct BenchmarkResult full;
+		benchmark.setOutputBuffer(buffer, bufferSize);
+		error = benchmark.measure(options->decodeMode, options->warmup, options->iterations, &full);
+		if (error == 0)
+		{
+			printf("%-12s %10d %6s %9.1f %9.1f %7.1f %7.2f  window at %.2fx in %d bytes\n", "  full buffer", bufferSize, "",
+				full.bestSpeed, full.meanSpeed, full.deviation, full.cyclesPerByte,
+				full.meanSpeed > 0 ? result.meanSpeed / full.meanSpeed : 0.0, LZBUFFERSIZE);
+		}
+		else
+		{
+			printf("%-12s full buffer decoding failed (%d)\n", name, error);
+		}
+		delete [] buffer;
+	}
+
+	delete [] compressed;
+	return error != 0;
+}
+
+/*
+* Print the throughput and the median and 99th percentile time per payload
+* of one way of decoding the payloads.  seconds is the time of all of the
+* iterations, and latencies has the time of each payload of each iteration.
+*/
+static void report(const char *name, double seconds, long long bytes, long long *latencies, int count)
+{
+	std::sort(latencies, latencies + count);
+	printf("%-12s %9.1f %9.1f %9.1f\n", name, seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+		latencies[count / 2] / 1e3, latencies[(int)((long long)count * 99 / 100)] / 1e3);
+}
+
+/*
+* Compare CBatchInflate with decoding the same payloads one call at a time,
+* each with a new window, output and decoder as main() makes them.  The
+* payloads are gzip members of 1 to 20K of JSON logs.  Returns 0, or 1 if
+* any output was wrong.
+*/
+static int batch(const struct SuiteOptions *options)
+{
+	int count = options->batch;
+	unsigned long long state = CORPUSSEED;
+	size_t sourceSize = SUITEPAYLOADMAX * 64;
+	unsigned char *source = new unsigned char[sourceSize];
+	CCorpus::generate(CORPUSJSON, source, sourceSize, CORPUSSEED);
+
+	/* Cut the payloads out of the corpus and compress each one. */
+	struct BatchInput *inputs = new struct BatchInput[count];
+	struct BatchOutput *outputs = new struct BatchOutput[count];
+	size_t *origins = new size_t[count];
+	size_t capacity = (size_t)count * (SUITEPAYLOADMAX + 1024);
+	unsigned char *compressed = new unsigned char[capacity];
+	CMemorySink compressedSink(compressed, capacity);
+	TDeflate<CMemorySink> deflate(&compressedSink, options->level);
+	deflate.setFormat(FORMATGZIP);
+	long long bytes = 0;
+	for (int n = 0; n < count; n++)
+	{
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		size_t length = SUITEPAYLOADMIN + (size_t)(state >> 33) % (SUITEPAYLOADMAX - SUITEPAYLOADMIN);
+		origins[n] = (size_t)(state >> 17) % (sourceSize - length);
+		long long before = compressedSink.getBytesWritten();
+		deflate.reset();
+		deflate.compress(&source[origins[n]], length, DEFLATEFINISH);
+		inputs[n].data = &compressed[before];
+		inputs[n].length = (size_t)(compressedSink.getBytesWritten() - before);
+		bytes += length;
+	}
+
+	int iterations = options->iterations;
+	long long *latencies = new long long[(size_t)count * iterations];
+	int failed = 0;
+	printf("\n%d payloads of %d to %d bytes, %d threads\n", count, SUITEPAYLOADMIN, SUITEPAYLOADMAX, options->threads);
+	printf("%-12s %9s %9s %9s\n", "decoder", "MB/s", "p50 us", "p99 us");
+
+	/* One call per payload, setting everything up each time. */
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		for (int n = 0; n < count; n++)
+		{
+			std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+			CLZ *lz = new CLZ();
+			CIO *io = new CIO(GROWABLEINITIALSIZE);
+			CHuffman huff(lz, io);
+			CGZip gzip(&huff);
+			int error = gzip.decompress(inputs[n].data, inputs[n].length);
+			if (iteration == 0 && (error != 0 || memcmp(io->getBuffer(), &source[origins[n]], (size_t)io->getBytesWritten()) != 0))
+			{
+				failed = 1;
+			}
+			delete lz;
+			delete io;
+			std::chrono::duration<long long, std::nano> elapsed = std::chrono::steady_clock::now() - started;
+			latencies[(size_t)iteration * count + n] = elapsed.count();
+		}
+	}
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	report("loop", seconds.count(), bytes * iterations, latencies, count * iterations);
+
+	/* The batch decoder on one thread, which shows what the pooling saves,
+	   and on all of them. */
+	int threadCounts[2] = { 1, options->threads };
+	for (int run = 0; run < (options->threads > 1 ? 2 : 1); run++)
+	{
+		CBatchInflate batchInflate(threadCounts[run]);
+		for (int n = 0; n < options->warmup; n++)
+		{
+			batchInflate.decompress(inputs, count, outputs);
+		}
+
+		start = std::chrono::steady_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			if (batchInflate.decompress(inputs, count, outputs) != 0)
+			{
+				failed = 1;
+			}
+			for (int n = 0; n < count; n++)
+			{
+				latencies[(size_t)iteration * count + n] = outputs[n].nanoseconds;
+			}
+		}
+		seconds = std::chrono::steady_clock::now() - start;
+
+		for (int n = 0; n < count; n++)
+		{
+			if (memcmp(outputs[n].data, &source[origins[n]], outputs[n].length) != 0)
+			{
+				failed = 1;
+			}
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "batch x%d", threadCounts[run]);
+		report(name, seconds.count(), bytes * iterations, latencies, count * iterations);
+	}
+
+	if (failed)
+	{
+		printf("batch outputs did not match\n");
+	}
+
+	delete [] latencies;
+	delete [] compressed;
+	delete [] origins;
+	delete [] outputs;
+	delete [] inputs;
+	delete [] source;
+	return failed;
+}
+
+/*
+* Benchmark suite.  Usage:
+*
+*	Benchmark [-size bytes] [-level n] [-mode n] [-warmup n] [-iterations n]
+*		[-cpu n] [-batch count] [-threads n] [file ...]
+*
+* Each synthetic corpus, and then each file given, is compressed in memory
+* with the encoder at -level (6 by default) and decoded with -mode
+* (MULTILITERALDECODE by default), so the numbers do not depend on what
+* compressor made some test file.  Speeds are in MB of output per second.
+* -batch also compares CBatchInflate on -threads threads (all of them by
+* default) with a loop of single calls, on count small payloads.  -fullbuffer
+* 1 also times each corpus decoded into one buffer for all of its output
+* rather than through the window, under it, with the bytes each needs.  The exit
+* code is 1 if anything failed, so a script can run it.
+*/
+int main(int argc, char* argv[])
+{
+	struct SuiteOptions options;
+	options.corpusSize = SUITECORPUSSIZE;
+	options.level = DEFLATEDEFAULT;
+	options.decodeMode = MULTILITERALDECODE;
+	options.warmup = BENCHWARMUP;
+	options.iterations = BENCHITERATIONS;
+	options.cpu = 0;
+	options.batch = 0;
+	options.threads = (int)std::thread::hardware_concurrency();
+	options.fullBuffer = 0;
+
+	int arg = 1;
+	for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+	{
+		long long value = atoll(argv[arg + 1]);
+		if (strcmp(argv[arg], "-size") == 0)
+		{
+			options.corpusSize = (size_t)value;
+		}
+		else if (strcmp(argv[arg], "-level") == 0)
+		{
+			options.level = (int)value;
+		}
+		else if (strcmp(argv[arg], "-mode") == 0)
+		{
+			options.decodeMode = (int)value;
+		}
+		else if (strcmp(argv[arg], "-warmup") == 0)
+		{
+			options.warmup = (int)value;
+		}
+		else if (strcmp(argv[arg], "-iterations") == 0 && value > 0)
+		{
+			options.iterations = (int)value;
+		}
+		else if (strcmp(argv[arg], "-cpu") == 0)
+		{
+			options.cpu = (int)value;
+		}
+		else if (strcmp(argv[arg], "-batch") == 0)
+		{
+			options.batch = (int)value;
+		}
+		else if (strcmp(argv[arg], "-threads") == 0)
+		{
+			options.threads = (int)value;
+		}
+		else if (strcmp(argv[arg], "-fullbuffer") == 0)
+		{
+			options.fullBuffer = (int)value;
+		}
+		else
+		{
+			printf("Unknown option %s.\n", argv[arg]);
+			return 1;
+		}
+	}
+
+	if (options.cpu >= 0 && !CBenchmark::pinThread(options.cpu))
+	{
+		printf("Could not pin to CPU %d, timing unpinned.\n", options.cpu);
+	}
+	printf("level %d, mode %d, %d warmup, %d iterations\n", options.level, options.decodeMode,
+		options.warmup, options.iterations);
+	printf("%-12s %10s %6s %9s %9s %7s %7s", "corpus", "bytes", "ratio", "best MB/s", "mean MB/s", "stddev", "cyc/B");
+#ifdef BENCHZLIB
+	printf(" %9s %8s", "zlib MB/s", "vs zlib");
+#endif
+	printf("\n");
+
+	int failed = 0;
+	unsigned char *corpus = new unsigned char[options.corpusSize > 0 ? options.corpusSize : 1];
+	for (int kind = 0; kind < CORPUSKINDS; kind++)
+	{
+		CCorpus::generate(kind, corpus, options.corpusSize, CORPUSSEED);
+		failed |= run(CCorpus::name(kind), corpus, options.corpusSize, &options);
+	}
+	delete [] corpus;
+
+	for (; arg < argc; arg++)
+	{
+		CMappedFile file;
+		if (file.open(argv[arg], MAPPOPULATE) != 0)
+		{
+			printf("%-12s could not be opened\n", argv[arg]);
+			failed = 1;
+			continue;
+		}
+		const char *name = argv[arg];
+		for (const char *p = argv[arg]; *p != 0; p++)
+		{
+			if (*p == '/' || *p == '\\')
+			{
+				name = p + 1;
+			}
+		}
+		failed |= run(name, file.data(), file.size(), &options);
+	}
+
+	if (options.batch > 0)
+	{
+		failed |= batch(&options);
+	}
+
+	return failed;
+}
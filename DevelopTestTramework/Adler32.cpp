@@ -0,0 +1,254 @@
+#include "stdafx.h"
+#include "Adler32.h"
+
+/* The vector sums are only used on x86. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ADLERSIMD
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SSSE3TARGET
+#define AVX2TARGET
+#else
+#include <cpuid.h>
+#define SSSE3TARGET __attribute__((target("ssse3")))
+#define AVX2TARGET __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+#endif
+
+/*
+* Update adler with length bytes of data.  Starting with adler 1 gives the
+* Adler-32 of data.
+*/
+unsigned int CAdler32::update(unsigned int adler, const unsigned char *data, size_t length)
+{
+	static const int level = getLevel();
+
+	if (level != ADLERSCALAR && length >= 64)
+	{
+		/* Sum whole 32-byte blocks and do the rest a byte at a time. */
+		size_t head = length & ~(size_t)31;
+		adler = level == ADLERAVX2 ? updateAvx2(adler, data, head) : updateSsse3(adler, data, head);
+		data += head;
+		length -= head;
+	}
+
+	return updateScalar(adler, data, length);
+}
+
+/// <summary>
+/// The best implementation the processor can run: ADLERAVX2, ADLERSSSE3 or
+/// ADLERSCALAR.
+/// </summary>
+int CAdler32::getLevel(void)
+{
+#ifdef ADLERSIMD
+	unsigned int eax, ebx, ecx, edx;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	ecx = (unsigned int)info[2];
+#else
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		return ADLERSCALAR;
+	}
+#endif
+	if ((ecx & (1 << 9)) == 0)
+	{
+		return ADLERSCALAR;
+	}
+
+	/* AVX2 also needs the system to save the YMM registers (OSXSAVE, and
+	   XCR0 bits 1 and 2). */
+	if ((ecx & (1 << 27)) != 0 && (ecx & (1 << 28)) != 0)
+	{
+#ifdef _MSC_VER
+		unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex(info, 7, 0);
+		ebx = (unsigned int)info[1];
+#else
+		__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		unsigned long long xcr0 = eax | ((unsigned long long)edx << 32);
+		if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		{
+			ebx = 0;
+		}
+#endif
+		if ((xcr0 & 6) == 6 && (ebx & (1 << 5)) != 0)
+		{
+			return ADLERAVX2;
+		}
+	}
+
+	return ADLERSSSE3;
+#else
+	return ADLERSCALAR;
+#endif
+}
+
+/*
+* A byte at a time, reducing the sums every ADLERNMAX bytes.
+*/
+unsigned int CAdler32::updateScalar(unsigned int adler, const unsigned char *data, size_t length)
+{
+	unsigned int s1 = adler & 0xffff;
+	unsigned int s2 = adler >> 16;
+
+	while (length > 0)
+	{
+		size_t count = length < ADLERNMAX ? length : ADLERNMAX;
+		length -= count;
+
+		while (count >= 8)
+		{
+			s1 += data[0]; s2 += s1;
+			s1 += data[1]; s2 += s1;
+			s1 += data[2]; s2 += s1;
+			s1 += data[3]; s2 += s1;
+			s1 += data[4]; s2 += s1;
+			s1 += data[5]; s2 += s1;
+			s1 += data[6]; s2 += s1;
+			s1 += data[7]; s2 += s1;
+			data += 8;
+			count -= 8;
+		}
+		while (count > 0)
+		{
+			s1 += *data++;
+			s2 += s1;
+			count--;
+		}
+
+		s1 %= ADLERBASE;
+		s2 %= ADLERBASE;
+	}
+
+	return s1 | (s2 << 16);
+}
+
+/*
+* Sum length bytes, a multiple of 32, sixteen bytes per instruction.
+*
+* Notes:
+*
+* - Over a block of 32 bytes, s1 grows by the sum of the bytes and s2 by 32
+*   times s1 at the start of the block plus each byte times 32, 31, ... 1.
+*   The byte sums come from SAD against zero, the weighted sums from a
+*   multiply-add of the bytes with those weights, and the s1 at the start of
+*   each block is added up in prefix and multiplied by 32 once at the end.
+*
+* - The lanes are only added together and reduced every ADLERNMAX bytes.
+*   The true sums fit in 32 bits until then, so the unsigned lane arithmetic
+*   gives them exactly even though the parts wrap.
+*/
+#ifdef ADLERSIMD
+SSSE3TARGET
+unsigned int CAdler32::updateSsse3(unsigned int adler, const unsigned char *data, size_t length)
+{
+	unsigned int s1 = adler & 0xffff;
+	unsigned int s2 = adler >> 16;
+	size_t blocks = length / 32;
+
+	const __m128i high = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+	const __m128i low = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+
+	while (blocks > 0)
+	{
+		size_t count = blocks < ADLERNMAX / 32 ? blocks : ADLERNMAX / 32;
+		blocks -= count;
+
+		__m128i prefix = _mm_setzero_si128();
+		__m128i sum1 = _mm_setzero_si128();
+		__m128i sum2 = _mm_setzero_si128();
+		s2 += s1 * 32 * (unsigned int)count;
+		for (size_t n = 0; n < count; n++)
+		{
+			__m128i first = _mm_loadu_si128((const __m128i *)data);
+			__m128i second = _mm_loadu_si128((const __m128i *)(data + 16));
+			prefix = _mm_add_epi32(prefix, sum1);
+			sum1 = _mm_add_epi32(sum1, _mm_add_epi32(_mm_sad_epu8(first, zero), _mm_sad_epu8(second, zero)));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_maddubs_epi16(first, high), ones));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_maddubs_epi16(second, low), ones));
+			data += 32;
+		}
+		sum2 = _mm_add_epi32(sum2, _mm_slli_epi32(prefix, 5));
+
+		/* add up the four lanes of each */
+		sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+		sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+		s1 += (unsigned int)_mm_cvtsi128_si32(sum1);
+		s2 += (unsigned int)_mm_cvtsi128_si32(sum2);
+
+		s1 %= ADLERBASE;
+		s2 %= ADLERBASE;
+	}
+
+	return s1 | (s2 << 16);
+}
+
+/*
+* The same with 32 bytes per instruction.
+*/
+AVX2TARGET
+unsigned int CAdler32::updateAvx2(unsigned int adler, const unsigned char *data, size_t length)
+{
+	unsigned int s1 = adler & 0xffff;
+	unsigned int s2 = adler >> 16;
+	size_t blocks = length / 32;
+
+	const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i zero = _mm256_setzero_si256();
+
+	while (blocks > 0)
+	{
+		size_t count = blocks < ADLERNMAX / 32 ? blocks : ADLERNMAX / 32;
+		blocks -= count;
+
+		__m256i prefix = _mm256_setzero_si256();
+		__m256i sum1 = _mm256_setzero_si256();
+		__m256i sum2 = _mm256_setzero_si256();
+		s2 += s1 * 32 * (unsigned int)count;
+		for (size_t n = 0; n < count; n++)
+		{
+			__m256i bytes = _mm256_loadu_si256((const __m256i *)data);
+			prefix = _mm256_add_epi32(prefix, sum1);
+			sum1 = _mm256_add_epi32(sum1, _mm256_sad_epu8(bytes, zero));
+			sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+			data += 32;
+		}
+		sum2 = _mm256_add_epi32(sum2, _mm256_slli_epi32(prefix, 5));
+
+		/* add up the eight lanes of each */
+		__m128i total1 = _mm_add_epi32(_mm256_castsi256_si128(sum1), _mm256_extracti128_si256(sum1, 1));
+		__m128i total2 = _mm_add_epi32(_mm256_castsi256_si128(sum2), _mm256_extracti128_si256(sum2, 1));
+		total1 = _mm_add_epi32(total1, _mm_shuffle_epi32(total1, _MM_SHUFFLE(1, 0, 3, 2)));
+		total1 = _mm_add_epi32(total1, _mm_shuffle_epi32(total1, _MM_SHUFFLE(2, 3, 0, 1)));
+		total2 = _mm_add_epi32(total2, _mm_shuffle_epi32(total2, _MM_SHUFFLE(1, 0, 3, 2)));
+		total2 = _mm_add_epi32(total2, _mm_shuffle_epi32(total2, _MM_SHUFFLE(2, 3, 0, 1)));
+		s1 += (unsigned int)_mm_cvtsi128_si32(total1);
+		s2 += (unsigned int)_mm_cvtsi128_si32(total2);
+
+		s1 %= ADLERBASE;
+		s2 %= ADLERBASE;
+	}
+
+	return s1 | (s2 << 16);
+}
+#else
+unsigned int CAdler32::updateSsse3(unsigned int adler, const unsigned char *data, size_t length)
+{
+	return updateScalar(adler, data, length);
+}
+
+unsigned int CAdler32::updateAvx2(unsigned int adler, const unsigned char *data, size_t length)
+{
+	return updateScalar(adler, data, length);
+}
+#endif
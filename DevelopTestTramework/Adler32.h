@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+
+/* Adler-32 works modulo the largest prime below 2^16. */
+#define ADLERBASE 65521
+
+/*
+	The most bytes that can be added up before the sums have to be reduced
+	modulo ADLERBASE: the largest n with 255n(n+1)/2 + (n+1)(ADLERBASE-1)
+	below 2^32.
+*/
+#define ADLERNMAX 5552
+
+/* Implementations that update() can pick, best last. */
+#define ADLERSCALAR 0
+#define ADLERSSSE3 1
+#define ADLERAVX2 2
+
+/*
+	Adler-32 as used in the zlib trailer (RFC 1950). Values are the same as
+	zlib's adler32(), so update() can be called piece by piece starting from
+	1 and the pieces can be any size.
+
+	Both sums are kept for 32 or 64 bytes at a time in vector registers when
+	the processor has SSSE3 or AVX2: the bytes are added up with SAD against
+	zero, and weighted by their distance from the end of the block with a
+	multiply-add, so the modulo only has to be taken once every ADLERNMAX
+	bytes.
+*/
+class CAdler32
+{
+public:
+	static unsigned int update(unsigned int adler, const unsigned char *data, size_t length);
+	static int getLevel(void);
+
+private:
+	static unsigned int updateScalar(unsigned int adler, const unsigned char *data, size_t length);
+	static unsigned int updateSsse3(unsigned int adler, const unsigned char *data, size_t length);
+	static unsigned int updateAvx2(unsigned int adler, const unsigned char *data, size_t length);
+};
@@ -0,0 +1,311 @@
+#include "stdafx.h"
+#include <string.h>
+#include <chrono>
+#include "BatchInflate.h"
+
+CBatchInflate::CBatchInflate(int threads)
+{
+	this->threads = threads > 0 ? threads : 1;
+	inputs = NULL;
+	outputs = NULL;
+	offsets = NULL;
+	owners = NULL;
+	itemCapacity = 0;
+	stolen = 0;
+	generation = 0;
+	finished = 0;
+	stopping = false;
+
+	workers = new struct BatchWorker[this->threads];
+	for (int t = 0; t < this->threads; t++)
+	{
+		struct BatchWorker *worker = &workers[t];
+		worker->pOwner = this;
+		worker->index = t;
+		worker->pSink = new CCallbackSink(collect, worker);
+		worker->pLZ = new TLZ<CCallbackSink>();
+		worker->pHuffman = new THuffman<CCallbackSink>(worker->pLZ, worker->pSink);
+		worker->pGZip = new TGZip<CCallbackSink>(worker->pHuffman);
+		worker->arena = new unsigned char[BATCHARENASIZE];
+		worker->arenaLength = 0;
+		worker->arenaCapacity = BATCHARENASIZE;
+		worker->next = worker->end = 0;
+	}
+
+	/* Worker 0 is whichever thread calls decompress(). */
+	for (int t = 1; t < this->threads; t++)
+	{
+		workers[t].thread = std::thread(run, &workers[t]);
+	}
+}
+
+CBatchInflate::~CBatchInflate()
+{
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+		stopping = true;
+	}
+	start.notify_all();
+
+	for (int t = 0; t < threads; t++)
+	{
+		struct BatchWorker *worker = &workers[t];
+		if (worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+		delete worker->pGZip;
+		delete worker->pHuffman;
+		delete worker->pLZ;
+		delete worker->pSink;
+		delete [] worker->arena;
+	}
+	delete [] workers;
+	delete [] offsets;
+	delete [] owners;
+}
+
+/*
+* Decompress count gzip payloads, inputs[n] to outputs[n].  Each payload may
+* have several members, as a gzip file can.  Returns 0 if every payload was
+* decoded, or the error of the first one that was not; the error of each is
+* in its output either way.
+*
+* Notes:
+*
+* - The outputs are only turned into pointers once every worker is done,
+*   since an arena can still move while it grows.
+*/
+int CBatchInflate::decompress(const struct BatchInput *inputs, int count, struct BatchOutput *outputs)
+{
+	if (count > itemCapacity)
+	{
+		delete [] offsets;
+		delete [] owners;
+		offsets = new size_t[count];
+		owners = new int[count];
+		itemCapacity = count;
+	}
+	this->inputs = inputs;
+	this->outputs = outputs;
+	stolen = 0;
+
+	/* Deal the payloads out in equal ranges and start over in each arena. */
+	for (int t = 0; t < threads; t++)
+	{
+		struct BatchWorker *worker = &workers[t];
+		std::lock_guard<std::mutex> guard(worker->lock);
+		worker->next = (int)((long long)count * t / threads);
+		worker->end = (int)((long long)count * (t + 1) / threads);
+		worker->arenaLength = 0;
+	}
+
+	if (threads > 1)
+	{
+		{
+			std::lock_guard<std::mutex> guard(poolLock);
+			finished = 0;
+			generation++;
+		}
+		start.notify_all();
+	}
+
+	work(&workers[0]);
+
+	if (threads > 1)
+	{
+		std::unique_lock<std::mutex> guard(poolLock);
+		while (finished < threads - 1)
+		{
+			done.wait(guard);
+		}
+	}
+
+	int error = 0;
+	for (int n = 0; n < count; n++)
+	{
+		outputs[n].data = &workers[owners[n]].arena[offsets[n]];
+		if (error == 0)
+		{
+			error = outputs[n].error;
+		}
+	}
+
+	return error;
+}
+
+/*
+* Thread body of the helpers: decode a share of each batch until the batch
+* decoder is destroyed.
+*/
+void CBatchInflate::run(struct BatchWorker *worker)
+{
+	CBatchInflate *self = worker->pOwner;
+	long long seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(self->poolLock);
+			while (!self->stopping && self->generation == seen)
+			{
+				self->start.wait(guard);
+			}
+			if (self->stopping)
+			{
+				return;
+			}
+			seen = self->generation;
+		}
+
+		self->work(worker);
+
+		{
+			std::lock_guard<std::mutex> guard(self->poolLock);
+			self->finished++;
+		}
+		self->done.notify_one();
+	}
+}
+
+/*
+* Decode payloads from the worker's own range, and then from the ranges of
+* the others, until there are none left anywhere.
+*/
+void CBatchInflate::work(struct BatchWorker *worker)
+{
+	for (;;)
+	{
+		int item = take(worker);
+		if (item < 0)
+		{
+			item = steal(worker);
+			if (item < 0)
+			{
+				break;
+			}
+		}
+		decode(worker, item);
+	}
+}
+
+/// <summary>
+/// The next payload of the worker's own range, or -1 if it is empty.
+/// </summary>
+int CBatchInflate::take(struct BatchWorker *worker)
+{
+	std::lock_guard<std::mutex> guard(worker->lock);
+	return worker->next < worker->end ? worker->next++ : -1;
+}
+
+/*
+* Move the back half of the range of the first other worker that has any
+* left into this worker's range, and take the first payload of it.  Returns
+* -1 if every range is empty, which ends the batch for this worker, since
+* ranges only ever shrink until the next batch.
+*
+* Notes:
+*
+* - Only one lock is held at a time.  The stolen range is out of the
+*   victim's range before it is in the thief's, which only means another
+*   thief that looks in between finds it in neither.
+*/
+int CBatchInflate::steal(struct BatchWorker *worker)
+{
+	for (int n = 1; n < threads; n++)
+	{
+		struct BatchWorker *victim = &workers[(worker->index + n) % threads];
+		int first, end;
+		{
+			std::lock_guard<std::mutex> guard(victim->lock);
+			int left = victim->end - victim->next;
+			if (left <= 0)
+			{
+				continue;
+			}
+			end = victim->end;
+			first = end - (left + 1) / 2;
+			victim->end = first;
+		}
+
+		stolen += end - first;
+		std::lock_guard<std::mutex> guard(worker->lock);
+		worker->next = first + 1;
+		worker->end = end;
+		return first;
+	}
+
+	return -1;
+}
+
+/*
+* Decode one payload onto the end of the worker's arena.
+*/
+void CBatchInflate::decode(struct BatchWorker *worker, int item)
+{
+	const struct BatchInput *input = &inputs[item];
+	struct BatchOutput *output = &outputs[item];
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	/* The trailer of the last member gives the output size modulo 2^32,
+	   which for a single member payload is exact, so the arena is grown
+	   once up front instead of while it is being written. */
+	if (input->length >= 4)
+	{
+		const unsigned char *isize = &input->data[input->length - 4];
+		size_t hint = (size_t)isize[0] | ((size_t)isize[1] << 8) | ((size_t)isize[2] << 16) | ((size_t)isize[3] << 24);
+		if (hint <= BATCHMAXHINT)
+		{
+			reserve(worker, hint);
+		}
+	}
+
+	size_t offset = worker->arenaLength;
+	output->error = worker->pGZip->decompress(input->data, input->length);
+	output->length = worker->arenaLength - offset;
+	offsets[item] = offset;
+	owners[item] = worker->index;
+
+	std::chrono::duration<long long, std::nano> elapsed = std::chrono::steady_clock::now() - started;
+	output->nanoseconds = elapsed.count();
+}
+
+/*
+* Sink callback: append decoded bytes to the worker's arena.
+*/
+int CBatchInflate::collect(void *context, const unsigned char *data, int size)
+{
+	struct BatchWorker *worker = (struct BatchWorker *)context;
+
+	reserve(worker, size);
+	memcpy(&worker->arena[worker->arenaLength], data, size);
+	worker->arenaLength += size;
+	return size;
+}
+
+/// <summary>
+/// Makes room for size more bytes in the worker's arena, at least doubling
+/// it when it has to grow.
+/// </summary>
+void CBatchInflate::reserve(struct BatchWorker *worker, size_t size)
+{
+	if (worker->arenaLength + size <= worker->arenaCapacity)
+	{
+		return;
+	}
+
+	size_t capacity = worker->arenaCapacity * 2;
+	while (capacity < worker->arenaLength + size)
+	{
+		capacity *= 2;
+	}
+	unsigned char *grown = new unsigned char[capacity];
+	if (worker->arenaLength > 0)
+	{
+		memcpy(grown, worker->arena, worker->arenaLength);
+	}
+	delete [] worker->arena;
+	worker->arena = grown;
+	worker->arenaCapacity = capacity;
+}
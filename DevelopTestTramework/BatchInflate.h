@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "Huffman.h"
+#include "GZip.h"
+
+/* Output bytes each worker's arena starts with. */
+#define BATCHARENASIZE (1 << 20)
+
+/* Largest ISIZE that is trusted to reserve arena room before decoding. */
+#define BATCHMAXHINT (64 << 20)
+
+/*
+	One gzip payload of a batch, and what it decompressed to. The output
+	points into the arena of the worker that decoded it and stays valid
+	until the next decompress().
+*/
+struct BatchInput
+{
+	const unsigned char *data;
+	size_t length;
+};
+
+struct BatchOutput
+{
+	const unsigned char *data;
+	size_t length;
+	int error;					/* from TGZip::decompress() */
+	long long nanoseconds;		/* time spent decoding it */
+};
+
+class CBatchInflate;
+
+/*
+	A thread of the pool, with its own decoder and output arena, and the
+	range of the batch it still has to decode.
+*/
+struct BatchWorker
+{
+	CBatchInflate *pOwner;
+	int index;
+	CCallbackSink *pSink;
+	TLZ<CCallbackSink> *pLZ;
+	THuffman<CCallbackSink> *pHuffman;
+	TGZip<CCallbackSink> *pGZip;
+	unsigned char *arena;
+	size_t arenaLength, arenaCapacity;
+	std::mutex lock;			/* guards next and end, which thieves change */
+	int next, end;
+	std::thread thread;
+};
+
+/*
+	Decompresses many small gzip payloads, such as request bodies, with a
+	fixed pool of threads.
+
+	Everything a decode needs is made once when the batch decoder is made
+	and then reused: each worker keeps its window, decoder and gzip parser,
+	and writes all of its output one payload after the other into an arena
+	that only grows, so decoding a payload allocates nothing. For payloads
+	of a few kilobytes, setting those up per call costs as much as the
+	decoding itself.
+
+	The payloads are dealt out to the workers in equal ranges. A worker
+	takes the payloads of its own range from the front, and when it has run
+	out it steals the back half of the range of another worker that still
+	has some, so one large payload does not hold up the rest of the batch.
+	The calling thread works as worker 0; the other threads wait for the
+	next batch between calls.
+*/
+class CBatchInflate
+{
+public:
+	CBatchInflate(int threads);
+	~CBatchInflate();
+
+	int decompress(const struct BatchInput *inputs, int count, struct BatchOutput *outputs);
+
+	/// <summary>
+	/// Number of payloads that were decoded by a worker other than the one
+	/// they were first dealt to, in the last decompress().
+	/// </summary>
+	int getStolen() const
+	{
+		return stolen;
+	}
+
+private:
+	void work(struct BatchWorker *worker);
+	int take(struct BatchWorker *worker);
+	int steal(struct BatchWorker *worker);
+	void decode(struct BatchWorker *worker, int item);
+
+	static void run(struct BatchWorker *worker);
+	static int collect(void *context, const unsigned char *data, int size);
+	static void reserve(struct BatchWorker *worker, size_t size);
+
+	int threads;
+	struct BatchWorker *workers;
+
+	/* The batch being decoded. */
+	const struct BatchInput *inputs;
+	struct BatchOutput *outputs;
+	size_t *offsets;			/* where each output starts in its worker's arena */
+	int *owners;				/* which worker decoded it */
+	int itemCapacity;
+	std::atomic<int> stolen;
+
+	/* Starting the helper threads on a batch and waiting for them. */
+	std::mutex poolLock;
+	std::condition_variable start, done;
+	long long generation;		/* batches started */
+	int finished;				/* helpers done with the current batch */
+	bool stopping;
+};
@@ -0,0 +1,258 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include "Benchmark.h"
+#include "Huffman.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+/* The time stamp counter is only read on x86. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BENCHTSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+#ifdef BENCHZLIB
+#include <zlib.h>
+#endif
+
+CBenchmark::CBenchmark(const unsigned char *data, size_t size)
+{
+	this->data = data;
+	this->size = size;
+	outputBuffer = NULL;
+	outputSize = 0;
+}
+
+/// <summary>
+/// Decodes the stream BENCHMARKREPEATS times with the given decode mode and
+/// returns the fastest time in seconds. The uncompressed length and the
+/// decoder's error code are passed back.
+/// </summary>
+double CBenchmark::decodeSeconds(int decodeMode, long long *outLength, int *error)
+{
+	double best = 0;
+
+	for (int repeat = 0; repeat < BENCHMARKREPEATS; repeat++)
+	{
+		TLZ<CNullSink> lz;
+		CNullSink sink;
+		lz.setIO(&sink);
+		THuffman<CNullSink> huff(&lz, &sink);
+		huff.setDecodeMode(decodeMode);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		huff.decompress(data, size);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		*outLength = sink.getBytesWritten();
+		*error = huff.error;
+		if (repeat == 0 || elapsed.count() < best)
+		{
+			best = elapsed.count();
+		}
+	}
+
+	return best;
+}
+
+/// <summary>
+/// Prints the speed of each decode mode on the stream, in megabytes of
+/// output per second, and how much faster the multiple literal table is
+/// than the plain lookup table. Returns the first decoder error, or 0.
+/// </summary>
+int CBenchmark::compareDecodeModes(const char *name)
+{
+	static const int modes[3] = { CANONICALDECODE, TABLEDECODE, MULTILITERALDECODE };
+	static const char *modeNames[3] = { "canonical", "table", "multi-literal" };
+	double seconds[3];
+	long long length = 0;
+	int error = 0;
+
+	printf("%s: %zu bytes compressed\n", name, size);
+	for (int mode = 0; mode < 3; mode++)
+	{
+		seconds[mode] = decodeSeconds(modes[mode], &length, &error);
+		if (error != 0)
+		{
+			printf("  %-14s failed (%d)\n", modeNames[mode], error);
+			return error;
+		}
+		printf("  %-14s %10lld bytes  %8.1f MB/s\n", modeNames[mode], length,
+			length / seconds[mode] / 1e6);
+	}
+	printf("  multi-literal is %.2fx the table decoder\n", seconds[1] / seconds[2]);
+
+	return 0;
+}
+
+/// <summary>
+/// Decodes the stream warmup times untimed and then iterations times, each
+/// one timed on its own, and fills in result. Returns the decoder's error,
+/// or 0.
+/// </summary>
+int CBenchmark::measure(int decodeMode, int warmup, int iterations, struct BenchmarkResult *result)
+{
+	double *seconds = new double[iterations];
+	unsigned long long *elapsedTicks = new unsigned long long[iterations];
+
+	result->error = 0;
+	for (int n = -warmup; n < iterations && result->error == 0; n++)
+	{
+		TLZ<CNullSink> lz;
+		CNullSink sink;
+		lz.setIO(&sink);
+		lz.setOutputBuffer(outputBuffer, outputSize);
+		THuffman<CNullSink> huff(&lz, &sink);
+		huff.setDecodeMode(decodeMode);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		unsigned long long startTicks = ticks();
+		huff.decompress(data, size);
+		unsigned long long endTicks = ticks();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		result->length = sink.getBytesWritten();
+		result->error = huff.error;
+		if (n >= 0)
+		{
+			seconds[n] = elapsed.count();
+			elapsedTicks[n] = endTicks - startTicks;
+		}
+	}
+
+	if (result->error == 0)
+	{
+		summarize(seconds, elapsedTicks, iterations, result);
+	}
+	delete [] seconds;
+	delete [] elapsedTicks;
+
+	return result->error;
+}
+
+#ifdef BENCHZLIB
+/// <summary>
+/// measure() for zlib's inflate() on the same raw deflate stream. The
+/// output goes to a 64K buffer that is reused, much as the window is.
+/// Returns 0, or zlib's error.
+/// </summary>
+int CBenchmark::measureZlib(int warmup, int iterations, struct BenchmarkResult *result)
+{
+	double *seconds = new double[iterations];
+	unsigned long long *elapsedTicks = new unsigned long long[iterations];
+	unsigned char *out = new unsigned char[65536];
+
+	result->error = 0;
+	for (int n = -warmup; n < iterations && result->error == 0; n++)
+	{
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		if (inflateInit2(&stream, -15) != Z_OK)
+		{
+			result->error = Z_MEM_ERROR;
+			break;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		unsigned long long startTicks = ticks();
+		stream.next_in = (Bytef *)data;
+		stream.avail_in = (uInt)size;
+		int ret;
+		do
+		{
+			stream.next_out = out;
+			stream.avail_out = 65536;
+			ret = inflate(&stream, Z_NO_FLUSH);
+		} while (ret == Z_OK);
+		unsigned long long endTicks = ticks();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		result->length = stream.total_out;
+		result->error = ret == Z_STREAM_END ? 0 : ret;
+		inflateEnd(&stream);
+		if (n >= 0)
+		{
+			seconds[n] = elapsed.count();
+			elapsedTicks[n] = endTicks - startTicks;
+		}
+	}
+
+	if (result->error == 0)
+	{
+		summarize(seconds, elapsedTicks, iterations, result);
+	}
+	delete [] seconds;
+	delete [] elapsedTicks;
+	delete [] out;
+
+	return result->error;
+}
+#endif
+
+/// <summary>
+/// Keeps the calling thread on the given CPU. Returns false where that is
+/// not supported or not allowed.
+/// </summary>
+bool CBenchmark::pinThread(int cpu)
+{
+#ifdef _WIN32
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(CPU_SET)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+/*
+* Read the time stamp counter, or 0 where there is none.
+*/
+unsigned long long CBenchmark::ticks(void)
+{
+#ifdef BENCHTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/*
+* Turn the times of the iterations into the speeds in result, which
+* already has the length of the output.
+*/
+void CBenchmark::summarize(const double *seconds, const unsigned long long *elapsedTicks, int iterations, struct BenchmarkResult *result)
+{
+	double sum = 0, squares = 0, best = 0, cycles = 0;
+
+	for (int n = 0; n < iterations; n++)
+	{
+		double speed = seconds[n] > 0 ? result->length / seconds[n] / 1e6 : 0;
+		sum += speed;
+		squares += speed * speed;
+		if (speed > best)
+		{
+			best = speed;
+		}
+		cycles += result->length > 0 ? (double)elapsedTicks[n] / result->length : 0;
+	}
+
+	result->bestSpeed = best;
+	result->meanSpeed = iterations > 0 ? sum / iterations : 0;
+	double variance = iterations > 1 ? (squares - sum * sum / iterations) / (iterations - 1) : 0;
+	result->deviation = variance > 0 ? sqrt(variance) : 0;
+	result->cyclesPerByte = iterations > 0 ? cycles / iterations : 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <stddef.h>
+
+/* How many times each measurement is repeated. The best time is reported. */
+#define BENCHMARKREPEATS 5
+
+/* Untimed and timed decodes per measurement by default. */
+#define BENCHWARMUP 3
+#define BENCHITERATIONS 20
+
+/*
+	What measure() found. Speeds are in megabytes (10^6) of output per
+	second; cycles are time stamp counter ticks, which run at a constant
+	rate close to the nominal clock on current x86 processors, and are 0
+	where there is no counter.
+*/
+struct BenchmarkResult
+{
+	long long length;		/* bytes of output of one decode */
+	double bestSpeed;		/* of the fastest iteration */
+	double meanSpeed;
+	double deviation;		/* standard deviation of the speeds */
+	double cyclesPerByte;	/* mean over the iterations */
+	int error;
+};
+
+/*
+	Times the decoder on a deflate stream held in memory. The output goes to
+	a CNullSink, so only the decoder is measured and not the memory or disk
+	it would write to.
+
+	measure() is the careful version used by the benchmark suite: it decodes
+	a few times first to warm the caches and the branch predictors, then
+	times each of many decodes on its own, so the spread between them shows
+	how far a single number can be trusted. Pinning the thread to one CPU
+	first keeps it from being moved between cores in the middle of a run.
+	Built with BENCHZLIB defined (and zlib linked), measureZlib() times
+	zlib's inflate() the same way on the same stream.
+
+	After setOutputBuffer(), measure() decodes into a buffer that holds the
+	whole output instead of through the window, which shows what sliding
+	the window, and keeping memory constant with it, costs.
+*/
+class CBenchmark
+{
+public:
+	CBenchmark(const unsigned char *data, size_t size);
+
+	double decodeSeconds(int decodeMode, long long *outLength, int *error);
+	int compareDecodeModes(const char *name);
+	int measure(int decodeMode, int warmup, int iterations, struct BenchmarkResult *result);
+#ifdef BENCHZLIB
+	int measureZlib(int warmup, int iterations, struct BenchmarkResult *result);
+#endif
+
+	static bool pinThread(int cpu);
+
+	/// <summary>
+	/// Makes measure() decode into buffer, which has room for size bytes, or
+	/// through the window again with NULL.
+	/// </summary>
+	void setOutputBuffer(unsigned char *buffer, int size)
+	{
+		outputBuffer = buffer;
+		outputSize = size;
+	}
+
+private:
+	static unsigned long long ticks(void);
+	static void summarize(const double *seconds, const unsigned long long *elapsedTicks, int iterations, struct BenchmarkResult *result);
+
+	const unsigned char *data;
+	size_t size;
+	unsigned char *outputBuffer;	/* see TLZ::setOutputBuffer(), NULL for the window */
+	int outputSize;
+};
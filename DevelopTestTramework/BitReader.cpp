@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include "BitReader.h"
+
+CBitReader::CBitReader()
+{
+	setInput(NULL, 0);
+}
+
+CBitReader::~CBitReader()
+{
+}
+
+/// <summary>
+/// Starts reading from a new block of input.
+/// </summary>
+/// <param name="data">Address of the data.</param>
+/// <param name="length">Number of bytes of data.</param>
+void CBitReader::setInput(const unsigned char *data, size_t length)
+{
+	dataIn = data;
+	byteLength = length;
+	byteIndex = 0;
+	bitBuffer = 0;
+	bitCount = 0;
+	overrun = 0;
+}
+
+/*
+* Continue with a new block of input, keeping the bits that are still in the
+* buffer.  data must start with the bytesBuffered() whole bytes that are
+* still in the buffer and the bytesAvailable() bytes of the old input that
+* were not loaded yet, followed by whatever comes next.  The buffered bytes
+* are only there so that alignToByte() can give them back.  Zero bytes that
+* were added past the end of the old input are taken out again first, since
+* the new input supplies the real values.  Must not be called once
+* exhausted() is true.
+*/
+void CBitReader::moreInput(const unsigned char *data, size_t length)
+{
+	int buffered = bytesBuffered();
+
+	bitCount -= overrun * 8;
+	overrun = 0;
+	bitBuffer &= (1ULL << bitCount) - 1;
+
+	dataIn = data;
+	byteLength = length;
+	byteIndex = buffered;
+}
+
+/*
+* Refill one byte at a time near the end of the input.  Once the input is
+* used up zero bytes are appended instead, and counted in overrun so that
+* exhausted() can tell real bits from padding.
+*/
+void CBitReader::refillTail(void)
+{
+	while (bitCount <= 56)
+	{
+		if (byteIndex < byteLength)
+		{
+			bitBuffer |= (unsigned long long)dataIn[byteIndex++] << bitCount;
+		}
+		else
+		{
+			overrun++;
+		}
+		bitCount += 8;
+	}
+}
+
+/*
+* Discard the bits up to the next byte boundary and hand any whole bytes that
+* are still in the buffer back to the input, so that current() points at the
+* next unread byte.  Returns -1 if the input had already run out.
+*/
+int CBitReader::alignToByte(void)
+{
+	int unread = (bitCount >> 3) - overrun;
+
+	if (unread < 0)
+	{
+		return -1;
+	}
+
+	byteIndex -= unread;
+	bitBuffer = 0;
+	bitCount = 0;
+	overrun = 0;
+
+	return 0;
+}
+
+/// <summary>
+/// Moves to an arbitrary bit offset of the input, discarding the buffer.
+/// </summary>
+void CBitReader::seek(long long bit)
+{
+	byteIndex = (size_t)(bit >> 3);
+	bitBuffer = 0;
+	bitCount = 0;
+	overrun = 0;
+
+	refill();
+	bitBuffer >>= bit & 7;
+	bitCount -= (int)(bit & 7);
+}
+
+/// <summary>
+/// Address of the next unread byte. Only valid right after alignToByte().
+/// </summary>
+const unsigned char *CBitReader::current(void) const
+{
+	return &dataIn[byteIndex];
+}
+
+/// <summary>
+/// Skips bytes after alignToByte(), for example the body of a stored block.
+/// </summary>
+void CBitReader::skip(int count)
+{
+	byteIndex += count;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <memory.h>
+#include <stddef.h>
+
+/*
+	Bit reader used by the decoder. Bits are kept in a 64-bit accumulator that
+	is refilled with a single unaligned eight-byte load while at least eight
+	bytes of input remain, so the bounds are only checked once per refill
+	rather than once per bit. The last few bytes of the input are loaded one
+	at a time, and reads past the end of the input return zero bits. Callers
+	check exhausted() to find out whether any of those were actually used.
+
+	The eight-byte load assumes a little-endian machine, which is what all of
+	our targets are.
+*/
+class CBitReader
+{
+public:
+	CBitReader();
+	~CBitReader();
+
+	void setInput(const unsigned char *data, size_t length);
+	void moreInput(const unsigned char *data, size_t length);
+
+	/// <summary>
+	/// Tops up the accumulator so that it holds at least 56 bits.
+	/// </summary>
+	void refill()
+	{
+		if (byteLength - byteIndex >= 8)
+		{
+			unsigned long long word;
+			memcpy(&word, &dataIn[byteIndex], 8);
+			/* Bits above bitCount that are already in the buffer came from
+			   the same bytes, so or-ing them in again changes nothing. */
+			bitBuffer |= word << bitCount;
+			byteIndex += (63 - bitCount) >> 3;
+			bitCount |= 56;
+		}
+		else
+		{
+			refillTail();
+		}
+	}
+
+	/// <summary>
+	/// Returns the next count bits (at most 32) without removing them.
+	/// </summary>
+	unsigned int peek(int count) const
+	{
+		return (unsigned int)bitBuffer & (unsigned int)((1ULL << count) - 1);
+	}
+
+	/// <summary>
+	/// Removes count bits. There must be at least that many in the buffer.
+	/// </summary>
+	void consume(int count)
+	{
+		bitBuffer >>= count;
+		bitCount -= count;
+	}
+
+	/// <summary>
+	/// Returns and removes the next need bits, refilling if necessary.
+	/// </summary>
+	int getBits(int need)
+	{
+		if (bitCount < need)
+		{
+			refill();
+		}
+		int value = (int)peek(need);
+		consume(need);
+		return value;
+	}
+
+	/// <summary>
+	/// True once more bits have been consumed than the input holds.
+	/// </summary>
+	bool exhausted() const
+	{
+		return bitCount < overrun * 8;
+	}
+
+	/// <summary>
+	/// Number of bits in the buffer that came from real input.
+	/// </summary>
+	int bitsAvailable() const
+	{
+		return bitCount - overrun * 8;
+	}
+
+	/// <summary>
+	/// Number of whole bytes of real input that are loaded in the buffer but
+	/// not used yet. alignToByte() can give these back to the input.
+	/// </summary>
+	int bytesBuffered() const
+	{
+		int bytes = (bitCount >> 3) - overrun;
+		return bytes > 0 ? bytes : 0;
+	}
+
+	/// <summary>
+	/// Number of bytes of input not yet loaded into the buffer.
+	/// </summary>
+	size_t bytesAvailable() const
+	{
+		return byteLength - byteIndex;
+	}
+
+	/// <summary>
+	/// Offset of the next unused bit from the start of the input.
+	/// </summary>
+	long long bitPosition() const
+	{
+		return (long long)(byteIndex + overrun) * 8 - bitCount;
+	}
+
+	void seek(long long bit);
+	int alignToByte(void);
+	const unsigned char *current(void) const;
+	void skip(int count);
+
+	const unsigned char *dataIn;
+	size_t byteLength, byteIndex;
+	unsigned long long bitBuffer;
+	int bitCount;
+
+private:
+	void refillTail(void);
+
+	int overrun;	/* zero bytes loaded from past the end of the input */
+};
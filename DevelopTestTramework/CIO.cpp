@@ -1 +1,284 @@
+#include "stdafx.h"
 #include "CIO.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <new>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/*
+* Output to a file through a large aligned buffer.  The file at filePath is
+* created or truncated.  Small writes are collected in the buffer and written
+* bufferSize bytes at a time; see outputToBufferedDisk().  If the file cannot
+* be opened, getError() returns OUTPUTWRITEFAILED.
+*/
+CIO::CIO(const char *filePath, int bufferSize)
+{
+	init();
+	type = BUFFEREDDISK;
+	writeSize = bufferSize > 0 ? bufferSize : DISKBUFFERSIZE;
+
+#ifdef _WIN32
+	fd = _open(filePath, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+	writeBuffer = (unsigned char *)_aligned_malloc(writeSize, DISKBUFFERALIGN);
+#else
+	fd = ::open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	void *buffer = NULL;
+	if (posix_memalign(&buffer, DISKBUFFERALIGN, writeSize) == 0)
+	{
+		writeBuffer = (unsigned char *)buffer;
+	}
+#endif
+
+	if (fd < 0 || writeBuffer == NULL)
+	{
+		error = OUTPUTWRITEFAILED;
+	}
+}
+
+CIO::~CIO()
+{
+	close();
+
+	if (ownsBuffer)
+	{
+		delete [] pOutBuffer;
+	}
+
+#ifdef _WIN32
+	_aligned_free(writeBuffer);
+#else
+	free(writeBuffer);
+#endif
+}
+
+/// <summary>
+/// Sets every member to its empty value, for the constructors.
+/// </summary>
+void CIO::init(void)
+{
+	fp = NULL;
+	size = 0;
+	pOutBuffer = NULL;
+	dataIndex = 0;
+	type = 0;
+	ownsBuffer = false;
+	fd = -1;
+	writeBuffer = NULL;
+	writeSize = writeFill = 0;
+	bytesWritten = 0;
+	error = 0;
+}
+
+/*
+* Copy to the caller's fixed buffer.  Output that does not fit is dropped and
+* OUTPUTFULL is returned and remembered in getError().
+*/
+int CIO::outputToMemory(unsigned char* data, int size)
+{
+	if (size > this->size - dataIndex)
+	{
+		error = OUTPUTFULL;
+		return OUTPUTFULL;
+	}
+
+	memcpy(&pOutBuffer[dataIndex], data, size);
+	dataIndex += size;
+	bytesWritten += size;
+	return size;
+}
+
+/*
+* Copy to memory, at least doubling the buffer whenever it is too small so
+* that the total cost of the copies stays linear in the output size.
+*/
+int CIO::outputToGrowable(unsigned char* data, int size)
+{
+	if (size > this->size - dataIndex)
+	{
+		long long grown = (long long)this->size * 2;
+		if (grown < (long long)dataIndex + size)
+		{
+			grown = (long long)dataIndex + size;
+		}
+		if (grown > 0x7fffffff)
+		{
+			error = OUTPUTNOMEMORY;
+			return OUTPUTNOMEMORY;
+		}
+
+		unsigned char *buffer = new (std::nothrow) unsigned char [(size_t)grown];
+		if (buffer == NULL)
+		{
+			error = OUTPUTNOMEMORY;
+			return OUTPUTNOMEMORY;
+		}
+		memcpy(buffer, pOutBuffer, dataIndex);
+		delete [] pOutBuffer;
+		pOutBuffer = buffer;
+		this->size = (int)grown;
+	}
+
+	memcpy(&pOutBuffer[dataIndex], data, size);
+	dataIndex += size;
+	bytesWritten += size;
+	return size;
+}
+
+int CIO::outputToDisk(unsigned char* data, int size)
+{
+	if (fp == NULL)
+	{
+		return -size;
+	}
+
+	if (fwrite(data, sizeof(char), size, fp) != (size_t)size)
+	{
+		error = OUTPUTWRITEFAILED;
+		return OUTPUTWRITEFAILED;
+	}
+	bytesWritten += size;
+	return size;
+}
+
+/*
+* Collect output in the write buffer.  When the new data does not fit, the
+* buffered bytes and the new data go out together in a single writev() so
+* that large pieces are never copied into the buffer first.
+*/
+int CIO::outputToBufferedDisk(unsigned char* data, int size)
+{
+	if (error != 0)
+	{
+		return error;
+	}
+
+	if (size <= writeSize - writeFill)
+	{
+		memcpy(&writeBuffer[writeFill], data, size);
+		writeFill += size;
+	}
+	else
+	{
+		if (writeAll(writeBuffer, writeFill, data, size) < 0)
+		{
+			return error;
+		}
+		writeFill = 0;
+	}
+
+	bytesWritten += size;
+	return size;
+}
+
+/*
+* Write first and then second to fd, retrying until everything is written,
+* and after a write interrupted by a signal.  Returns 0, or OUTPUTWRITEFAILED.
+*/
+int CIO::writeAll(const unsigned char *first, int firstSize, const unsigned char *second, int secondSize)
+{
+	while (firstSize + secondSize > 0)
+	{
+#ifdef _WIN32
+		int written;
+		if (firstSize > 0)
+		{
+			written = _write(fd, first, firstSize);
+		}
+		else
+		{
+			written = _write(fd, second, secondSize);
+		}
+#else
+		struct iovec pieces[2];
+		pieces[0].iov_base = (void *)first;
+		pieces[0].iov_len = firstSize;
+		pieces[1].iov_base = (void *)second;
+		pieces[1].iov_len = secondSize;
+		ssize_t written = writev(fd, firstSize > 0 ? pieces : &pieces[1], firstSize > 0 ? 2 : 1);
+#endif
+		if (written < 0 && errno == EINTR)
+		{
+			/* Interrupted before anything was written; try again. */
+			continue;
+		}
+		if (written <= 0)
+		{
+			error = OUTPUTWRITEFAILED;
+			return error;
+		}
+
+		/* Step past whatever made it out. */
+		if (written >= firstSize)
+		{
+			written -= firstSize;
+			first += firstSize;
+			firstSize = 0;
+			second += written;
+			secondSize -= (int)written;
+		}
+		else
+		{
+			first += written;
+			firstSize -= (int)written;
+		}
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Writes out anything held in the write buffer. Returns 0 or the error.
+/// </summary>
+int CIO::flush(void)
+{
+	if (type == BUFFEREDDISK && error == 0 && writeFill > 0)
+	{
+		if (writeAll(writeBuffer, writeFill, NULL, 0) < 0)
+		{
+			return error;
+		}
+		writeFill = 0;
+	}
+	else if (type == DISK && fp != NULL)
+	{
+		fflush(fp);
+	}
+
+	return error;
+}
+
+/// <summary>
+/// Flushes and closes a file opened by the constructor. Returns 0 or the error.
+/// </summary>
+int CIO::close(void)
+{
+	flush();
+
+	if (fd >= 0)
+	{
+		/* A write the system took in but could not get to the disk, on a
+		   full disk or over NFS, can first be reported here. */
+#ifdef _WIN32
+		int closed = _close(fd);
+#else
+		int closed = ::close(fd);
+#endif
+		if (closed != 0 && error == 0)
+		{
+			error = OUTPUTWRITEFAILED;
+		}
+		fd = -1;
+	}
+
+	return error;
+}
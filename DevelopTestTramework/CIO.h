@@ -4,6 +4,18 @@
 
 #define MEMORY 1
 #define DISK 2
+#define GROWABLE 3
+#define BUFFEREDDISK 4
+
+/* Errors */
+#define OUTPUTFULL -1			/* a fixed memory buffer ran out of room */
+#define OUTPUTNOMEMORY -2		/* a growable buffer could not grow */
+#define OUTPUTWRITEFAILED -3	/* the file could not be opened or written */
+
+/* Defaults for the sinks that manage their own memory. */
+#define GROWABLEINITIALSIZE 65536
+#define DISKBUFFERSIZE (1 << 20)
+#define DISKBUFFERALIGN 4096
 
 class CIO
 {
@@ -11,62 +23,97 @@ class CIO
 public:
 	CIO(unsigned char * pOutBuffer, int size)
 	{
-		fp = NULL;
+		init();
 		this->size = size;
 		this->pOutBuffer = pOutBuffer;
-		dataIndex = 0;
 		type = MEMORY;
 	}
 
+	/// <summary>
+	/// Memory output that starts with bufferSize bytes and grows as needed.
+	/// </summary>
 	CIO(int bufferSize)
 	{
-		fp = NULL;
-		size = bufferSize;
-		pOutBuffer = new unsigned char [bufferSize];
-		dataIndex = 0;
-		type = MEMORY;
+		init();
+		size = bufferSize > 0 ? bufferSize : GROWABLEINITIALSIZE;
+		pOutBuffer = new unsigned char [size];
+		ownsBuffer = true;
+		type = GROWABLE;
 	}
 
 	CIO(FILE* fp)
 	{
+		init();
 		this->fp = fp;
 		type = DISK;
 	}
 
-	int outputToMemory(unsigned char* data, int size)
-	{
-		memcpy(&pOutBuffer[dataIndex], data, size);
-		dataIndex += size;
-		return size;
-	}
+	CIO(const char *filePath, int bufferSize);
+	~CIO();
 
-	int outputToDisk(unsigned char* data, int size)
-	{
-		if (fp == NULL)
-		{
-			return -size;
-		}
-		return fwrite(data, size, sizeof(char), fp);
-	}
+	int outputToMemory(unsigned char* data, int size);
+	int outputToGrowable(unsigned char* data, int size);
+	int outputToDisk(unsigned char* data, int size);
+	int outputToBufferedDisk(unsigned char* data, int size);
+	int flush(void);
+	int close(void);
 
 	int output(unsigned char* data, int size)
 	{
-		if (type == MEMORY)
-		{
-			return outputToMemory(data, size);
-		}
-		else if (type == DISK)
+		switch (type)
 		{
-			return outputToDisk(data, size);
+			case MEMORY:
+				return outputToMemory(data, size);
+			case DISK:
+				return outputToDisk(data, size);
+			case GROWABLE:
+				return outputToGrowable(data, size);
+			case BUFFEREDDISK:
+				return outputToBufferedDisk(data, size);
 		}
 		return 0;
 	}
 
+	/// <summary>
+	/// The memory the output went to, for MEMORY and GROWABLE.
+	/// </summary>
+	unsigned char *getBuffer() const
+	{
+		return pOutBuffer;
+	}
+
+	/// <summary>
+	/// Bytes accepted so far. For BUFFEREDDISK some of them may still be in
+	/// the write buffer until flush() or close().
+	/// </summary>
+	long long getBytesWritten() const
+	{
+		return bytesWritten;
+	}
+
+	/// <summary>
+	/// The first error seen, or 0.
+	/// </summary>
+	int getError() const
+	{
+		return error;
+	}
+
 private:
+	void init(void);
+	int writeAll(const unsigned char *first, int firstSize, const unsigned char *second, int secondSize);
+
 	FILE* fp;
 	int size;
 	unsigned char* pOutBuffer;
 	int dataIndex;
 	int type;
+
+	bool ownsBuffer;			/* pOutBuffer was allocated here */
+	int fd;						/* file descriptor for BUFFEREDDISK */
+	unsigned char *writeBuffer;	/* aligned buffer for BUFFEREDDISK */
+	int writeSize, writeFill;
+	long long bytesWritten;
+	int error;
 };
 
@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include <string.h>
+#include "Corpus.h"
+
+/* Words the prose is made of, built from syllables. */
+#define CORPUSWORDS 512
+#define CORPUSWORDLENGTH 16
+
+static const char *syllables[32] =
+{
+	"the", "an", "re", "in", "con", "ter", "al", "ing", "com", "de", "pro", "ex",
+	"ma", "ti", "on", "er", "est", "per", "so", "la", "mo", "ri", "ble", "ca",
+	"un", "di", "sta", "ver", "ly", "ment", "ac", "or"
+};
+
+static const char *levels[4] = { "DEBUG", "INFO", "WARN", "ERROR" };
+static const char *services[6] = { "auth", "billing", "search", "gateway", "storage", "mailer" };
+static const char *messages[8] =
+{
+	"request completed", "cache miss", "retrying upstream call", "user signed in",
+	"connection reset by peer", "slow query", "token refreshed", "payload too large"
+};
+
+/*
+* Copy length bytes of text to data at position, as far as size allows.
+* Returns the new position.
+*/
+static size_t append(unsigned char *data, size_t size, size_t position, const char *text, size_t length)
+{
+	if (length > size - position)
+	{
+		length = size - position;
+	}
+	memcpy(&data[position], text, length);
+	return position + length;
+}
+
+/// <summary>
+/// Fills size bytes of data with the given kind of corpus, the same bytes
+/// for the same seed.
+/// </summary>
+void CCorpus::generate(int kind, unsigned char *data, size_t size, unsigned long long seed)
+{
+	unsigned long long state = seed;
+
+	switch (kind)
+	{
+	case CORPUSTEXT:
+		text(data, size, &state);
+		break;
+	case CORPUSJSON:
+		json(data, size, &state);
+		break;
+	case CORPUSBINARY:
+		binary(data, size, &state);
+		break;
+	case CORPUSREPETITIVE:
+		repetitive(data, size, &state);
+		break;
+	default:
+		random(data, size, &state);
+		break;
+	}
+}
+
+/// <summary>
+/// Short name of a kind of corpus, for reports.
+/// </summary>
+const char *CCorpus::name(int kind)
+{
+	static const char *names[CORPUSKINDS] = { "text", "json", "binary", "random", "repetitive" };
+	return kind >= 0 && kind < CORPUSKINDS ? names[kind] : "?";
+}
+
+/*
+* Sentences of words picked with a skewed distribution, so a few words are
+* very common and most are rare, roughly as in natural language.
+*/
+void CCorpus::text(unsigned char *data, size_t size, unsigned long long *state)
+{
+	char words[CORPUSWORDS][CORPUSWORDLENGTH];
+	size_t position = 0;
+
+	for (int w = 0; w < CORPUSWORDS; w++)
+	{
+		int count = 1 + (int)(next(state) % 4);
+		words[w][0] = 0;
+		for (int s = 0; s < count && strlen(words[w]) + 4 < CORPUSWORDLENGTH; s++)
+		{
+			strcat(words[w], syllables[next(state) % 32]);
+		}
+	}
+
+	while (position < size)
+	{
+		int count = 5 + (int)(next(state) % 16);
+		for (int n = 0; n < count && position < size; n++)
+		{
+			/* Cubing a uniform index favours the first words. */
+			unsigned long long r = next(state) % CORPUSWORDS;
+			const char *word = words[r * r * r / (CORPUSWORDS * CORPUSWORDS)];
+			char buffer[CORPUSWORDLENGTH + 1];
+			strcpy(buffer, word);
+			if (n == 0)
+			{
+				buffer[0] = (char)(buffer[0] - 'a' + 'A');
+			}
+			position = append(data, size, position, buffer, strlen(buffer));
+			position = append(data, size, position, n + 1 < count ? " " : ". ", n + 1 < count ? 1 : 2);
+		}
+		if (next(state) % 6 == 0)
+		{
+			position = append(data, size, position, "\n\n", 2);
+		}
+	}
+}
+
+/*
+* Log records with the same keys on every line, a clock that only moves
+* forward, and values drawn from small sets, with random ids among them.
+*/
+void CCorpus::json(unsigned char *data, size_t size, unsigned long long *state)
+{
+	long long millis = 1700000000000LL;
+	size_t position = 0;
+
+	while (position < size)
+	{
+		char line[512];
+		unsigned long long r = next(state);
+		millis += r % 250;
+		long long seconds = millis / 1000;
+		int length = snprintf(line, sizeof(line),
+			"{\"ts\":\"2023-11-%02d %02d:%02d:%02d.%03d\",\"level\":\"%s\",\"service\":\"%s\","
+			"\"request_id\":\"%016llx\",\"status\":%d,\"latency_ms\":%d,\"msg\":\"%s\"}\n",
+			14 + (int)(seconds / 86400 % 14), (int)(seconds / 3600 % 24), (int)(seconds / 60 % 60),
+			(int)(seconds % 60), (int)(millis % 1000), levels[(r >> 8) % 4 == 0 ? (r >> 10) % 4 : 1],
+			services[(r >> 12) % 6], next(state), (r >> 16) % 10 == 0 ? 500 : 200,
+			(int)((r >> 20) % 900), messages[(r >> 32) % 8]);
+		position = append(data, size, position, line, length);
+	}
+}
+
+/*
+* 32 byte records: a sequence number, a type from a small set, a counter
+* that grows slowly, and two floats that drift, with padding, as in a
+* table written out by a program.
+*/
+void CCorpus::binary(unsigned char *data, size_t size, unsigned long long *state)
+{
+	unsigned char record[32];
+	unsigned long long counter = 0;
+	float a = 100.0f, b = 0.5f;
+	size_t position = 0;
+
+	for (unsigned int sequence = 0; position < size; sequence++)
+	{
+		unsigned long long r = next(state);
+		counter += r % 16;
+		a += (float)((int)(r >> 8 & 255) - 128) / 64.0f;
+		b = b * 0.99f + (float)(r >> 16 & 1023) / 1e5f;
+
+		memset(record, 0, sizeof(record));
+		memcpy(&record[0], &sequence, 4);
+		record[4] = (unsigned char)((r >> 26) % 5);
+		memcpy(&record[8], &counter, 8);
+		memcpy(&record[16], &a, 4);
+		memcpy(&record[20], &b, 4);
+		position = append(data, size, position, (const char *)record, sizeof(record));
+	}
+}
+
+/*
+* Bytes from the generator itself, which deflate can only store.
+*/
+void CCorpus::random(unsigned char *data, size_t size, unsigned long long *state)
+{
+	for (size_t position = 0; position < size; position += 8)
+	{
+		unsigned long long r = next(state);
+		append(data, size, position, (const char *)&r, 8);
+	}
+}
+
+/*
+* A 100 byte pattern over and over, with one byte in about 4K changed, so
+* nearly everything is a maximum length match.
+*/
+void CCorpus::repetitive(unsigned char *data, size_t size, unsigned long long *state)
+{
+	unsigned char pattern[100];
+
+	for (int n = 0; n < (int)sizeof(pattern); n++)
+	{
+		pattern[n] = (unsigned char)('a' + next(state) % 26);
+	}
+	for (size_t position = 0; position < size; position++)
+	{
+		data[position] = pattern[position % sizeof(pattern)];
+		if ((position & 4095) == 0)
+		{
+			data[position] = (unsigned char)next(state);
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+
+/* Kinds of synthetic data. */
+#define CORPUSTEXT 0			/* English-like prose */
+#define CORPUSJSON 1			/* one JSON log record per line */
+#define CORPUSBINARY 2			/* fixed size records of ids, counters and floats */
+#define CORPUSRANDOM 3			/* incompressible */
+#define CORPUSREPETITIVE 4		/* a short pattern repeated with rare changes */
+#define CORPUSKINDS 5
+
+/* Seed used unless another is given, so every run makes the same bytes. */
+#define CORPUSSEED 0x9e3779b97f4a7c15ULL
+
+/*
+	Deterministic test data for the benchmarks. Each kind stands for a kind
+	of input the decoder meets in practice, from data that is nearly all
+	literals to data that is nearly all long matches, and the same kind,
+	size and seed always give the same bytes on every platform, so results
+	can be compared between builds and machines.
+*/
+class CCorpus
+{
+public:
+	static void generate(int kind, unsigned char *data, size_t size, unsigned long long seed);
+	static const char *name(int kind);
+
+private:
+	static void text(unsigned char *data, size_t size, unsigned long long *state);
+	static void json(unsigned char *data, size_t size, unsigned long long *state);
+	static void binary(unsigned char *data, size_t size, unsigned long long *state);
+	static void random(unsigned char *data, size_t size, unsigned long long *state);
+	static void repetitive(unsigned char *data, size_t size, unsigned long long *state);
+
+	/// <summary>
+	/// The next 64 pseudo-random bits (splitmix64).
+	/// </summary>
+	static unsigned long long next(unsigned long long *state)
+	{
+		unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+};
@@ -0,0 +1,328 @@
+#include "stdafx.h"
+#include "Crc32.h"
+#include <string.h>
+
+/* Carry-less multiplication is only used on x86. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRCFOLDING
+#ifdef _MSC_VER
+#include <intrin.h>
+#define FOLDINGTARGET
+#else
+#include <cpuid.h>
+#define FOLDINGTARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/*
+* The slice-by-8 tables.  table[0] is the ordinary byte at a time table, and
+* table[k][n] is the CRC of byte n followed by k zero bytes, so eight bytes
+* can be looked up independently and the results xor-ed together.
+*/
+struct CrcTables
+{
+	unsigned int table[8][256];
+
+	CrcTables()
+	{
+		for (unsigned int n = 0; n < 256; n++)
+		{
+			unsigned int crc = n;
+			for (int k = 0; k < 8; k++)
+			{
+				crc = crc & 1 ? (crc >> 1) ^ CRC32POLY : crc >> 1;
+			}
+			table[0][n] = crc;
+		}
+
+		for (unsigned int n = 0; n < 256; n++)
+		{
+			for (int k = 1; k < 8; k++)
+			{
+				table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+			}
+		}
+	}
+};
+
+/* Built the first time it is used.  Initialising a local static is thread safe. */
+static const CrcTables &crcTables(void)
+{
+	static const CrcTables tables;
+	return tables;
+}
+
+/*
+* Update crc with length bytes of data.  Starting with crc 0 gives the CRC-32
+* of data.
+*/
+unsigned int CCrc32::update(unsigned int crc, const unsigned char *data, size_t length)
+{
+	static const bool folding = hasFolding();
+
+	if (folding && length >= 64)
+	{
+		/* Fold whole 16-byte blocks and do the rest with the tables. */
+		size_t head = length & ~(size_t)15;
+		crc = updateFolding(crc, data, head);
+		data += head;
+		length -= head;
+	}
+
+	return updateTables(crc, data, length);
+}
+
+/// <summary>
+/// True if the processor can do the carry-less multiplications used by
+/// updateFolding().
+/// </summary>
+bool CCrc32::hasFolding(void)
+{
+#ifdef CRCFOLDING
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 19)) != 0;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		return false;
+	}
+	return (ecx & bit_PCLMUL) != 0 && (ecx & bit_SSE4_1) != 0;
+#endif
+#else
+	return false;
+#endif
+}
+
+/*
+* Slice-by-8.  Eight bytes are combined with the CRC and looked up in the
+* eight tables at once, which takes the table lookups off the critical path
+* that a byte at a time loop has.
+*/
+unsigned int CCrc32::updateTables(unsigned int crc, const unsigned char *data, size_t length)
+{
+	const CrcTables &tables = crcTables();
+	const unsigned int (*table)[256] = tables.table;
+
+	crc = ~crc;
+
+	/* Line up on a four byte boundary so the loads below are aligned. */
+	while (length > 0 && ((size_t)data & 3) != 0)
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+		length--;
+	}
+
+	while (length >= 8)
+	{
+		unsigned int low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= crc;
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+			table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+			table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+			table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+		data += 8;
+		length -= 8;
+	}
+
+	while (length > 0)
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+		length--;
+	}
+
+	return ~crc;
+}
+
+/*
+* Fold length bytes, which must be at least 64 and a multiple of 16, with
+* carry-less multiplication (Gopal et al., "Fast CRC Computation for Generic
+* Polynomials Using PCLMULQDQ Instruction", Intel, 2009).
+*
+* Notes:
+*
+* - Four 128-bit lanes are carried along so the multiplications of one step
+*   do not wait for each other.  Each step multiplies every lane by x^512 mod
+*   P (k1, k2) and adds in the next 64 bytes.
+*
+* - The lanes are then folded into one with x^128 mod P (k3, k4), the 128
+*   bits are reduced to 64 with k5, and a Barrett reduction gives the 32-bit
+*   remainder.  The constants are for the bit-reflected polynomial, which is
+*   why they are one bit longer than 32 bits.
+*/
+#ifdef CRCFOLDING
+FOLDINGTARGET unsigned int CCrc32::updateFolding(unsigned int crc, const unsigned char *data, size_t length)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000LL, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)~crc));
+	data += 64;
+	length -= 64;
+
+	/* fold four lanes */
+	x0 = k1k2;
+	while (length >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + 0x30)));
+
+		data += 64;
+		length -= 64;
+	}
+
+	/* fold the lanes into one */
+	x0 = k3k4;
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold any remaining 16-byte blocks */
+	while (length >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data)), x5);
+		data += 16;
+		length -= 16;
+	}
+
+	/* 128 bits to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x0 = k5k0;
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = poly;
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return ~(unsigned int)_mm_extract_epi32(x1, 1);
+}
+#else
+unsigned int CCrc32::updateFolding(unsigned int crc, const unsigned char *data, size_t length)
+{
+	return updateTables(crc, data, length);
+}
+#endif
+
+/*
+* Multiply a and b modulo the CRC polynomial.  Both are bit-reflected, so
+* x^0 is the top bit.
+*/
+unsigned int CCrc32::multiply(unsigned int a, unsigned int b)
+{
+	unsigned int m = 1u << 31;
+	unsigned int p = 0;
+
+	for (;;)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+			{
+				break;
+			}
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32POLY : b >> 1;
+	}
+
+	return p;
+}
+
+/*
+* x^(n * 2^k) modulo the CRC polynomial, by squaring.
+*/
+unsigned int CCrc32::powerOfX(long long n, int k)
+{
+	/* x^(2^i) for i = 0..31; the powers repeat after that. */
+	static const struct PowerTable
+	{
+		unsigned int power[32];
+
+		PowerTable()
+		{
+			unsigned int p = 1u << 30;	/* x^1 */
+			power[0] = p;
+			for (int i = 1; i < 32; i++)
+			{
+				power[i] = p = multiply(p, p);
+			}
+		}
+	} table;
+
+	unsigned int p = 1u << 31;	/* x^0 */
+	while (n)
+	{
+		if (n & 1)
+		{
+			p = multiply(table.power[k & 31], p);
+		}
+		n >>= 1;
+		k++;
+	}
+
+	return p;
+}
+
+/*
+* Return the CRC-32 of two pieces of data put together, given crc1 of the
+* first, crc2 of the second and the length of the second.  This is what lets
+* pieces that were checked separately, for instance on different threads, be
+* checked against one trailer.
+*
+* Notes:
+*
+* - Appending length2 bytes to the first piece multiplies its remainder by
+*   x^(8 * length2), and the pre- and post-conditioning cancel out so that
+*   crc2 can simply be added.
+*/
+unsigned int CCrc32::combine(unsigned int crc1, unsigned int crc2, long long length2)
+{
+	return multiply(powerOfX(length2, 3), crc1) ^ crc2;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+
+/* The reflected CRC-32 polynomial used by gzip, zip and PNG. */
+#define CRC32POLY 0xedb88320
+
+/*
+	CRC-32 as used in the gzip trailer. Values are the finished CRC, the same
+	as zlib's crc32(), so update() can be called piece by piece starting from
+	0 and the pieces can be any size.
+
+	Buffers of 64 bytes or more are folded with carry-less multiplication
+	when the processor has it (PCLMULQDQ on x86), and everything else goes
+	through slice-by-8 tables, eight bytes per step.
+*/
+class CCrc32
+{
+public:
+	static unsigned int update(unsigned int crc, const unsigned char *data, size_t length);
+	static unsigned int combine(unsigned int crc1, unsigned int crc2, long long length2);
+	static bool hasFolding(void);
+
+private:
+	static unsigned int updateTables(unsigned int crc, const unsigned char *data, size_t length);
+	static unsigned int updateFolding(unsigned int crc, const unsigned char *data, size_t length);
+	static unsigned int multiply(unsigned int a, unsigned int b);
+	static unsigned int powerOfX(long long n, int k);
+};
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+#include <string.h>
+#include <chrono>
+#include "DecodeStats.h"
+
+CDecodeStats::CDecodeStats()
+{
+	blocks = NULL;
+	blockCount = blockCapacity = 0;
+	open = false;
+	memset(&spare, 0, sizeof(spare));
+}
+
+CDecodeStats::~CDecodeStats()
+{
+	delete [] blocks;
+}
+
+/// <summary>
+/// Forgets the blocks recorded so far. The records are kept across
+/// decodes until this is called, so the members of a gzip file add up.
+/// </summary>
+void CDecodeStats::clear(void)
+{
+	blockCount = 0;
+	open = false;
+}
+
+/*
+* Start the record of a block whose header, at bit in the input, has just
+* been read with output bytes of output before it.
+*/
+void CDecodeStats::beginBlock(int type, int last, long long bit, long long output, long long tableNanoseconds)
+{
+	if (blockCount == blockCapacity)
+	{
+		int capacity = blockCapacity == 0 ? 64 : blockCapacity * 2;
+		struct BlockStats *grown = new struct BlockStats[capacity];
+		if (blockCount > 0)
+		{
+			memcpy(grown, blocks, blockCount * sizeof(struct BlockStats));
+		}
+		delete [] blocks;
+		blocks = grown;
+		blockCapacity = capacity;
+	}
+
+	struct BlockStats *block = &blocks[blockCount++];
+	memset(block, 0, sizeof(*block));
+	block->type = type;
+	block->last = last;
+	block->bit = bit;
+	block->output = output;
+	block->tableNanoseconds = tableNanoseconds;
+	open = true;
+}
+
+/*
+* Close the record of the current block, which ends at bit in the input
+* with output bytes of output so far.
+*/
+void CDecodeStats::endBlock(long long bit, long long output)
+{
+	if (open)
+	{
+		struct BlockStats *block = &blocks[blockCount - 1];
+		block->bits = bit - block->bit;
+		block->outputLength = output - block->output;
+		open = false;
+	}
+}
+
+/// <summary>
+/// Adds up the counters and times of all the blocks into sum. Its type is
+/// the number of blocks and bit and output are those of the first one.
+/// </summary>
+void CDecodeStats::total(struct BlockStats *sum) const
+{
+	memset(sum, 0, sizeof(*sum));
+	sum->type = blockCount;
+	if (blockCount > 0)
+	{
+		sum->bit = blocks[0].bit;
+		sum->output = blocks[0].output;
+	}
+
+	for (int n = 0; n < blockCount; n++)
+	{
+		const struct BlockStats *block = &blocks[n];
+		sum->last |= block->last;
+		sum->bits += block->bits;
+		sum->outputLength += block->outputLength;
+		sum->literals += block->literals;
+		sum->matches += block->matches;
+		sum->tableNanoseconds += block->tableNanoseconds;
+		sum->decodeNanoseconds += block->decodeNanoseconds;
+		for (int symbol = 0; symbol < 29; symbol++)
+		{
+			sum->lengthSymbols[symbol] += block->lengthSymbols[symbol];
+		}
+		for (int symbol = 0; symbol < 30; symbol++)
+		{
+			sum->distanceSymbols[symbol] += block->distanceSymbols[symbol];
+		}
+	}
+}
+
+/*
+* Write the records as a JSON object with a "blocks" array, one object per
+* block, and the "total" of them all.  Returns 0, or -1 if the write failed.
+*
+* Notes:
+*
+* - Offsets and sizes are given as they are kept, in bits for the input and
+*   in bytes for the output, so a block can be found again in the file.
+*/
+int CDecodeStats::writeJson(FILE *fp) const
+{
+	static const char *const types[3] = { "stored", "fixed", "dynamic" };
+	struct BlockStats sum;
+
+	total(&sum);
+	fprintf(fp, "{\n  \"blocks\": [");
+	for (int n = 0; n <= blockCount; n++)
+	{
+		const struct BlockStats *block = n < blockCount ? &blocks[n] : &sum;
+		if (n < blockCount)
+		{
+			fprintf(fp, "%s\n    {\"type\": \"%s\", \"last\": %s, ", n > 0 ? "," : "",
+				block->type >= 0 && block->type < 3 ? types[block->type] : "?", block->last ? "true" : "false");
+		}
+		else
+		{
+			fprintf(fp, "\n  ],\n  \"total\": {\"blocks\": %d, ", blockCount);
+		}
+		fprintf(fp, "\"bit\": %lld, \"bits\": %lld, \"output\": %lld, \"outputLength\": %lld, "
+			"\"literals\": %lld, \"matches\": %lld, \"tableNanoseconds\": %lld, \"decodeNanoseconds\": %lld, ",
+			block->bit, block->bits, block->output, block->outputLength,
+			block->literals, block->matches, block->tableNanoseconds, block->decodeNanoseconds);
+
+		fprintf(fp, "\"lengthSymbols\": [");
+		for (int symbol = 0; symbol < 29; symbol++)
+		{
+			fprintf(fp, "%s%u", symbol > 0 ? ", " : "", block->lengthSymbols[symbol]);
+		}
+		fprintf(fp, "], \"distanceSymbols\": [");
+		for (int symbol = 0; symbol < 30; symbol++)
+		{
+			fprintf(fp, "%s%u", symbol > 0 ? ", " : "", block->distanceSymbols[symbol]);
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n}\n");
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/// <summary>
+/// A steady clock in nanoseconds, for the block times.
+/// </summary>
+long long CDecodeStats::now(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
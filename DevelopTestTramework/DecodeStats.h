@@ -0,0 +1,68 @@
+#pragma once
+#include <stdio.h>
+#include "structs.h"
+
+/*
+	Per block statistics of a decode, for finding out why some input decodes
+	slowly: how its blocks are made up, and where the time goes between
+	building code tables and decoding with them.
+
+	THuffman only keeps these when it is built with DECODESTATS defined, so
+	the ordinary build has neither the counters in its inner loop nor the
+	clock reads around each block. The decoder opens a record when it has
+	read a block header and closes it at the end of the block; the counters
+	of the open block are updated in place through current().
+*/
+class CDecodeStats
+{
+public:
+	CDecodeStats();
+	~CDecodeStats();
+
+	void clear(void);
+	void beginBlock(int type, int last, long long bit, long long output, long long tableNanoseconds);
+	void endBlock(long long bit, long long output);
+	void total(struct BlockStats *sum) const;
+	int writeJson(FILE *fp) const;
+
+	static long long now(void);
+
+	/// <summary>
+	/// The record of the block being decoded. Outside a block this is a
+	/// spare record, so the decoder never has to check for one.
+	/// </summary>
+	struct BlockStats *current()
+	{
+		return open ? &blocks[blockCount - 1] : &spare;
+	}
+
+	/// <summary>
+	/// Adds time spent decoding the contents of the current block.
+	/// </summary>
+	void addDecodeTime(long long nanoseconds)
+	{
+		current()->decodeNanoseconds += nanoseconds;
+	}
+
+	/// <summary>
+	/// Number of blocks recorded since the last clear().
+	/// </summary>
+	int getBlockCount() const
+	{
+		return blockCount;
+	}
+
+	/// <summary>
+	/// The record of block n, in the order they were decoded.
+	/// </summary>
+	const struct BlockStats *getBlock(int n) const
+	{
+		return &blocks[n];
+	}
+
+private:
+	struct BlockStats *blocks;
+	int blockCount, blockCapacity;
+	bool open;					/* the last record is of a block still being decoded */
+	struct BlockStats spare;
+};
@@ -0,0 +1,1330 @@
+#include "stdafx.h"
+#include <string.h>
+#include <algorithm>
+#include "Deflate.h"
+#include "GZip.h"
+#include "Crc32.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Match lengths are found sixteen bytes at a time where SSE2 is always there. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEFLATESSE2
+#include <emmintrin.h>
+#endif
+
+/* zlib's settings for levels 0 to 9. */
+static const struct deflateConfig configs[DEFLATEBEST + 1] = {
+	/* good lazy nice chain */
+	{ 0, 0, 0, 0, STRATEGYSTORED },		/* 0: stored only */
+	{ 0, 0, 0, 0, STRATEGYFAST },		/* 1: one candidate per hash */
+	{ 4, 5, 16, 8, STRATEGYGREEDY },
+	{ 4, 6, 32, 32, STRATEGYGREEDY },
+	{ 4, 4, 16, 16, STRATEGYLAZY },		/* 4: lazy */
+	{ 8, 16, 32, 32, STRATEGYLAZY },
+	{ 8, 16, 128, 128, STRATEGYLAZY },
+	{ 8, 32, 128, 256, STRATEGYLAZY },
+	{ 32, 128, 258, 1024, STRATEGYLAZY },
+	{ 32, 258, 258, 4096, STRATEGYLAZY } };	/* 9: slowest */
+
+/* Order in which the code length code lengths are sent. */
+static const short codeLengthOrder[CODELENGTHCODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+/* Number of trailing zero bits in a value that is not zero. */
+static inline int trailingZeros(unsigned long long value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+/*
+* Number of bytes at scan and match that are the same, from length, which
+* are already known to be, up to maxLength.
+*
+* Notes:
+*
+* - The bytes are compared sixteen at a time with SSE2, where the first one
+*   that differs is the lowest clear bit of the mask of equal bytes, or
+*   otherwise eight at a time, where it is the lowest set byte of the
+*   exclusive or of the two loads.  Either way the trailing zero count finds
+*   it without a loop over the bytes.
+*
+* - The loads can go up to MATCHSLACK bytes past maxLength, so the window is
+*   followed by that many bytes.
+*/
+static inline int matchLength(const unsigned char *scan, const unsigned char *match, int length, int maxLength)
+{
+	while (length < maxLength)
+	{
+#ifdef DEFLATESSE2
+		__m128i a = _mm_loadu_si128((const __m128i *)&scan[length]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&match[length]);
+		unsigned int equal = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if (equal != 0xffff)
+		{
+			length += trailingZeros(~equal & 0xffff);
+			break;
+		}
+		length += 16;
+#else
+		unsigned long long a, b;
+		memcpy(&a, &scan[length], 8);
+		memcpy(&b, &match[length], 8);
+		if (a != b)
+		{
+			length += trailingZeros(a ^ b) >> 3;
+			break;
+		}
+		length += 8;
+#endif
+	}
+
+	return length < maxLength ? length : maxLength;
+}
+
+/* Hash of the four bytes at data, for deflateFast(). */
+static inline unsigned int fastHash(const unsigned char *data)
+{
+	unsigned int bytes;
+	memcpy(&bytes, data, sizeof(bytes));
+	return (bytes * 0x9e3779b1) >> (32 - HASHBITS);
+}
+
+template <class Sink>
+TDeflate<Sink>::TDeflate(Sink *pSink, int level)
+{
+	this->pSink = pSink;
+	setLevel(level);
+	format = FORMATRAW;
+
+	window = new unsigned char[2 * WINDOWSIZE + MATCHSLACK];
+	head = new int[HASHSIZE];
+	prev = new int[WINDOWSIZE];
+	symbolDistances = new unsigned short[SYMBOLBUFFERSIZE];
+	symbolValues = new unsigned short[SYMBOLBUFFERSIZE];
+	outBuffer = new unsigned char[DEFLATEOUTSIZE];
+
+	/* Map match lengths and distances to their symbols, using the decoder's
+	   base tables. */
+	for (int code = 0; code < LENGTHCODES; code++)
+	{
+		for (int n = 0; n < (1 << lengthExtra[code]); n++)
+		{
+			lengthCode[lengthBase[code] + n - MINMATCH] = (unsigned char)code;
+		}
+	}
+	for (int code = 0; code < MAXDCODES; code++)
+	{
+		for (int n = 0; n < (1 << distanceExtra[code]); n++)
+		{
+			int distance = distanceBase[code] + n - 1;
+			distanceCode[distance < 256 ? distance : 256 + (distance >> 7)] = (unsigned char)code;
+		}
+	}
+
+	/* The fixed code of RFC 1951 section 3.2.6. */
+	for (int symbol = 0; symbol < FIXLCODES; symbol++)
+	{
+		fixedLitLengths[symbol] = (unsigned char)(symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8);
+	}
+	memset(fixedDistLengths, 5, sizeof(fixedDistLengths));
+	canonicalCodes(fixedLitLengths, FIXLCODES, fixedLitCodes);
+	canonicalCodes(fixedDistLengths, MAXDCODES, fixedDistCodes);
+
+	reset();
+}
+
+template <class Sink>
+TDeflate<Sink>::~TDeflate()
+{
+	delete [] window;
+	delete [] head;
+	delete [] prev;
+	delete [] symbolDistances;
+	delete [] symbolValues;
+	delete [] outBuffer;
+}
+
+/// <summary>
+/// Starts a new stream with the current level and format.
+/// </summary>
+template <class Sink>
+void TDeflate<Sink>::reset(void)
+{
+	config = &configs[level];
+	error = 0;
+
+	/* The window is cleared so the compares that read past the input only
+	   ever see initialised bytes. */
+	memset(window, 0, 2 * WINDOWSIZE + MATCHSLACK);
+	for (int n = 0; n < HASHSIZE; n++)
+	{
+		head[n] = -1;
+	}
+	strstart = lookahead = blockStart = 0;
+	matchStart = prevMatch = 0;
+	prevLength = MINMATCH - 1;
+	matchAvailable = false;
+
+	symbolCount = 0;
+	memset(litFreq, 0, sizeof(litFreq));
+	memset(distFreq, 0, sizeof(distFreq));
+
+	bitBuffer = 0;
+	bitCount = 0;
+	outLength = 0;
+
+	started = finished = false;
+	checkValue = 0;
+	totalIn = totalOut = 0;
+}
+
+/*
+* Use the last WINDOWSIZE bytes of dictionary, at most, as if they had come
+* before the input, so that the start of the input can refer back to them.
+* The decoder has to be given the same dictionary.  Call it after reset()
+* and before the first compress().
+*/
+template <class Sink>
+void TDeflate<Sink>::setDictionary(const unsigned char *dictionary, int length)
+{
+	if (length > WINDOWSIZE)
+	{
+		dictionary += length - WINDOWSIZE;
+		length = WINDOWSIZE;
+	}
+
+	memcpy(window, dictionary, length);
+	strstart = blockStart = length;
+	if (configs[level].strategy == STRATEGYFAST)
+	{
+		for (int n = 0; n + 4 <= length; n++)
+		{
+			head[fastHash(&window[n])] = n;
+		}
+	}
+	else if (level > DEFLATESTORE)
+	{
+		for (int n = 0; n + MINMATCH <= length; n++)
+		{
+			insertString(n);
+		}
+	}
+}
+
+/*
+* Compress size bytes of data.  flush is DEFLATENOFLUSH if more input
+* follows, in which case the end of this input can be held back to be
+* matched against what comes next, DEFLATESYNC to write out everything so
+* far and end on a byte boundary, or DEFLATEFINISH to end the stream.
+* Returns 0 or an error, which is also left in error.
+*
+* Notes:
+*
+* - Matches are only looked for while MINLOOKAHEAD bytes of input are in the
+*   window, so that a match can be as long as possible, unless no more input
+*   will come before the next flush.  That is the stop argument of the
+*   deflate functions: the lookahead they leave.
+*
+* - DEFLATESYNC is what zlib's Z_SYNC_FLUSH writes.  The empty stored block
+*   brings the output to a byte boundary, so the data after it can be
+*   compressed separately and simply appended, as long as only the last
+*   piece has a final block.
+*/
+template <class Sink>
+int TDeflate<Sink>::compress(const unsigned char *data, size_t size, int flush)
+{
+	if (finished)
+	{
+		return error = STREAMFINISHED;
+	}
+
+	if (!started)
+	{
+		started = true;
+		if (format == FORMATGZIP)
+		{
+			unsigned char header[GZIPHEADERSIZE];
+			gzipHeader(header, level);
+			for (int n = 0; n < GZIPHEADERSIZE; n++)
+			{
+				putByte(header[n]);
+			}
+		}
+	}
+
+	if (format == FORMATGZIP)
+	{
+		checkValue = CCrc32::update(checkValue, data, size);
+	}
+	totalIn += size;
+
+	for (;;)
+	{
+		fillWindow(&data, &size);
+
+		/* Keep MINLOOKAHEAD bytes back unless this is all the input. */
+		int stop = size > 0 || flush == DEFLATENOFLUSH ? MINLOOKAHEAD : 1;
+		if (level == DEFLATESTORE)
+		{
+			deflateStored(stop);
+		}
+		else if (config->strategy == STRATEGYFAST)
+		{
+			deflateFast(stop);
+		}
+		else if (config->strategy == STRATEGYGREEDY)
+		{
+			deflateGreedy(stop);
+		}
+		else
+		{
+			deflateLazy(stop);
+		}
+
+		if (size == 0 || error != 0)
+		{
+			break;
+		}
+	}
+
+	if (flush != DEFLATENOFLUSH && error == 0)
+	{
+		if (matchAvailable)
+		{
+			tallyLiteral(window[strstart - 1]);
+			matchAvailable = false;
+		}
+
+		if (flush == DEFLATEFINISH)
+		{
+			flushBlock(1);
+			alignToByte();
+			if (format == FORMATGZIP)
+			{
+				for (int n = 0; n < 4; n++)
+				{
+					putByte((checkValue >> (n * 8)) & 0xff);
+				}
+				for (int n = 0; n < 4; n++)
+				{
+					putByte((int)((totalIn >> (n * 8)) & 0xff));
+				}
+			}
+			finished = true;
+		}
+		else
+		{
+			if (symbolCount > 0 || strstart > blockStart)
+			{
+				flushBlock(0);
+			}
+			storedBlock(NULL, 0, 0);
+		}
+
+		flushOutput();
+		if (flush == DEFLATEFINISH && error == 0)
+		{
+			int ret = pSink->flush();
+			if (ret < 0)
+			{
+				error = ret;
+			}
+		}
+	}
+
+	return error;
+}
+
+/*
+* Fill in the GZIPHEADERSIZE bytes of a gzip member header for data
+* compressed at level: the ID, the method, no flags and no time, and the
+* extra flags gzip sets for its fastest and best levels.
+*/
+template <class Sink>
+void TDeflate<Sink>::gzipHeader(unsigned char *header, int level)
+{
+	header[0] = GZIPID1;
+	header[1] = GZIPID2;
+	header[2] = GZIPDEFLATE;
+	memset(&header[3], 0, 5);
+	header[8] = (unsigned char)(level == DEFLATEBEST ? 2 : level == DEFLATEFASTEST ? 4 : 0);
+	header[9] = GZIPOSUNKNOWN;
+}
+
+/*
+* Copy input into the window until there is MINLOOKAHEAD of it or the input
+* runs out, sliding the window down first when the input has reached the
+* end of it.
+*/
+template <class Sink>
+void TDeflate<Sink>::fillWindow(const unsigned char **data, size_t *size)
+{
+	while (lookahead < MINLOOKAHEAD && *size > 0)
+	{
+		if (strstart >= WINDOWSIZE + MAXDISTANCE)
+		{
+			slideWindow();
+		}
+
+		size_t room = 2 * WINDOWSIZE - strstart - lookahead;
+		size_t count = *size < room ? *size : room;
+		memcpy(&window[strstart + lookahead], *data, count);
+		lookahead += (int)count;
+		*data += count;
+		*size -= count;
+	}
+}
+
+/*
+* Move the upper half of the window down to the lower half, and every
+* position in the hash chains with it.  Positions that fall off the bottom
+* become -1, the end of a chain.  Level 1 has no chains, only head[].
+* Without matches, the stored level has to write out its block first, since
+* the bytes of a stored block are copied from the window.
+*/
+template <class Sink>
+void TDeflate<Sink>::slideWindow(void)
+{
+	if (level == DEFLATESTORE && strstart > blockStart)
+	{
+		flushBlock(0);
+	}
+
+	memcpy(window, &window[WINDOWSIZE], WINDOWSIZE);
+	strstart -= WINDOWSIZE;
+	blockStart -= WINDOWSIZE;
+	matchStart -= WINDOWSIZE;
+	prevMatch -= WINDOWSIZE;
+
+	for (int n = 0; n < HASHSIZE; n++)
+	{
+		head[n] = head[n] >= WINDOWSIZE ? head[n] - WINDOWSIZE : -1;
+	}
+	if (config->strategy != STRATEGYFAST)
+	{
+		for (int n = 0; n < WINDOWSIZE; n++)
+		{
+			prev[n] = prev[n] >= WINDOWSIZE ? prev[n] - WINDOWSIZE : -1;
+		}
+	}
+}
+
+/*
+* Add the string at position to its hash chain and return the position of
+* the previous string with the same hash, or -1.  MINMATCH bytes of input
+* are needed from position on.
+*/
+template <class Sink>
+inline int TDeflate<Sink>::insertString(int position)
+{
+	unsigned int bytes;
+	memcpy(&bytes, &window[position], sizeof(bytes));
+	unsigned int hash = ((bytes & 0xffffff) * 0x9e3779b1) >> (32 - HASHBITS);
+
+	int match = head[hash];
+	prev[position & (WINDOWSIZE - 1)] = match;
+	head[hash] = position;
+	return match;
+}
+
+/*
+* Follow the hash chain from current for the longest match to the string at
+* strstart that is longer than best.  Returns the length of the longest one,
+* which is best if there is none, and sets matchStart to it.  The length is
+* never more than lookahead.
+*
+* Notes:
+*
+* - A candidate is first checked at the position of the last byte of the
+*   best match so far, since it cannot be longer if that byte differs.
+*/
+template <class Sink>
+int TDeflate<Sink>::longestMatch(int current, int best)
+{
+	int chain = config->maxChain;
+	int nice = config->niceLength;
+	int maxLength = lookahead < MAXMATCH ? lookahead : MAXMATCH;
+	int limit = strstart > MAXDISTANCE ? strstart - MAXDISTANCE : 0;
+	const unsigned char *scan = &window[strstart];
+
+	if (best >= config->goodLength)
+	{
+		chain >>= 2;
+	}
+	if (nice > maxLength)
+	{
+		nice = maxLength;
+	}
+	if (best >= maxLength)
+	{
+		return best;
+	}
+
+	do
+	{
+		const unsigned char *match = &window[current];
+		if (match[best] != scan[best] || match[0] != scan[0] || match[1] != scan[1])
+		{
+			continue;
+		}
+
+		int length = matchLength(scan, match, 2, maxLength);
+
+		if (length > best)
+		{
+			matchStart = current;
+			best = length;
+			if (length >= nice)
+			{
+				break;
+			}
+		}
+	}
+	while ((current = prev[current & (WINDOWSIZE - 1)]) >= limit && --chain != 0);
+
+	return best;
+}
+
+/*
+* Level 0: no matches, the input is only collected into stored blocks.
+*/
+template <class Sink>
+void TDeflate<Sink>::deflateStored(int stop)
+{
+	while (lookahead >= stop && lookahead > 0)
+	{
+		int count = MAXSTORED - (strstart - blockStart);
+		if (count > lookahead)
+		{
+			count = lookahead;
+		}
+		strstart += count;
+		lookahead -= count;
+
+		if (strstart - blockStart == MAXSTORED)
+		{
+			flushBlock(0);
+		}
+	}
+}
+
+/*
+* Level 1: the quickest way to find matches there is.  head[] holds just the
+* last position of each hash of four bytes, without chains, and a position
+* is only tried against that one candidate.  This is how LZ4 and zlib-ng's
+* deflate_quick() find their matches.
+*
+* Notes:
+*
+* - The candidate is checked with a single four byte compare, and a match is
+*   extended with matchLength().  The positions inside a match are skipped
+*   without being hashed, apart from the last one.
+*
+* - After 1 << FASTSKIPSHIFT positions in a row without a match, the search
+*   starts stepping over positions, one more for every 1 << FASTSKIPSHIFT
+*   misses, and the bytes stepped over go out as literals.  Data that does
+*   not compress then costs little more than the copy into the window.
+*/
+template <class Sink>
+void TDeflate<Sink>::deflateFast(int stop)
+{
+	/* The loop works on locals, since the stores to the symbol buffer could
+	   otherwise alias the members and force them to be reloaded. */
+	const unsigned char *base = window;
+	int *table = head;
+	int position = strstart, left = lookahead, count = symbolCount;
+	int misses = 0;
+
+	while (left >= stop && left > 0)
+	{
+		if (left >= 4)
+		{
+			unsigned int hash = fastHash(&base[position]);
+			int current = table[hash];
+			table[hash] = position;
+
+			if (current >= 0 && position - current <= MAXDISTANCE &&
+				memcmp(&base[current], &base[position], 4) == 0)
+			{
+				int maxLength = left < MAXMATCH ? left : MAXMATCH;
+				int length = matchLength(&base[position], &base[current], 4, maxLength);
+				int distance = position - current - 1;
+
+				symbolDistances[count] = (unsigned short)(distance + 1);
+				symbolValues[count++] = (unsigned short)(length - MINMATCH);
+				litFreq[ENDBLOCK + 1 + lengthCode[length - MINMATCH]]++;
+				distFreq[distanceCode[distance < 256 ? distance : 256 + (distance >> 7)]]++;
+
+				position += length;
+				left -= length;
+				if (left >= 4)
+				{
+					table[fastHash(&base[position - 1])] = position - 1;
+				}
+				misses = 0;
+
+				if (count == SYMBOLBUFFERSIZE)
+				{
+					strstart = position;
+					lookahead = left;
+					symbolCount = count;
+					flushBlock(0);
+					count = 0;
+				}
+				continue;
+			}
+		}
+
+		/* Literals, more of them the longer there has been no match. */
+		int step = 1 + (misses++ >> FASTSKIPSHIFT);
+		if (step > left - stop + 1 || step > SYMBOLBUFFERSIZE - count)
+		{
+			step = 1;
+		}
+		left -= step;
+		while (step-- > 0)
+		{
+			int c = base[position++];
+			symbolDistances[count] = 0;
+			symbolValues[count++] = (unsigned short)c;
+			litFreq[c]++;
+		}
+
+		if (count == SYMBOLBUFFERSIZE)
+		{
+			strstart = position;
+			lookahead = left;
+			symbolCount = count;
+			flushBlock(0);
+			count = 0;
+		}
+	}
+
+	strstart = position;
+	lookahead = left;
+	symbolCount = count;
+}
+
+/*
+* Levels 2 and 3: take the longest match at each position, if there is one.
+* Only the strings inside short matches are added to the hash chains.
+*/
+template <class Sink>
+void TDeflate<Sink>::deflateGreedy(int stop)
+{
+	while (lookahead >= stop && lookahead > 0)
+	{
+		int length = 0;
+		if (lookahead >= MINMATCH)
+		{
+			int current = insertString(strstart);
+			if (current >= 0 && strstart - current <= MAXDISTANCE)
+			{
+				length = longestMatch(current, MINMATCH - 1);
+			}
+		}
+
+		if (length >= MINMATCH)
+		{
+			tallyMatch(strstart - matchStart, length);
+			lookahead -= length;
+			if (length <= config->maxLazy && lookahead >= MINMATCH)
+			{
+				while (--length != 0)
+				{
+					insertString(++strstart);
+				}
+				strstart++;
+			}
+			else
+			{
+				strstart += length;
+			}
+		}
+		else
+		{
+			tallyLiteral(window[strstart]);
+			strstart++;
+			lookahead--;
+		}
+
+		if (symbolCount == SYMBOLBUFFERSIZE)
+		{
+			flushBlock(0);
+		}
+	}
+}
+
+/*
+* Levels 4 to 9: a match is only taken if the next position does not have
+* a longer one, in which case the byte at this position goes as a literal
+* and the decision is made again at the next.  This is zlib's
+* deflate_slow().
+*
+* Notes:
+*
+* - matchAvailable means the byte before strstart has not been encoded
+*   yet, because the match at it (prevLength and prevMatch, if there is one)
+*   may still lose to the match at strstart.
+*
+* - A match of only MINMATCH bytes more than TOOFAR back costs about as much
+*   as the three literals it replaces, so it is not used.
+*/
+template <class Sink>
+void TDeflate<Sink>::deflateLazy(int stop)
+{
+	while (lookahead >= stop && lookahead > 0)
+	{
+		int current = -1;
+		if (lookahead >= MINMATCH)
+		{
+			current = insertString(strstart);
+		}
+
+		int length = MINMATCH - 1;
+		if (current >= 0 && prevLength < config->maxLazy && strstart - current <= MAXDISTANCE)
+		{
+			length = longestMatch(current, prevLength);
+			if (length <= prevLength)
+			{
+				length = MINMATCH - 1;
+			}
+			else if (length == MINMATCH && strstart - matchStart > TOOFAR)
+			{
+				length = MINMATCH - 1;
+			}
+		}
+
+		if (prevLength >= MINMATCH && length <= prevLength)
+		{
+			/* The match at the previous byte is the better one. */
+			int maxInsert = strstart + lookahead - MINMATCH;
+			tallyMatch(strstart - 1 - prevMatch, prevLength);
+
+			lookahead -= prevLength - 1;
+			for (int n = prevLength - 2; n > 0; n--)
+			{
+				if (++strstart <= maxInsert)
+				{
+					insertString(strstart);
+				}
+			}
+			strstart++;
+			matchAvailable = false;
+			prevLength = MINMATCH - 1;
+
+			if (symbolCount == SYMBOLBUFFERSIZE)
+			{
+				flushBlock(0);
+			}
+		}
+		else
+		{
+			if (matchAvailable)
+			{
+				tallyLiteral(window[strstart - 1]);
+				if (symbolCount == SYMBOLBUFFERSIZE)
+				{
+					flushBlock(0);
+				}
+			}
+			matchAvailable = true;
+			prevLength = length;
+			prevMatch = matchStart;
+			strstart++;
+			lookahead--;
+		}
+	}
+}
+
+template <class Sink>
+inline void TDeflate<Sink>::tallyLiteral(int c)
+{
+	symbolDistances[symbolCount] = 0;
+	symbolValues[symbolCount++] = (unsigned short)c;
+	litFreq[c]++;
+}
+
+template <class Sink>
+inline void TDeflate<Sink>::tallyMatch(int distance, int length)
+{
+	symbolDistances[symbolCount] = (unsigned short)distance;
+	symbolValues[symbolCount++] = (unsigned short)(length - MINMATCH);
+	litFreq[ENDBLOCK + 1 + lengthCode[length - MINMATCH]]++;
+	distance--;
+	distFreq[distanceCode[distance < 256 ? distance : 256 + (distance >> 7)]]++;
+}
+
+/*
+* Build a canonical Huffman code for the n symbols with the counts in freq,
+* with no code longer than maxBits.  lengths[] gets the code lengths, 0 for
+* unused symbols, and codes[] the codes as canonicalCodes() makes them.
+*
+* Notes:
+*
+* - The code lengths are computed in place over the counts sorted in
+*   increasing order, which is the algorithm of Moffat and Katajainen that
+*   miniz uses: the first pass builds the tree with parent pointers, the
+*   second turns them into depths, and the third counts the leaves at each
+*   depth.
+*
+* - Only the number of codes of each length matters, as the longest codes
+*   go to the least frequent symbols.  To limit the lengths, all the codes
+*   longer than maxBits are made maxBits long, which oversubscribes the
+*   code, and then codes are moved one at a time from maxBits to one bit
+*   longer than the longest shorter code until the code is complete again.
+*
+* - A code needs at least two symbols to be complete, which the decoder
+*   requires, so symbols with no uses are given one if there are fewer.
+*/
+template <class Sink>
+void TDeflate<Sink>::buildCode(const unsigned int *freq, int n, int maxBits, unsigned char *lengths, unsigned short *codes)
+{
+	int sorted[FIXLCODES];		/* (count << 9) | symbol, then the depths */
+	int depth[FIXLCODES];
+	int used = 0;
+
+	for (int symbol = 0; symbol < n; symbol++)
+	{
+		lengths[symbol] = 0;
+		if (freq[symbol] != 0)
+		{
+			sorted[used++] = (int)(freq[symbol] << 9) | symbol;
+		}
+	}
+	for (int symbol = 0; used < 2; symbol++)
+	{
+		if (freq[symbol] == 0)
+		{
+			sorted[used++] = (1 << 9) | symbol;
+		}
+	}
+	std::sort(sorted, sorted + used);
+
+	int *a = depth;
+	for (int k = 0; k < used; k++)
+	{
+		a[k] = sorted[k] >> 9;
+	}
+
+	/* Combine the two smallest weights into a parent until one is left. */
+	int root = 0, leaf = 2, next;
+	a[0] += a[1];
+	for (next = 1; next < used - 1; next++)
+	{
+		if (leaf >= used || a[root] < a[leaf])
+		{
+			a[next] = a[root];
+			a[root++] = next;
+		}
+		else
+		{
+			a[next] = a[leaf++];
+		}
+		if (leaf >= used || (root < next && a[root] < a[leaf]))
+		{
+			a[next] += a[root];
+			a[root++] = next;
+		}
+		else
+		{
+			a[next] += a[leaf++];
+		}
+	}
+
+	/* Depths of the internal nodes. */
+	a[used - 2] = 0;
+	for (next = used - 3; next >= 0; next--)
+	{
+		a[next] = a[a[next]] + 1;
+	}
+
+	/* Number of leaves at each depth. */
+	int count[MAXBITS + 2] = { 0 };
+	int available = 1, internal = 0, bits = 0;
+	root = used - 2;
+	next = used - 1;
+	while (available > 0)
+	{
+		while (root >= 0 && a[root] == bits)
+		{
+			internal++;
+			root--;
+		}
+		while (available > internal)
+		{
+			count[bits > maxBits ? maxBits + 1 : bits]++;
+			next--;
+			available--;
+		}
+		available = 2 * internal;
+		bits++;
+		internal = 0;
+	}
+
+	/* Limit the lengths to maxBits. */
+	count[maxBits] += count[maxBits + 1];
+	unsigned int total = 0;
+	for (bits = maxBits; bits > 0; bits--)
+	{
+		total += (unsigned int)count[bits] << (maxBits - bits);
+	}
+	while (total > (1u << maxBits))
+	{
+		count[maxBits]--;
+		for (bits = maxBits - 1; bits > 0; bits--)
+		{
+			if (count[bits] != 0)
+			{
+				count[bits]--;
+				count[bits + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	/* The most frequent symbols get the shortest codes. */
+	next = used;
+	for (bits = 1; bits <= maxBits; bits++)
+	{
+		for (int k = count[bits]; k > 0; k--)
+		{
+			lengths[sorted[--next] & 0x1ff] = (unsigned char)bits;
+		}
+	}
+
+	canonicalCodes(lengths, n, codes);
+}
+
+/*
+* Assign the canonical Huffman codes for the code lengths of n symbols, with
+* their bits reversed, ready to be written to the stream from the least
+* significant bit.  Symbols of the same length get consecutive codes in
+* symbol order, and shorter codes come before longer ones, which is the
+* order the decoder expects.
+*/
+template <class Sink>
+void TDeflate<Sink>::canonicalCodes(const unsigned char *lengths, int n, unsigned short *codes)
+{
+	int lengthCount[MAXBITS + 1] = { 0 };
+	int nextCode[MAXBITS + 1];
+
+	for (int symbol = 0; symbol < n; symbol++)
+	{
+		lengthCount[lengths[symbol]]++;
+	}
+	lengthCount[0] = 0;
+	for (int bits = 1, code = 0; bits <= MAXBITS; bits++)
+	{
+		code = (code + lengthCount[bits - 1]) << 1;
+		nextCode[bits] = code;
+	}
+
+	for (int symbol = 0; symbol < n; symbol++)
+	{
+		int length = lengths[symbol];
+		if (length != 0)
+		{
+			unsigned int forward = nextCode[length]++, reversed = 0;
+			for (int k = 0; k < length; k++)
+			{
+				reversed = (reversed << 1) | ((forward >> k) & 1);
+			}
+			codes[symbol] = (unsigned short)reversed;
+		}
+	}
+}
+
+/*
+* Write the current block as a stored, fixed or dynamic block, whichever is
+* shortest, and start a new one.  last is set for the final block of the
+* stream.
+*
+* Format notes:
+*
+* - A dynamic block header is the number of literal/length codes less 257
+*   in five bits, the number of distance codes less one in five bits, the
+*   number of code length code lengths less four in four bits, those
+*   lengths in three bits each in the order of codeLengthOrder[], and then
+*   the literal/length and distance code lengths as one sequence coded with
+*   the code length code.
+*
+* - In that sequence, symbol 16 repeats the previous length 3 to 6 times (two
+*   extra bits), 17 repeats a zero 3 to 10 times (three extra bits) and 18
+*   repeats a zero 11 to 138 times (seven extra bits).  The repeats may run
+*   from the literal/length lengths into the distance lengths.
+*
+* - A stored block can only be used while all of its bytes are still in the
+*   window, and is split into pieces of MAXSTORED bytes.  Each piece costs
+*   the block header and padding to a byte, and four bytes of length.
+*/
+template <class Sink>
+void TDeflate<Sink>::flushBlock(int last)
+{
+	unsigned char litLengths[FIXLCODES], distLengths[MAXDCODES];
+	unsigned short litCodes[FIXLCODES], distCodes[MAXDCODES];
+	int storedLength = blockStart >= 0 ? strstart - blockStart : -1;
+
+	if (level == DEFLATESTORE)
+	{
+		storedBlock(&window[blockStart], storedLength, last);
+		blockStart = strstart;
+		return;
+	}
+
+	litFreq[ENDBLOCK] = 1;
+	buildCode(litFreq, MAXLCODES, MAXBITS, litLengths, litCodes);
+	buildCode(distFreq, MAXDCODES, MAXBITS, distLengths, distCodes);
+
+	int litCount = MAXLCODES, distCount = MAXDCODES;
+	while (litCount > 257 && litLengths[litCount - 1] == 0)
+	{
+		litCount--;
+	}
+	while (distCount > 1 && distLengths[distCount - 1] == 0)
+	{
+		distCount--;
+	}
+
+	/* Run length code the code lengths, as symbol and extra bits. */
+	unsigned char all[MAXCODES];
+	unsigned char runSymbols[MAXCODES], runExtra[MAXCODES];
+	unsigned int codeLengthFreq[CODELENGTHCODES] = { 0 };
+	int runs = 0;
+	memcpy(all, litLengths, litCount);
+	memcpy(&all[litCount], distLengths, distCount);
+	for (int n = 0; n < litCount + distCount; )
+	{
+		int length = all[n], repeat = 1;
+		while (n + repeat < litCount + distCount && all[n + repeat] == length)
+		{
+			repeat++;
+		}
+		n += repeat;
+
+		if (length == 0)
+		{
+			while (repeat >= 11)
+			{
+				int k = repeat < 138 ? repeat : 138;
+				runSymbols[runs] = 18;
+				runExtra[runs++] = (unsigned char)(k - 11);
+				repeat -= k;
+			}
+			if (repeat >= 3)
+			{
+				runSymbols[runs] = 17;
+				runExtra[runs++] = (unsigned char)(repeat - 3);
+				repeat = 0;
+			}
+		}
+		else
+		{
+			runSymbols[runs] = (unsigned char)length;
+			runExtra[runs++] = 0;
+			repeat--;
+			while (repeat >= 3)
+			{
+				int k = repeat < 6 ? repeat : 6;
+				runSymbols[runs] = 16;
+				runExtra[runs++] = (unsigned char)(k - 3);
+				repeat -= k;
+			}
+		}
+		while (repeat-- > 0)
+		{
+			runSymbols[runs] = (unsigned char)length;
+			runExtra[runs++] = 0;
+		}
+	}
+	for (int n = 0; n < runs; n++)
+	{
+		codeLengthFreq[runSymbols[n]]++;
+	}
+
+	unsigned char codeLengthLengths[CODELENGTHCODES];
+	unsigned short codeLengthCodes[CODELENGTHCODES];
+	buildCode(codeLengthFreq, CODELENGTHCODES, CODELENGTHBITS, codeLengthLengths, codeLengthCodes);
+	int orderCount = CODELENGTHCODES;
+	while (orderCount > 4 && codeLengthLengths[codeLengthOrder[orderCount - 1]] == 0)
+	{
+		orderCount--;
+	}
+
+	/* The size of the block each way, in bits. */
+	static const unsigned char runExtraBits[3] = { 2, 3, 7 };
+	long long dynamicBits = 3 + 5 + 5 + 4 + 3 * orderCount;
+	long long fixedBits = 3;
+	for (int n = 0; n < CODELENGTHCODES; n++)
+	{
+		dynamicBits += (long long)codeLengthFreq[n] * (codeLengthLengths[n] + (n >= 16 ? runExtraBits[n - 16] : 0));
+	}
+	for (int n = 0; n < MAXLCODES; n++)
+	{
+		int extra = n > ENDBLOCK ? lengthExtra[n - ENDBLOCK - 1] : 0;
+		dynamicBits += (long long)litFreq[n] * (litLengths[n] + extra);
+		fixedBits += (long long)litFreq[n] * (fixedLitLengths[n] + extra);
+	}
+	for (int n = 0; n < MAXDCODES; n++)
+	{
+		dynamicBits += (long long)distFreq[n] * (distLengths[n] + distanceExtra[n]);
+		fixedBits += (long long)distFreq[n] * (fixedDistLengths[n] + distanceExtra[n]);
+	}
+
+	long long storedBits = -1;
+	if (storedLength >= 0)
+	{
+		long long pieces = storedLength == 0 ? 1 : (storedLength + MAXSTORED - 1) / MAXSTORED;
+		storedBits = (storedLength + 5 * pieces) * 8;
+	}
+
+	if (storedBits >= 0 && storedBits <= fixedBits && storedBits <= dynamicBits)
+	{
+		storedBlock(&window[blockStart], storedLength, last);
+	}
+	else if (fixedBits <= dynamicBits)
+	{
+		putBits(last, 1);
+		putBits(FIXED, 2);
+		compressBlock(fixedLitLengths, fixedLitCodes, fixedDistLengths, fixedDistCodes);
+	}
+	else
+	{
+		putBits(last, 1);
+		putBits(DYNAMIC, 2);
+		putBits(litCount - 257, 5);
+		putBits(distCount - 1, 5);
+		putBits(orderCount - 4, 4);
+		for (int n = 0; n < orderCount; n++)
+		{
+			putBits(codeLengthLengths[codeLengthOrder[n]], 3);
+		}
+		for (int n = 0; n < runs; n++)
+		{
+			int symbol = runSymbols[n];
+			putBits(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+			if (symbol >= 16)
+			{
+				putBits(runExtra[n], runExtraBits[symbol - 16]);
+			}
+		}
+		compressBlock(litLengths, litCodes, distLengths, distCodes);
+	}
+
+	blockStart = strstart;
+	symbolCount = 0;
+	memset(litFreq, 0, sizeof(litFreq));
+	memset(distFreq, 0, sizeof(distFreq));
+}
+
+/*
+* Write the symbols of the block with the given codes, and the end-of-block
+* code.
+*
+* Notes:
+*
+* - Each length code is put together with its extra bits into one value
+*   beforehand, for all the match lengths, and each distance code with its
+*   extra bits as it is written, so a match is two additions to the bit
+*   buffer and a literal is one.
+*
+* - The bit buffer is kept in locals and written out after every symbol with
+*   a single eight byte store of which only the whole bytes are kept.  A
+*   symbol is at most 48 bits, so with the up to seven bits left over it
+*   always fits.  The store puts the low byte first, so this assumes a
+*   little-endian processor, as the bit reader does.
+*/
+template <class Sink>
+void TDeflate<Sink>::compressBlock(const unsigned char *litLengths, const unsigned short *litCodes,
+	const unsigned char *distLengths, const unsigned short *distCodes)
+{
+	unsigned int matchCodes[MAXMATCH - MINMATCH + 1];
+	unsigned char matchBits[MAXMATCH - MINMATCH + 1];
+
+	for (int value = 0; value <= MAXMATCH - MINMATCH; value++)
+	{
+		int code = lengthCode[value];
+		int symbol = ENDBLOCK + 1 + code;
+		matchCodes[value] = litCodes[symbol] | ((value + MINMATCH - lengthBase[code]) << litLengths[symbol]);
+		matchBits[value] = (unsigned char)(litLengths[symbol] + lengthExtra[code]);
+	}
+
+	/* Start with fewer than eight bits in the buffer. */
+	alignBits();
+	unsigned long long bits = bitBuffer;
+	int count = bitCount;
+	int length = outLength;
+
+	for (int n = 0; n < symbolCount; n++)
+	{
+		int distance = symbolDistances[n];
+		int value = symbolValues[n];
+
+		if (length > DEFLATEOUTSIZE - 8)
+		{
+			outLength = length;
+			flushOutput();
+			length = 0;
+		}
+
+		if (distance == 0)
+		{
+			bits |= (unsigned long long)litCodes[value] << count;
+			count += litLengths[value];
+		}
+		else
+		{
+			bits |= (unsigned long long)matchCodes[value] << count;
+			count += matchBits[value];
+
+			distance--;
+			int code = distanceCode[distance < 256 ? distance : 256 + (distance >> 7)];
+			unsigned int extra = distance + 1 - distanceBase[code];
+			bits |= (unsigned long long)(distCodes[code] | (extra << distLengths[code])) << count;
+			count += distLengths[code] + distanceExtra[code];
+		}
+
+		memcpy(&outBuffer[length], &bits, 8);
+		length += count >> 3;
+		bits >>= count & ~7;
+		count &= 7;
+	}
+
+	bitBuffer = bits;
+	bitCount = count;
+	outLength = length;
+	putBits(litCodes[ENDBLOCK], litLengths[ENDBLOCK]);
+}
+
+/*
+* Write length bytes of data as stored blocks of up to MAXSTORED bytes.
+* Only the last of them is marked last if last is set.  A length of zero
+* writes one empty block.
+*/
+template <class Sink>
+void TDeflate<Sink>::storedBlock(const unsigned char *data, int length, int last)
+{
+	do
+	{
+		int count = length < MAXSTORED ? length : MAXSTORED;
+		length -= count;
+
+		putBits(length == 0 ? last : 0, 1);
+		putBits(STORED, 2);
+		alignToByte();
+		putByte(count & 0xff);
+		putByte(count >> 8);
+		putByte(~count & 0xff);
+		putByte((~count >> 8) & 0xff);
+
+		while (count > 0)
+		{
+			int room = DEFLATEOUTSIZE - outLength;
+			int copy = count < room ? count : room;
+			memcpy(&outBuffer[outLength], data, copy);
+			outLength += copy;
+			data += copy;
+			count -= copy;
+			if (outLength == DEFLATEOUTSIZE)
+			{
+				flushOutput();
+			}
+		}
+	}
+	while (length > 0);
+}
+
+/* Add count bits of value to the output, least significant bit first. */
+template <class Sink>
+inline void TDeflate<Sink>::putBits(unsigned int value, int count)
+{
+	bitBuffer |= (unsigned long long)value << bitCount;
+	bitCount += count;
+	if (bitCount >= 32)
+	{
+		if (outLength + 4 > DEFLATEOUTSIZE)
+		{
+			flushOutput();
+		}
+		outBuffer[outLength] = (unsigned char)bitBuffer;
+		outBuffer[outLength + 1] = (unsigned char)(bitBuffer >> 8);
+		outBuffer[outLength + 2] = (unsigned char)(bitBuffer >> 16);
+		outBuffer[outLength + 3] = (unsigned char)(bitBuffer >> 24);
+		outLength += 4;
+		bitBuffer >>= 32;
+		bitCount -= 32;
+	}
+}
+
+/* Add a byte to the output.  The output has to be on a byte boundary. */
+template <class Sink>
+inline void TDeflate<Sink>::putByte(int value)
+{
+	if (outLength == DEFLATEOUTSIZE)
+	{
+		flushOutput();
+	}
+	outBuffer[outLength++] = (unsigned char)value;
+}
+
+/* Write out the whole bytes in the bit buffer, leaving fewer than eight bits. */
+template <class Sink>
+void TDeflate<Sink>::alignBits(void)
+{
+	while (bitCount >= 8)
+	{
+		putByte((int)(bitBuffer & 0xff));
+		bitBuffer >>= 8;
+		bitCount -= 8;
+	}
+}
+
+/* Write out the bits that are left, padded with zeros to a byte. */
+template <class Sink>
+void TDeflate<Sink>::alignToByte(void)
+{
+	while (bitCount > 0)
+	{
+		if (outLength == DEFLATEOUTSIZE)
+		{
+			flushOutput();
+		}
+		outBuffer[outLength++] = (unsigned char)bitBuffer;
+		bitBuffer >>= 8;
+		bitCount -= 8;
+	}
+	bitBuffer = 0;
+	bitCount = 0;
+}
+
+/* Pass the whole bytes of output collected so far on to the sink. */
+template <class Sink>
+void TDeflate<Sink>::flushOutput(void)
+{
+	if (outLength > 0)
+	{
+		int ret = pSink->output(outBuffer, outLength);
+		if (ret < 0 && error == 0)
+		{
+			error = ret;
+		}
+		totalOut += outLength;
+		outLength = 0;
+	}
+}
+
+template class TDeflate<CIO>;
+template class TDeflate<CMemorySink>;
+template class TDeflate<CFileSink>;
+template class TDeflate<CNullSink>;
+template class TDeflate<CCallbackSink>;
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "Huffman.h"
+
+/* Compression levels. */
+#define DEFLATESTORE 0					/* stored blocks only */
+#define DEFLATEFASTEST 1
+#define DEFLATEDEFAULT 6
+#define DEFLATEBEST 9
+
+/* What compress() does once it has taken all of its input. */
+#define DEFLATENOFLUSH 0				/* nothing, more input follows */
+#define DEFLATESYNC 1					/* end the block and pad to a byte with an empty stored block */
+#define DEFLATEFINISH 2					/* end the stream */
+
+/*
+	Match finding. Strings of MINMATCH bytes are hashed into HASHSIZE chains.
+	A match has to leave MINLOOKAHEAD bytes of input after it in the window
+	when it is looked for, so a match can never run past the input, and the
+	window slides before that input would reach its end, which keeps matches
+	to MAXDISTANCE bytes back.
+*/
+#define MINMATCH 3
+#define HASHBITS 15
+#define HASHSIZE (1 << HASHBITS)
+#define MINLOOKAHEAD (MAXMATCH + MINMATCH + 1)
+#define MAXDISTANCE (WINDOWSIZE - MINLOOKAHEAD)
+#define TOOFAR 4096						/* a match of MINMATCH is not worth it further back */
+#define MATCHSLACK 16					/* bytes read past the input by the wide compares */
+#define FASTSKIPSHIFT 5					/* level 1 steps one more byte every 32 misses */
+
+/* Blocks. */
+#define SYMBOLBUFFERSIZE 16384			/* literals and matches per block */
+#define MAXSTORED 65535					/* bytes in one stored block */
+#define CODELENGTHCODES 19				/* symbols of the code length code */
+#define CODELENGTHBITS 7				/* maximum bits in a code length code */
+#define ENDBLOCK 256					/* the end-of-block symbol */
+#define DEFLATEOUTSIZE 65536			/* compressed bytes collected before they go to the sink */
+
+/* gzip header the encoder writes. */
+#define GZIPHEADERSIZE 10
+#define GZIPOSUNKNOWN 255
+
+/* How a level finds its matches. */
+#define STRATEGYSTORED 0				/* it does not */
+#define STRATEGYFAST 1					/* one candidate per hash, no chains */
+#define STRATEGYGREEDY 2				/* the longest match on the chain */
+#define STRATEGYLAZY 3					/* the longest, unless the next position has a longer one */
+
+/* Errors */
+#define STREAMFINISHED -22				/* compress() after DEFLATEFINISH, without reset() */
+
+/*
+	Per level tuning, as in zlib. Matches that are goodLength long already
+	cut the search for a better one to a quarter, a match of niceLength ends
+	the search, and at most maxChain strings are compared for each match.
+	maxLazy is the longest match after which the next position is still
+	searched for a longer one by the lazy levels; the greedy levels instead
+	only add the strings inside a match to the hash chains if the match is
+	no longer than that. STRATEGYFAST uses none of these.
+*/
+struct deflateConfig
+{
+	unsigned short goodLength;
+	unsigned short maxLazy;
+	unsigned short niceLength;
+	unsigned short maxChain;
+	int strategy;
+};
+
+/*
+	The encoder. Input is given to compress() in pieces of any size and the
+	compressed data goes to Sink (see Sinks.h), in the raw deflate format or
+	wrapped as a gzip member.
+
+	The input is copied into a window of two WINDOWSIZE halves, as in zlib,
+	so that matches can reach back a whole window whatever the size of the
+	pieces are; when the input reaches the end of the window, the top half
+	is moved down. Positions of earlier strings are kept in hash chains,
+	head[] for the most recent string with each hash and prev[] for the
+	string before that, and the matches found are collected into a block of
+	SYMBOLBUFFERSIZE symbols. Each block is then written as whichever of a
+	stored, fixed or dynamic block is the smallest, the dynamic codes being
+	built for it from its symbol counts.
+*/
+template <class Sink>
+class TDeflate
+{
+public:
+	TDeflate(Sink *pSink, int level);
+	~TDeflate();
+
+	void reset(void);
+	void setDictionary(const unsigned char *dictionary, int length);
+	int compress(const unsigned char *data, size_t size, int flush);
+
+	static void gzipHeader(unsigned char *header, int level);
+
+	/// <summary>
+	/// Sets the compression level, 0 to 9. Takes effect from the next
+	/// reset().
+	/// </summary>
+	void setLevel(int level)
+	{
+		this->level = level < DEFLATESTORE ? DEFLATESTORE : level > DEFLATEBEST ? DEFLATEBEST : level;
+	}
+
+	/// <summary>
+	/// Selects FORMATRAW (the default) or FORMATGZIP, which adds the gzip
+	/// header and trailer. Takes effect from the next reset().
+	/// </summary>
+	void setFormat(int format)
+	{
+		this->format = format;
+	}
+
+	/// <summary>
+	/// Bytes of input taken and of compressed output written since reset().
+	/// </summary>
+	long long getTotalIn() const
+	{
+		return totalIn;
+	}
+
+	long long getTotalOut() const
+	{
+		return totalOut;
+	}
+
+	/// <summary>
+	/// CRC-32 of the input since reset(), kept for FORMATGZIP only.
+	/// </summary>
+	unsigned int getCheck() const
+	{
+		return checkValue;
+	}
+
+	int error;
+
+private:
+	void fillWindow(const unsigned char **data, size_t *size);
+	void slideWindow(void);
+	int insertString(int position);
+	int longestMatch(int current, int best);
+	void deflateStored(int stop);
+	void deflateFast(int stop);
+	void deflateGreedy(int stop);
+	void deflateLazy(int stop);
+	void tallyLiteral(int c);
+	void tallyMatch(int distance, int length);
+	void flushBlock(int last);
+	void storedBlock(const unsigned char *data, int length, int last);
+	void compressBlock(const unsigned char *litLengths, const unsigned short *litCodes,
+		const unsigned char *distLengths, const unsigned short *distCodes);
+	static void buildCode(const unsigned int *freq, int n, int maxBits, unsigned char *lengths, unsigned short *codes);
+	static void canonicalCodes(const unsigned char *lengths, int n, unsigned short *codes);
+	void putBits(unsigned int value, int count);
+	void putByte(int value);
+	void alignBits(void);
+	void alignToByte(void);
+	void flushOutput(void);
+
+	Sink *pSink;
+	int level;
+	int format;
+	const struct deflateConfig *config;
+
+	/* The window and the hash chains. */
+	unsigned char *window;
+	int *head;
+	int *prev;
+	int strstart;			/* next position to be encoded */
+	int lookahead;			/* bytes of input in the window from strstart on */
+	int blockStart;			/* first position of the current block, negative if it slid out */
+	int matchStart;			/* where longestMatch() found its match */
+	int prevLength;			/* lazy matching: the match at strstart - 1 */
+	int prevMatch;
+	bool matchAvailable;	/* lazy matching: the byte at strstart - 1 is not encoded yet */
+
+	/* The symbols of the current block and their counts. */
+	unsigned short *symbolDistances;	/* 0 for a literal */
+	unsigned short *symbolValues;		/* the literal, or the match length less MINMATCH */
+	int symbolCount;
+	unsigned int litFreq[FIXLCODES];
+	unsigned int distFreq[MAXDCODES];
+	unsigned char lengthCode[MAXMATCH - MINMATCH + 1];
+	unsigned char distanceCode[512];
+	unsigned char fixedLitLengths[FIXLCODES], fixedDistLengths[MAXDCODES];
+	unsigned short fixedLitCodes[FIXLCODES], fixedDistCodes[MAXDCODES];
+
+	/* The compressed output. */
+	unsigned long long bitBuffer;
+	int bitCount;
+	unsigned char *outBuffer;
+	int outLength;
+
+	bool started;			/* the gzip header has been written */
+	bool finished;
+	unsigned int checkValue;
+	long long totalIn, totalOut;
+};
+
+/* The encoder for the run-time configured CIO output. */
+typedef TDeflate<CIO> CDeflate;
+
+/* Instantiated in Deflate.cpp. */
+extern template class TDeflate<CIO>;
+extern template class TDeflate<CMemorySink>;
+extern template class TDeflate<CFileSink>;
+extern template class TDeflate<CNullSink>;
+extern template class TDeflate<CCallbackSink>;
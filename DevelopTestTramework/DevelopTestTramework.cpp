@@ -3,89 +3,310 @@
 
 #include "stdafx.h"
 #include "structs.h"
-#include <io.h>
-#include <malloc.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Huffman.h"
+#include "MappedFile.h"
+#include "GZip.h"
+#include "Zlib.h"
+#include "ParallelInflate.h"
+#include "Benchmark.h"
+#include "SeekIndex.h"
+#include "Deflate.h"
+#include "ParallelDeflate.h"
+#include "PipelineInflate.h"
 
 static char test[] = "D:\\work\\Data Compression Dev\\TestData\\Data18.def";
 
 // Look at:
 //   https://www.daylight.com/meetings/mug00/Sayle/gzip.html#:~:text=Stored%20blocks%20are%20allowed%20to,size%20of%20the%20gzip%20header.
 
-/*/ <summary>
-/// This function simply allocates memory and loads a file into it.
-/// </summary>
-/// <param name="filePath">File path of the file to load.</param>
-/// <param name="len">Once function is complete, this will contain the file length.</param>
-/// <returns>Allocated/populate memory buffer.</returns>
+/*
+* Build the seek index of the file and save it as the file name plus
+* ".idx", or read length bytes from offset in its output with the index
+* saved before, building it first if there is none.  The bytes read go to
+* outPath, or to standard output.
 */
-void *load(const char *filePath, int *len)
+static int seek(const char *filePath, const unsigned char *data, size_t size, int build, long long offset, int length, const char *outPath)
 {
-	/* Assume 0. */
-	*len = 0;
+	char indexPath[1024];
+	CSeekIndex seekIndex;
+	int error;
 
-	/* Attempt to open the file. */
-	FILE *fp = fopen(filePath, "rb");
-	/* If file did not open return NULL indicating error. */
-	if (fp == NULL)
+	snprintf(indexPath, sizeof(indexPath), "%s.idx", filePath);
+	if (build || seekIndex.load(indexPath, data, size) != 0)
 	{
-		return NULL;
+		error = seekIndex.build(data, size, SEEKSPAN);
+		if (error == 0)
+		{
+			error = seekIndex.save(indexPath, data, size);
+		}
+		if (error != 0)
+		{
+			printf("Could not build the index (%d).\n", error);
+			return 1;
+		}
+	}
+	if (build)
+	{
+		printf("%d checkpoints for %lld bytes.\n", seekIndex.getCheckpointCount(), seekIndex.getLength());
+		return 0;
 	}
 
-	/* Populate *len with the file length. This line will not port to gss Linux. */
-	*len = (int)_filelength(_fileno(fp));
-
-	/* Allocate the membory. */
-	void *ret = malloc(*len);
-	/* Check to see if memory allocated. */
-	if (ret == NULL)
+	unsigned char *out = new unsigned char[length > 0 ? length : 1];
+	int count = seekIndex.read(data, size, offset, out, length);
+	if (count < 0)
 	{
-		/* Set len to 0. */
-		*len = 0;
-		/* Close the file. */
-		fclose(fp);
-		/* Bail out return NULL to indicate error. */
-		return NULL;
+		printf("Read failed (%d).\n", count);
+		delete [] out;
+		return 1;
 	}
 
-	/* Read the data. */
-	fread(ret, *len, sizeof(char), fp);
-	/* Close the file. */
-	fclose(fp);
+	FILE *fp = outPath != NULL ? fopen(outPath, "wb") : stdout;
+	if (fp != NULL)
+	{
+		fwrite(out, 1, count, fp);
+		if (fp != stdout)
+		{
+			fclose(fp);
+		}
+	}
+	delete [] out;
 
-	/* Return the allocated/populated buffer. */
-	return ret;
+	return fp == NULL;
 }
 
 /* Typeical start of program. */
-void main(int argc, char* argv[])
+int main(int argc, char* argv[])
 {
-	int len;
+	/* -bench file.gz times the decode modes instead of writing output. */
+	int bench = argc > 2 && strcmp(argv[1], "-bench") == 0;
+	if (bench)
+	{
+		argv++;
+		argc--;
+	}
 
-	/* Call load in order to get the allocated/populated buffer. */
-	unsigned char *fileBuffer = (unsigned char *)load( test, &len );
-	/* Check for load() failure. */
-	if (fileBuffer == NULL)
+	/* -parallel n decodes with n threads. */
+	int threads = 0;
+	if (argc > 3 && strcmp(argv[1], "-parallel") == 0)
+	{
+		threads = atoi(argv[2]);
+		argv += 2;
+		argc -= 2;
+	}
+
+#ifdef DECODESTATS
+	/* -stats file.json writes what the decoder saw in each block. */
+	const char *statsPath = NULL;
+	if (argc > 3 && strcmp(argv[1], "-stats") == 0)
+	{
+		statsPath = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+#endif
+
+	/* -compress level file out.gz writes a gzip file instead, with -parallel
+	   on several threads. */
+	int level = -1;
+	if (argc > 4 && strcmp(argv[1], "-compress") == 0)
+	{
+		level = atoi(argv[2]);
+		argv += 2;
+		argc -= 2;
+	}
+
+	/* -dict file is the preset dictionary of a zlib stream that needs one. */
+	const char *dictionaryPath = NULL;
+	if (argc > 3 && strcmp(argv[1], "-dict") == 0)
+	{
+		dictionaryPath = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+
+	/* -index builds a seek index and saves it next to the file, and
+	   -read offset length reads a range of the output with it. */
+	int index = argc > 2 && strcmp(argv[1], "-index") == 0;
+	long long readOffset = -1;
+	int readLength = 0;
+	if (index)
+	{
+		argv++;
+		argc--;
+	}
+	else if (argc > 4 && strcmp(argv[1], "-read") == 0)
+	{
+		readOffset = atoll(argv[2]);
+		readLength = atoi(argv[3]);
+		argv += 3;
+		argc -= 3;
+	}
+
+	/* -pipeline file out decodes file to out with the reading, decoding and
+	   writing overlapped, never holding either file whole. */
+	if (argc > 3 && strcmp(argv[1], "-pipeline") == 0)
+	{
+		CPipelineInflate pipeline;
+		if (pipeline.decompress(argv[2], argv[3]) != 0)
+		{
+			printf("Decompression failed (%d).\n", pipeline.error);
+			return 1;
+		}
+		printf("Decompressed %lld bytes.\n", pipeline.getBytesWritten());
+		return 0;
+	}
+
+	/* The file to decode can be given on the command line. */
+	const char *filePath = argc > 1 ? argv[1] : test;
+
+	/* Map the file so the decoder reads straight from the page cache. */
+	CMappedFile file;
+	if (file.open(filePath, MAPSEQUENTIAL) != 0 || file.size() == 0)
 	{
 		/* Show error */
 		printf("Could not open input file.\n");
 		/* Bail out of program.*/
-		exit(0);
+		return 1;
+	}
+	const unsigned char *fileBuffer = file.data();
+	size_t len = file.size();
+
+	if (bench)
+	{
+		/* Time the deflate data of the first member. */
+		struct GZipMember member;
+		if (CGZip::parseHeader(fileBuffer, len, 0, &member) != 0)
+		{
+			printf("Not a gzip file.\n");
+			return 1;
+		}
+		CBenchmark benchmark(&fileBuffer[member.dataOffset], len - member.dataOffset);
+		return benchmark.compareDecodeModes(filePath) != 0;
+	}
+
+	if (level >= 0)
+	{
+		/* With -parallel the pieces are compressed on that many threads. */
+		CIO out( argv[2], DISKBUFFERSIZE );
+		int error;
+		long long compressed;
+		if (threads > 0)
+		{
+			TParallelDeflate<CIO> deflate( &out, threads, level );
+			error = deflate.compress( fileBuffer, len );
+			compressed = deflate.getTotalOut();
+		}
+		else
+		{
+			CDeflate deflate( &out, level );
+			deflate.setFormat( FORMATGZIP );
+			deflate.reset();
+			error = deflate.compress( fileBuffer, len, DEFLATEFINISH );
+			compressed = deflate.getTotalOut();
+		}
+		out.close();
+		if (error != 0 || out.getError() != 0)
+		{
+			printf("Compression failed (%d, %d).\n", error, out.getError());
+			return 1;
+		}
+		printf("Compressed %zu bytes to %lld.\n", len, compressed);
+		return 0;
 	}
 
-	/* The first thing we will do is get the gzip buffer. Later
-	   we may look at it. */
-	struct GZipHeader header;
-	memcpy(&header, fileBuffer, sizeof(GZipHeader));
+	if (index || readOffset >= 0)
+	{
+		return seek(filePath, fileBuffer, len, index, readOffset, readLength, argc > 2 ? argv[2] : NULL);
+	}
 
-	/* The plan is to overload the constructor with output options. */
+	/* Output goes to the file named by the second argument, or to memory
+	   that grows as needed. */
 	CLZ *lz = new CLZ();
-	unsigned char* pOutputBuffer = new unsigned char [100000];
-	int size = 100000;
-	CIO* io = new CIO( pOutputBuffer, size );
+	CIO* io;
+	if (argc > 2)
+	{
+		io = new CIO( argv[2], DISKBUFFERSIZE );
+	}
+	else
+	{
+		io = new CIO( GROWABLEINITIALSIZE );
+	}
 	CHuffman huff( lz, io );
-	huff.decompress(&fileBuffer[sizeof(GZipHeader)], len - sizeof(GZipHeader) );
+	/* The input can be a gzip file, a zlib stream or raw deflate data. */
+	int format = CZlib::detect( fileBuffer, len );
+	int error;
+	if (format == FORMATZLIB)
+	{
+		CMappedFile dictionary;
+		CZlib zlib( &huff );
+		if (dictionaryPath != NULL)
+		{
+			if (dictionary.open( dictionaryPath, MAPSEQUENTIAL ) != 0)
+			{
+				printf("Could not open dictionary %s.\n", dictionaryPath);
+				delete lz;
+				delete io;
+				return 1;
+			}
+			zlib.setDictionary( dictionary.data(), (int)dictionary.size() );
+		}
+		error = zlib.decompress( fileBuffer, len );
+	}
+	else if (format == FORMATRAW)
+	{
+		huff.setFormat( FORMATRAW );
+		huff.decompress( fileBuffer, len );
+		error = huff.error;
+	}
+	else if (threads > 0)
+	{
+		TParallelInflate<CIO> parallel( io, threads );
+		error = parallel.decompress( fileBuffer, len );
+	}
+	else
+	{
+		/* Decode every member of the file, checking each one's trailer. */
+		CGZip gzip( &huff );
+		error = gzip.decompress( fileBuffer, len );
+	}
+	io->close();
+
+	int status = 0;
+	if (error != 0 || io->getError() != 0)
+	{
+		printf("Decompression failed (%d, %d).\n", error, io->getError());
+		status = 1;
+	}
+	else
+	{
+		printf("Decompressed %lld bytes.\n", io->getBytesWritten());
+		if (threads == 0 && huff.getCacheHits() + huff.getCacheMisses() > 0)
+		{
+			printf("Reused the code tables of %lld of %lld dynamic blocks.\n", huff.getCacheHits(),
+				huff.getCacheHits() + huff.getCacheMisses());
+		}
+	}
+
+#ifdef DECODESTATS
+	if (statsPath != NULL)
+	{
+		FILE *fp = fopen(statsPath, "w");
+		if (fp == NULL || huff.stats.writeJson(fp) != 0)
+		{
+			printf("Could not write %s.\n", statsPath);
+			status = 1;
+		}
+		if (fp != NULL)
+		{
+			fclose(fp);
+		}
+	}
+#endif
+
 	delete lz;
 	delete io;
+
+	return status;
 }
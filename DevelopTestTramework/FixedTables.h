@@ -0,0 +1,146 @@
+#pragma once
+
+#include "structs.h"
+
+/*
+	The decoding tables of the fixed codes of deflate (RFC 1951, 3.2.6),
+	worked out by the compiler. They never change, so every decoder can
+	share one constant copy of them, and there is nothing to build the first
+	time a fixed block is seen or for two threads to race on.
+
+	TFixedCode<Symbols, RootBits> is one fixed code: the counts and sorted
+	symbols that the canonical decoder steps through, and the lookup table.
+	They are made the same way construct() and buildTable() make them for a
+	dynamic code, but no fixed code is longer than its root bits, so there
+	are no subtables. CFixedLiterals is the multiple literal table made from
+	the literal/length lookup table, as buildLiteralTable() makes it.
+
+	The includer defines MAXBITS, FIXLCODES, LITBITS, MAXLITERALS and the
+	TABLE entry kinds (see Huffman.h).
+
+	Format notes:
+
+	- The literal/length code lengths are 8 for 0..143, 9 for 144..255, 7 for
+	  256..279 and 8 for 280..287. All of the distance codes are 5 bits.
+
+	- Only 30 distance symbols are given codes, as in fixed() of puff, so the
+	  two unused five bit patterns stay TABLEINVALID.
+*/
+
+/// <summary>
+/// Length of the fixed code of symbol, in a code of symbols symbols.
+/// </summary>
+constexpr short fixedCodeLength(int symbols, int symbol)
+{
+	return symbols < FIXLCODES ? 5 :
+		symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+}
+
+template <int Symbols, int RootBits>
+struct TFixedCode
+{
+	short count[MAXBITS + 1];
+	short symbol[Symbols];
+	struct decodeEntry table[1 << RootBits];
+
+	constexpr TFixedCode() : count(), symbol(), table()
+	{
+		short offset[MAXBITS + 1] = {};
+
+		/* count the codes of each length and sort the symbols by length */
+		for (int n = 0; n < Symbols; n++)
+		{
+			count[fixedCodeLength(Symbols, n)]++;
+		}
+		for (int len = 1; len < MAXBITS; len++)
+		{
+			offset[len + 1] = offset[len] + count[len];
+		}
+		for (int n = 0; n < Symbols; n++)
+		{
+			symbol[offset[fixedCodeLength(Symbols, n)]++] = (short)n;
+		}
+
+		/* every bit pattern starts out invalid */
+		for (int fill = 0; fill < (1 << RootBits); fill++)
+		{
+			table[fill].value = 0;
+			table[fill].bits = 0;
+			table[fill].op = TABLEINVALID;
+		}
+
+		/* the canonical codes, reversed to index the table */
+		int code = 0, index = 0;
+		for (int len = 1; len <= MAXBITS; len++)
+		{
+			for (int left = count[len]; left > 0; left--)
+			{
+				int reversed = 0;
+				for (int bit = 0; bit < len; bit++)
+				{
+					reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+				}
+				for (int fill = reversed; fill < (1 << RootBits); fill += 1 << len)
+				{
+					table[fill].value = (unsigned short)symbol[index];
+					table[fill].bits = (unsigned char)len;
+					table[fill].op = TABLESYMBOL;
+				}
+				index++;
+				code++;
+			}
+			code <<= 1;
+		}
+	}
+};
+
+struct CFixedLiterals
+{
+	struct literalEntry entries[1 << LITBITS];
+
+	/* table is the literal/length lookup table, which has no subtables. */
+	constexpr CFixedLiterals(const struct decodeEntry *table, int rootBits) : entries()
+	{
+		/* single literals */
+		for (int index = 0; index < (1 << LITBITS); index++)
+		{
+			const struct decodeEntry &entry = table[index & ((1 << rootBits) - 1)];
+			entries[index].count = 0;
+			entries[index].bits = 0;
+			entries[index].lit[0] = entries[index].lit[1] = entries[index].lit[2] = 0;
+			entries[index].symbol = 0;
+			if (entry.op == TABLESYMBOL && entry.bits <= LITBITS)
+			{
+				entries[index].bits = entry.bits;
+				if (entry.value < 256)
+				{
+					entries[index].count = 1;
+					entries[index].lit[0] = (unsigned char)entry.value;
+				}
+				else
+				{
+					entries[index].symbol = entry.value;
+				}
+			}
+		}
+
+		/* add the literals that follow, from the top down as in buildLiteralTable() */
+		for (int index = (1 << LITBITS) - 1; index >= 0; index--)
+		{
+			struct literalEntry single = entries[index];
+			for (int count = 1; entries[index].count == count && count < MAXLITERALS; count++)
+			{
+				int next = index >> entries[index].bits;
+				const struct literalEntry &follow = next == index ? single : entries[next];
+				if (follow.count == 0 || entries[index].bits + follow.bits > LITBITS)
+				{
+					break;
+				}
+
+				entries[index].lit[count] = follow.lit[0];
+				entries[index].bits = (unsigned char)(entries[index].bits + follow.bits);
+				entries[index].count++;
+			}
+		}
+	}
+};
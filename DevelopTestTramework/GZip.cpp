@@ -0,0 +1,301 @@
+#include "stdafx.h"
+#include <string.h>
+#include "GZip.h"
+#include "Crc32.h"
+
+template <class Sink>
+TGZip<Sink>::TGZip(THuffman<Sink> *pHuffman)
+{
+	this->pHuffman = pHuffman;
+	error = 0;
+	members = NULL;
+	memberCount = memberCapacity = 0;
+	trailing = 0;
+}
+
+template <class Sink>
+TGZip<Sink>::~TGZip()
+{
+	delete [] members;
+}
+
+/*
+* Decompress every member of the gzip file in data, in order, to the
+* decoder's output.  Returns 0 or an error, which is also left in error.
+*
+* Format notes:
+*
+* - A member ends with its trailer, and the next one starts right after it.
+*   The deflate data carries no length, so the end of a member is only known
+*   once it has been decoded.
+*
+* - Anything after the last member that does not start like a member is
+*   ignored, as gzip does.  Tape and block devices pad files with zeros, for
+*   example.  The first member has to be there, though.
+*/
+template <class Sink>
+int TGZip<Sink>::decompress(const unsigned char *data, size_t size)
+{
+	struct GZipMember member;
+	size_t offset = 0;
+	long long output = 0;
+
+	error = 0;
+	memberCount = 0;
+	trailing = 0;
+
+	while (offset < size)
+	{
+		if (memberCount > 0 && !isMember(data, size, offset))
+		{
+			trailing = size - offset;
+			break;
+		}
+
+		error = parseHeader(data, size, offset, &member);
+		if (error != 0)
+		{
+			return error;
+		}
+
+		member.outputOffset = output;
+		error = decompressMember(data, size, &member);
+		if (error != 0)
+		{
+			return error;
+		}
+
+		addMember(&member);
+		output += member.outputLength;
+		offset = member.endOffset;
+	}
+
+	if (memberCount == 0)
+	{
+		error = NOTGZIP;
+	}
+
+	return error;
+}
+
+/*
+* Decode one member whose header has been parsed into member, and check its
+* trailer.  If member->endOffset is already known, the decoder is only given
+* the member itself.  Sets the end and the output length of the member, and
+* returns 0 or the decoder's error.
+*/
+template <class Sink>
+int TGZip<Sink>::decompressMember(const unsigned char *data, size_t size, struct GZipMember *member)
+{
+	size_t end = member->endOffset != 0 ? member->endOffset : size;
+
+	pHuffman->setFormat(FORMATGZIP);
+	pHuffman->decompress(&data[member->dataOffset], end - member->dataOffset);
+	if (pHuffman->error != 0)
+	{
+		return pHuffman->error;
+	}
+
+	member->endOffset = member->dataOffset + pHuffman->inputUsed();
+	member->outputLength = pHuffman->outputLength();
+
+	return 0;
+}
+
+/*
+* Find the members without decoding them.  That is only possible where the
+* header says how long the member is, as the BGZF extra field does, so the
+* scan stops at the first member that does not.  Returns the number of
+* members found; their output offsets are not known and are left at -1.
+*/
+template <class Sink>
+int TGZip<Sink>::scan(const unsigned char *data, size_t size)
+{
+	struct GZipMember member;
+	size_t offset = 0;
+
+	error = 0;
+	memberCount = 0;
+	trailing = 0;
+
+	while (offset < size && isMember(data, size, offset))
+	{
+		if (parseHeader(data, size, offset, &member) != 0 || member.blockSize == 0 ||
+			member.blockSize > size - offset)
+		{
+			break;
+		}
+
+		member.endOffset = offset + member.blockSize;
+		member.outputOffset = member.outputLength = -1;
+		addMember(&member);
+		offset = member.endOffset;
+	}
+
+	return memberCount;
+}
+
+/*
+* Parse the header of the member at offset into member.  Returns 0, DATAEND
+* if the header is cut off, NOTGZIP, BADMETHOD, BADFLAGS or
+* HEADERCRCMISMATCH.
+*
+* Format notes:
+*
+* - The ten-byte fixed part (struct GZipHeader) is followed by the optional
+*   fields in this order: the extra field (a two-byte length and that many
+*   bytes), the file name and the comment (both zero-terminated), and a
+*   CRC-16 of the header so far, which is the low half of its CRC-32.  All
+*   numbers are least significant byte first.
+*
+* - The extra field is a list of subfields, each two identifying bytes, a
+*   two-byte length and the data.  BGZF, which is what bgzip and samtools
+*   write, puts a subfield 'B' 'C' with the size of the whole member minus
+*   one in every header.
+*/
+template <class Sink>
+int TGZip<Sink>::parseHeader(const unsigned char *data, size_t size, size_t offset, struct GZipMember *member)
+{
+	struct GZipHeader header;
+	size_t at = offset + sizeof(GZipHeader);
+
+	if (size - offset < sizeof(GZipHeader))
+	{
+		return DATAEND;
+	}
+
+	memcpy(&header, &data[offset], sizeof(GZipHeader));
+	if (header.magic[0] != GZIPID1 || header.magic[1] != GZIPID2)
+	{
+		return NOTGZIP;
+	}
+
+	if (header.cm != GZIPDEFLATE)
+	{
+		return BADMETHOD;
+	}
+
+	if (header.flags & FRESERVED)
+	{
+		return BADFLAGS;
+	}
+
+	memset(member, 0, sizeof(struct GZipMember));
+	member->offset = offset;
+	member->flags = header.flags;
+	member->mtime = header.timedate[0] | (header.timedate[1] << 8) |
+		(header.timedate[2] << 16) | ((unsigned int)header.timedate[3] << 24);
+	member->extraFlags = header.flags2;
+	member->os = header.os;
+
+	if (header.flags & FEXTRA)
+	{
+		if (size - at < 2)
+		{
+			return DATAEND;
+		}
+		member->extraLength = data[at] | (data[at + 1] << 8);
+		member->extraOffset = at + 2;
+		at += 2;
+		if (size - at < member->extraLength)
+		{
+			return DATAEND;
+		}
+
+		/* Look for the BGZF block size. */
+		const unsigned char *field = &data[at];
+		unsigned int left = member->extraLength;
+		while (left >= 4)
+		{
+			unsigned int length = field[2] | (field[3] << 8);
+			if (length > left - 4)
+			{
+				break;
+			}
+			if (field[0] == 'B' && field[1] == 'C' && length == 2)
+			{
+				member->blockSize = (field[4] | (field[5] << 8)) + 1;
+			}
+			field += 4 + length;
+			left -= 4 + length;
+		}
+		at += member->extraLength;
+	}
+
+	if (header.flags & FNAME)
+	{
+		const void *end = memchr(&data[at], 0, size - at);
+		if (end == NULL)
+		{
+			return DATAEND;
+		}
+		member->nameOffset = at;
+		at = (const unsigned char *)end - data + 1;
+	}
+
+	if (header.flags & FCOMMENT)
+	{
+		const void *end = memchr(&data[at], 0, size - at);
+		if (end == NULL)
+		{
+			return DATAEND;
+		}
+		member->commentOffset = at;
+		at = (const unsigned char *)end - data + 1;
+	}
+
+	if (header.flags & FHCRC)
+	{
+		if (size - at < 2)
+		{
+			return DATAEND;
+		}
+		unsigned int check = data[at] | (data[at + 1] << 8);
+		if (check != (CCrc32::update(0, &data[offset], at - offset) & 0xffff))
+		{
+			return HEADERCRCMISMATCH;
+		}
+		at += 2;
+	}
+
+	member->dataOffset = at;
+	return 0;
+}
+
+/// <summary>
+/// True if the bytes at offset start with the gzip identification bytes.
+/// </summary>
+template <class Sink>
+int TGZip<Sink>::isMember(const unsigned char *data, size_t size, size_t offset)
+{
+	return size - offset >= 2 && data[offset] == GZIPID1 && data[offset + 1] == GZIPID2;
+}
+
+/// <summary>
+/// Adds a member to the list, growing it as needed.
+/// </summary>
+template <class Sink>
+void TGZip<Sink>::addMember(const struct GZipMember *member)
+{
+	if (memberCount == memberCapacity)
+	{
+		int capacity = memberCapacity == 0 ? 16 : memberCapacity * 2;
+		struct GZipMember *grown = new struct GZipMember[capacity];
+		if (memberCount > 0)
+		{
+			memcpy(grown, members, memberCount * sizeof(struct GZipMember));
+		}
+		delete [] members;
+		members = grown;
+		memberCapacity = capacity;
+	}
+
+	members[memberCount++] = *member;
+}
+
+/* The outputs the container is built for. */
+template class TGZip<CIO>;
+template class TGZip<CMemorySink>;
+template class TGZip<CFileSink>;
+template class TGZip<CNullSink>;
+template class TGZip<CCallbackSink>;
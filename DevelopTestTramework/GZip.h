@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Huffman.h"
+#include "structs.h"
+
+/* Identification bytes and compression method of a gzip member. */
+#define GZIPID1 0x1f
+#define GZIPID2 0x8b
+#define GZIPDEFLATE 8
+
+/* Header flags (FLG). */
+#define FTEXT 1				/* probably text, which changes nothing here */
+#define FHCRC 2				/* the header ends with a CRC-16 of itself */
+#define FEXTRA 4			/* an extra field follows the fixed part */
+#define FNAME 8				/* zero-terminated original file name */
+#define FCOMMENT 16			/* zero-terminated comment */
+#define FRESERVED 0xe0		/* must be zero */
+
+/* Errors */
+#define NOTGZIP -16
+#define BADMETHOD -17
+#define BADFLAGS -18
+#define HEADERCRCMISMATCH -19
+
+/*
+	The gzip container. A gzip file is one or more members, each a header,
+	a deflate stream and a trailer, and decompressing it gives the output of
+	all the members one after the other (which is what concatenating .gz
+	files relies on). Each member is decoded with its own fresh window and
+	checked against its own trailer.
+
+	The members that have been found are kept, with where each one starts
+	and ends in the input and in the output, so they can be decoded again
+	one at a time, or handed to different threads, without reading through
+	the file from the start.
+*/
+template <class Sink>
+class TGZip
+{
+public:
+	TGZip(THuffman<Sink> *pHuffman);
+	~TGZip();
+
+	int decompress(const unsigned char *data, size_t size);
+	int decompressMember(const unsigned char *data, size_t size, struct GZipMember *member);
+	int scan(const unsigned char *data, size_t size);
+
+	static int parseHeader(const unsigned char *data, size_t size, size_t offset, struct GZipMember *member);
+
+	/// <summary>
+	/// Number of members found by the last decompress() or scan().
+	/// </summary>
+	int getMemberCount() const
+	{
+		return memberCount;
+	}
+
+	/// <summary>
+	/// The member at index, in the order they appear in the file.
+	/// </summary>
+	const struct GZipMember *getMember(int index) const
+	{
+		return &members[index];
+	}
+
+	/// <summary>
+	/// Number of bytes after the last member that are not another member.
+	/// Like gzip, these are ignored.
+	/// </summary>
+	size_t getTrailingBytes() const
+	{
+		return trailing;
+	}
+
+	int error;
+
+private:
+	void addMember(const struct GZipMember *member);
+	static int isMember(const unsigned char *data, size_t size, size_t offset);
+
+	THuffman<Sink> *pHuffman;
+	struct GZipMember *members;
+	int memberCount, memberCapacity;
+	size_t trailing;
+};
+
+/* The container for the run-time configured CIO output. */
+typedef TGZip<CIO> CGZip;
+
+/* Instantiated in GZip.cpp. */
+extern template class TGZip<CIO>;
+extern template class TGZip<CMemorySink>;
+extern template class TGZip<CFileSink>;
+extern template class TGZip<CNullSink>;
+extern template class TGZip<CCallbackSink>;
@@ -1,59 +1,95 @@
 #include "stdafx.h"
 #include "Huffman.h"
 #include "structs.h"
-
-CHuffman::CHuffman(CLZ *pLZ,CIO *pCIO)
+#include "MarkerLZ.h"
+#include "FixedTables.h"
+
+/* Base lengths and extra bits of length symbols 257..285, and base distances
+   and extra bits of distance symbols 0..29.  The encoder uses them too. */
+const short lengthBase[LENGTHCODES] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const short lengthExtra[LENGTHCODES] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const short distanceBase[MAXDCODES] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577 };
+const short distanceExtra[MAXDCODES] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 13, 13 };
+
+/* The fixed codes, shared by every decoder.  See FixedTables.h. */
+static constexpr TFixedCode<FIXLCODES, LENROOTBITS> fixedLengthCode;
+static constexpr TFixedCode<MAXDCODES, DISTROOTBITS> fixedDistanceCode;
+static constexpr CFixedLiterals fixedLiterals(fixedLengthCode.table, LENROOTBITS);
+static const struct huffman fixedLencode =
+	{ fixedLengthCode.count, fixedLengthCode.symbol, fixedLengthCode.table, LENROOTBITS, fixedLiterals.entries };
+static const struct huffman fixedDistcode =
+	{ fixedDistanceCode.count, fixedDistanceCode.symbol, fixedDistanceCode.table, DISTROOTBITS, NULL };
+
+template <class Sink, class Window>
+THuffman<Sink, Window>::THuffman(Window *pLZ, Sink *pSink)
 {
 	/* Do default initializations. */
-	bytesIn = byteLength = byteIndex = bitBuffer = bitCount = 0;
-	dataIn = NULL;
+	error = 0;
+	decodeMode = MULTILITERALDECODE;
+	format = FORMATRAW;
+	state = STATEDONE;
+	last = storedLeft = inputFinal = 0;
+	stopBit = -1;
+	blockCallback = NULL;
+	blockContext = NULL;
+	blockLencode = blockDistcode = NULL;
+	blockCode = NULL;
+	blockOutput = 0;
+	streamBuffer = NULL;
+	streamCapacity = 0;
+
+	/* The code cache starts out empty. */
+	dynCodes = new struct DynamicCode[DYNCACHESIZE];
+	for (int index = 0; index < DYNCACHESIZE; index++)
+	{
+		dynCodes[index].signature = 0;
+		dynCodes[index].nlen = dynCodes[index].ndist = 0;
+		dynCodes[index].used = 0;
+	}
+	dynUses = cacheHits = cacheMisses = 0;
 
 	this->pLZ = pLZ;
-	this->pCIO = pCIO;
+	this->pSink = pSink;
+
+	/* Back-references are resolved by pLZ, which writes to pSink. */
+	if (pLZ != NULL)
+	{
+		pLZ->setIO(pSink);
+	}
 }
 
-CHuffman::~CHuffman()
+template <class Sink, class Window>
+THuffman<Sink, Window>::~THuffman()
 {
+	delete [] dynCodes;
+	delete [] streamBuffer;
 }
 
 /*
-* Return need bits from the input stream.  This always leaves less than
-* eight bits in the buffer.  getBits() works properly for need == 0.
+* Return need bits from the input stream.  getBits() works properly for
+* need == 0.
 *
 * Format notes:
 *
 * - Bits are stored in bytes from the least significant bit to the most
 *   significant bit.  Therefore bits are dropped from the bottom of the bit
 *   buffer, using shift right, and new bytes are appended to the top of the
-*   bit buffer, using shift left.
+*   bit buffer, using shift left.  See CBitReader.
 */
-int CHuffman::getBits(int need)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::getBits(int need)
 {
-	/* Get anything in the bit buffer. */
-	int value = bitBuffer;
-
-	/* We may need more than we are asking for. */
-	if (bitCount < need)
-	{
-		/* This means we are out of data. */
-		if (byteIndex >= byteLength)
-		{
-			/* Return with -1 to signify that we are out of data. */
-			return -1;
-		}
-		/* Now combine the current data with the new byte of data. */
-		value |= (long)(dataIn[byteIndex++]) << bitCount;
-		/* Increment the bit count by 8. */
-		bitCount += 8;
-	}
-
-	/* Here we shift right to get right of the bits that are being retrieved. */
-	bitBuffer = (int)(value >> need);
-	/* Adjust the bit count by the need. */
-	bitCount -= need;
-
-	/* Return the needed bits and zero out the bits above them. */
-	return (int)( value & ( ( 1L << need ) - 1 ) );
+	return in.getBits(need);
 }
 
 /*
@@ -72,6 +108,278 @@ int CHuffman::getBits(int need)
 * no output written.  For this dest must be (unsigned char *)0.  In this case,
 * the input value of *destlen is ignored, and on return *destlen is set to the
 * size of the uncompressed output.
+*/
+template <class Sink, class Window>
+void THuffman<Sink, Window>::decompress(const unsigned char *compressedData, size_t dataSize)
+{
+	/* Initialize variables. */
+	error = 0;
+	state = STATEHEADER;
+	last = 0;
+	/* All of the input is here. */
+	inputFinal = 1;
+	/* Point the bit reader at the data. */
+	in.setInput(compressedData, dataSize);
+	/* Start with an empty history that is written to pSink. */
+	pLZ->setCheck(checkKind());
+	pLZ->reset();
+	pLZ->setHold(false);
+
+	/* Nothing is held, so only a full output buffer stops it early. */
+	if (inflate() == NEEDOUTPUT)
+	{
+		error = OUTPUTBUFFERFULL;
+	}
+
+	/* Write out whatever is still in the window. */
+	pLZ->flush();
+	if (pSink != NULL)
+	{
+		pSink->flush();
+	}
+}
+
+/*
+* Decode the blocks of a raw deflate stream in data from the one that starts
+* at startBit, up to the first block that starts at stopBit or later, or the
+* end of the last block if that comes first.  stoppedAt() tells where it
+* stopped.  The output goes to the window and its sink as for decompress().
+* Returns 0 or an error.
+*
+* Notes:
+*
+* - This is how the parallel decoder runs pieces of one stream.  The window
+*   decides what happens to distances that reach back before startBit; a
+*   CMarkerLZ turns them into markers to be filled in later.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::decodeRange(const unsigned char *data, size_t size, long long startBit, long long stopBit)
+{
+	error = 0;
+	state = STATEHEADER;
+	last = 0;
+	inputFinal = 1;
+	in.setInput(data, size);
+	in.seek(startBit);
+	pLZ->setCheck(CHECKNONE);
+	pLZ->reset();
+	pLZ->setHold(false);
+
+	this->stopBit = stopBit;
+	inflate();
+	this->stopBit = -1;
+
+	pLZ->flush();
+	return error;
+}
+
+/*
+* Return 0 if a dynamic block header that passes every check that dynamic()
+* makes starts at bit in data, or an error otherwise.  The parallel decoder
+* uses this to find where blocks may start in the middle of a stream.
+*
+* Notes:
+*
+* - The cheap tests come first, since nearly every position fails them: the
+*   block type, and the counts of lengths and codes, which only go up to 29
+*   for both the literal/length and the distance codes.  Only then is the
+*   header read and its codes built and checked.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::probe(const unsigned char *data, size_t size, long long bit)
+{
+	in.setInput(data, size);
+	in.seek(bit);
+
+	/* BFINAL, BTYPE, HLIT and HDIST. */
+	unsigned int header = in.peek(13);
+	if (((header >> 1) & 3) != DYNAMIC || ((header >> 3) & 0x1f) > 29 || ((header >> 8) & 0x1f) > 29)
+	{
+		return BADBLOCKTYPE;
+	}
+
+	error = 0;
+	state = STATEHEADER;
+	last = 0;
+	inputFinal = 1;
+	return block();
+}
+
+/*
+* Start decoding a stream that arrives in pieces through feed().  The output
+* is held in the window and taken with drain().
+*
+* Notes:
+*
+* - The decoder never waits inside a block for more input.  Instead each
+*   unit that has to be read as a whole -- a block header together with the
+*   stored length or the dynamic code description, or one literal or
+*   length/distance pair -- is backed out again if the input runs out in the
+*   middle of it, and the next call to drain() starts that unit over.  Bits
+*   that were already taken from the input stay in the bit reader.
+*
+* - Output stops when the window is full of bytes that have not been drained
+*   yet.  The window always has room for a whole match, so a match is never
+*   split across calls.
+*/
+template <class Sink, class Window>
+void THuffman<Sink, Window>::beginStream(void)
+{
+	error = 0;
+	state = STATEHEADER;
+	last = 0;
+	inputFinal = 0;
+	in.setInput(streamBuffer, 0);
+	pLZ->setCheck(checkKind());
+	pLZ->reset();
+	pLZ->setHold(true);
+}
+
+/*
+* Start decoding the raw deflate stream in data, which is all in memory,
+* from the block that starts at bit.  The output is taken with drain() as
+* for the other beginStream(), but the input is read where it is rather
+* than copied, and there is nothing to feed().  With a dictionary set on the
+* window this resumes decoding in the middle of a stream.
+*/
+template <class Sink, class Window>
+void THuffman<Sink, Window>::beginStream(const unsigned char *data, size_t size, long long bit)
+{
+	error = 0;
+	state = STATEHEADER;
+	last = 0;
+	inputFinal = 1;
+	in.setInput(data, size);
+	in.seek(bit);
+	pLZ->setCheck(CHECKNONE);
+	pLZ->reset();
+	pLZ->setHold(true);
+}
+
+/*
+* Add size bytes of compressed input.  The bytes are copied, so chunk can be
+* reused as soon as this returns.  Input that has not been decoded yet is
+* kept, so memory use stays at about one chunk as long as the output is
+* drained between calls.  Returns size.
+*
+* Notes:
+*
+* - The bytes that are in the bit buffer are kept along with the ones that
+*   were not loaded yet, since a stored block or the trailer gives them back
+*   to the input and reads them from there.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::feed(const unsigned char *chunk, int size)
+{
+	int left = (int)in.bytesAvailable() + in.bytesBuffered();
+	const unsigned char *unread = in.dataIn + in.byteIndex - in.bytesBuffered();
+
+	if (left + size > streamCapacity)
+	{
+		/* Grow the buffer, at least doubling it. */
+		int capacity = streamCapacity * 2;
+		if (capacity < left + size)
+		{
+			capacity = left + size;
+		}
+
+		unsigned char *buffer = new unsigned char [capacity];
+		if (left > 0)
+		{
+			memcpy(buffer, unread, left);
+		}
+		delete [] streamBuffer;
+		streamBuffer = buffer;
+		streamCapacity = capacity;
+	}
+	else if (left > 0)
+	{
+		/* Move the kept bytes to the front. */
+		memmove(streamBuffer, unread, left);
+	}
+
+	memcpy(&streamBuffer[left], chunk, size);
+	in.moreInput(streamBuffer, left + size);
+
+	return size;
+}
+
+/// <summary>
+/// Tells the decoder that feed() will not be called again, so running out of
+/// input now means the stream is truncated.
+/// </summary>
+template <class Sink, class Window>
+void THuffman<Sink, Window>::endInput(void)
+{
+	inputFinal = 1;
+}
+
+/*
+* Decode as much as is needed to fill out with up to size bytes, or until the
+* input that has been fed runs out.  Returns the number of bytes written to
+* out.  A return of less than size means more input is needed, the stream is
+* finished (see finished()), or an error was found (see error).
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::drain(unsigned char *out, int size)
+{
+	int total = pLZ->drain(out, size);
+
+	while (total < size && state != STATEDONE && error == 0)
+	{
+		int ret = inflate();
+
+		total += pLZ->drain(&out[total], size - total);
+		if (ret == NEEDINPUT)
+		{
+			break;
+		}
+	}
+
+	return total;
+}
+
+/*
+* Decode the next piece of output and point *span at it, in the window,
+* instead of copying it out as drain() does.  Returns the number of bytes in
+* the span, which stays valid until the next call to next(), drain() or
+* feed().  A return of 0 means more input is needed, the stream is finished
+* (see finished()), or an error was found (see error).
+*
+* Notes:
+*
+* - A span is at most two windows and a match long, and usually about one
+*   window: decoding stops once the window holds more output that has not
+*   been given out than it can slide, as it does for drain(), so memory
+*   stays bounded however slowly the spans are used.
+*
+* - The bytes of a span stay in the window as history after it is given
+*   out, which is what makes it safe to read until the decoder next writes.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::next(const unsigned char **span)
+{
+	int count = pLZ->take(span);
+
+	while (count == 0 && state != STATEDONE && error == 0)
+	{
+		int ret = inflate();
+
+		count = pLZ->take(span);
+		if (ret == NEEDINPUT)
+		{
+			break;
+		}
+	}
+
+	return count;
+}
+
+/*
+* Decode blocks until the end of the stream, an error, or a point where more
+* input or more output room is needed.  Returns 0 at the end of the stream,
+* NEEDINPUT or NEEDOUTPUT when it stopped early, or the error, which is also
+* left in error.
 *
 * Format notes:
 *
@@ -83,41 +391,217 @@ int CHuffman::getBits(int need)
 *   block (if it was a fixed or dynamic block) are undefined and have no
 *   expected values to check.
 */
-void CHuffman::decompress(unsigned char *compressedData, int dataSize)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::inflate(void)
 {
-	/* Initialize variables. */
-	bytesIn = byteIndex = bitBuffer = bitCount = error = 0;
-	/* Store the data size. */
-	byteLength = dataSize;
-	/* This points to the data. */
-	dataIn = compressedData;
-
-	int last, type;
+	int ret = 0;
 
-	do
+	while (ret == 0 && error == 0 && state != STATEDONE)
 	{
-		/* This indicates whether this is the last block. */
-		last = getBits(1);
-		/* Get the block type. */
-		type = getBits(2);
-
-		switch (type)
+#ifdef DECODESTATS
+		long long started = CDecodeStats::now();
+#endif
+		switch (state)
 		{
-			case STORED:
-				stored();
+			case STATESTORED:
+				ret = storedData();
+#ifdef DECODESTATS
+				endBlockStats(started);
+#endif
 				break;
-			case FIXED:
-				fixed();
+			case STATECODES:
+				ret = codes(blockLencode, blockDistcode);
+#ifdef DECODESTATS
+				endBlockStats(started);
+#endif
 				break;
-			case DYNAMIC:
-				dynamic();
+			case STATETRAILER:
+				ret = trailer();
 				break;
 			default:
+				if (last)
+				{
+					state = format != FORMATRAW ? STATETRAILER : STATEDONE;
+				}
+				else if (stopBit >= 0 && in.bitPosition() >= stopBit)
+				{
+					state = STATEDONE;
+				}
+				else
+				{
+					if (blockCallback != NULL)
+					{
+						const unsigned char *history;
+						int historyLength = pLZ->history(&history);
+						blockCallback(blockContext, in.bitPosition(), pLZ->getLength(), history, historyLength);
+					}
+					ret = block();
+#ifdef DECODESTATS
+					if (ret == 0)
+					{
+						int type = state == STATESTORED ? STORED : blockLencode == &fixedLencode ? FIXED : DYNAMIC;
+						stats.beginBlock(type, last, blockStart.bitPosition(), pLZ->getLength(), CDecodeStats::now() - started);
+					}
+#endif
+				}
 				break;
 		}
-	} 
-	while (last == 0);
+	}
 
+	if (ret != NEEDINPUT && ret != NEEDOUTPUT)
+	{
+		error = ret;
+	}
+
+	return ret;
+}
+
+#ifdef DECODESTATS
+/*
+* Add the time since started to the current block, and close its record if
+* the block has ended.
+*/
+template <class Sink, class Window>
+void THuffman<Sink, Window>::endBlockStats(long long started)
+{
+	stats.addDecodeTime(CDecodeStats::now() - started);
+	if (state != STATESTORED && state != STATECODES)
+	{
+		stats.endBlock(in.bitPosition(), pLZ->getLength());
+	}
+}
+#endif
+
+/*
+* Read a block header and whatever has to follow it before the contents of
+* the block can be decoded.  Returns 0, NEEDINPUT or an error.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::block(void)
+{
+	/* Remember where the block starts, in case its header is not all here yet. */
+	blockStart = in;
+
+	/* Make sure the three header bits are in the buffer. */
+	in.refill();
+
+	/* This indicates whether this is the last block. */
+	last = in.getBits(1);
+	/* Get the block type. */
+	int type = in.getBits(2);
+
+	if (in.exhausted())
+	{
+		return blockIncomplete();
+	}
+
+	switch (type)
+	{
+		case STORED:
+			return stored();
+		case FIXED:
+			fixed();
+			return 0;
+		case DYNAMIC:
+			return dynamic();
+		default:
+			return BADBLOCKTYPE;
+	}
+}
+
+/*
+* Check the gzip or zlib trailer against the output.  Returns 0, NEEDINPUT,
+* CRCMISMATCH, LENGTHMISMATCH or ADLERMISMATCH.
+*
+* Format notes:
+*
+* - The trailer starts at the first byte boundary after the last block.
+*
+* - The gzip trailer is the CRC-32 of the uncompressed data followed by its
+*   length modulo 2^32 (ISIZE), both four bytes, least significant byte
+*   first.
+*
+* - The zlib trailer is the Adler-32 of the uncompressed data, four bytes,
+*   most significant byte first.  A preset dictionary is not part of it.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::trailer(void)
+{
+	CBitReader start = in;
+	int size = format == FORMATZLIB ? 4 : 8;
+
+	if (in.alignToByte() < 0 || in.bytesAvailable() < (size_t)size)
+	{
+		return needInput(&start);
+	}
+
+	const unsigned char *data = in.current();
+	in.skip(size);
+
+	if (format == FORMATZLIB)
+	{
+		unsigned int adler = ((unsigned int)data[0] << 24) | ((unsigned int)data[1] << 16) | (data[2] << 8) | data[3];
+		if (adler != pLZ->getCheck())
+		{
+			return ADLERMISMATCH;
+		}
+
+		state = STATEDONE;
+		return 0;
+	}
+
+	unsigned int crc = getTwoByteValue(data) | (getTwoByteValue(&data[2]) << 16);
+	unsigned int length = getTwoByteValue(&data[4]) | (getTwoByteValue(&data[6]) << 16);
+
+	if (crc != pLZ->getCheck())
+	{
+		return CRCMISMATCH;
+	}
+
+	if (length != (unsigned int)pLZ->getLength())
+	{
+		return LENGTHMISMATCH;
+	}
+
+	state = STATEDONE;
+	return 0;
+}
+
+/// <summary>
+/// The check value the window keeps for the trailer of the format.
+/// </summary>
+template <class Sink, class Window>
+int THuffman<Sink, Window>::checkKind(void) const
+{
+	return format == FORMATGZIP ? CHECKCRC32 : format == FORMATZLIB ? CHECKADLER32 : CHECKNONE;
+}
+
+/*
+* The input ran out.  If more can come, put the bit reader back to restart
+* and return NEEDINPUT, otherwise the stream is truncated.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::needInput(const CBitReader *restart)
+{
+	if (inputFinal)
+	{
+		return DATAEND;
+	}
+
+	in = *restart;
+	return NEEDINPUT;
+}
+
+/*
+* The input ran out inside a block header.  The whole header is read again
+* once there is more.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::blockIncomplete(void)
+{
+	last = 0;
+	state = STATEHEADER;
+	return needInput(&blockStart);
 }
 
 /// <summary>
@@ -125,7 +609,8 @@ void CHuffman::decompress(unsigned char *compressedData, int dataSize)
 /// </summary>
 /// <param name="data">Address of the data.</param>
 /// <returns>The 16-bit unsigned value.</returns>
-unsigned int CHuffman::getTwoByteValue(unsigned char *data)
+template <class Sink, class Window>
+unsigned int THuffman<Sink, Window>::getTwoByteValue(const unsigned char *data)
 {
 	unsigned int value;
 
@@ -152,50 +637,89 @@ unsigned int CHuffman::getTwoByteValue(unsigned char *data)
 * - A stored block can have zero length.  This is sometimes used to byte-align
 *   subsets of the compressed data for random access or partial recovery.
 */
-void CHuffman::stored(void)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::stored(void)
 {
-
 	/* When the data is stored and were are going to simply
-	   copy, we discard any leftover bits. */
-	bitCount = bitBuffer = 0;
-
-	/* We are out of data. */
-	if (byteIndex + 4 > byteLength)
+	   copy, we discard any leftover bits. Whole bytes that
+	   were read ahead are given back to the input. */
+	if (in.alignToByte() < 0 || in.bytesAvailable() < 4)
 	{
-		error = DATAEND;
-		return;
+		/* We are out of data. */
+		return blockIncomplete();
 	}
 
 	/* Get the length from the first two bytes. Convert from Big-Endian to Little-Endian. */
-	unsigned int len = getTwoByteValue(&dataIn[byteIndex]);
+	const unsigned char *data = in.current();
+	unsigned int len = getTwoByteValue(data);
 	/* Get the complement. */
-	unsigned int complement = getTwoByteValue(&dataIn[byteIndex+2]);
+	unsigned int complement = getTwoByteValue(data + 2);
 	/* Compare */
-	if (~complement != len)
+	if ((~complement & 0xffff) != len)
 	{
-		error = COMPLEMENTNOMATCH;
-		return;
+		return COMPLEMENTNOMATCH;
 	}
 	/* Skip past these four bytes which contain the block length and its complement. */
-	byteIndex += 4;
+	in.skip(4);
+
+	/* The bytes are copied by storedData(), which inflate() calls next. */
+	storedLeft = len;
+	state = STATESTORED;
 
-	/* Check to make sure we have enough data remaining. */
-	if (byteIndex + len > len)
+	return 0;
+}
+
+/*
+* Copy the bytes of a stored block, as many as the input and the window
+* allow.  Returns 0 at the end of the block, NEEDINPUT, NEEDOUTPUT or
+* DATAEND.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::storedData(void)
+{
+	while (storedLeft > 0)
 	{
-		error = DATAEND;
-		return;
-	}
+		int count = storedLeft;
 
-	/* ToDo */
-	/* Here we store the bytes to the destination. This is not implemented at this moment (1-30-2022). */
+		/* Check to make sure we have enough data remaining. */
+		if ((size_t)count > in.bytesAvailable())
+		{
+			count = (int)in.bytesAvailable();
+			if (count == 0)
+			{
+				return needInput(&in);
+			}
+		}
 
-	// 6-11-2022
-	pCIO->output(&dataIn[byteIndex], len);
-	byteIndex += len;
+		/* Copy the bytes into the window so later blocks can refer back to them. */
+		count = pLZ->store(in.current(), count);
+		if (count == 0)
+		{
+			return NEEDOUTPUT;
+		}
 
-	/* Adjust the values. */
-	byteIndex += len;
+		/* Adjust the values. */
+		in.skip(count);
+		storedLeft -= count;
+	}
 
+	state = STATEHEADER;
+	return 0;
+}
+
+/*
+* Decode a code from the stream using huffman table h, with the lookup table
+* when there is one and the mode allows it.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::decode(const struct huffman* h)
+{
+	if (decodeMode != CANONICALDECODE && h->table != NULL)
+	{
+		return decodeTable(h);
+	}
+
+	return decodeCanonical(h);
 }
 
 /*
@@ -221,7 +745,8 @@ void CHuffman::stored(void)
 * - Incomplete codes are handled by this decoder, since they are permitted
 *   in the deflate format.  See the format notes for fixed() and dynamic().
 */
-int CHuffman::decode(const struct huffman* h)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::decodeCanonical(const struct huffman* h)
 {
 	int len;            /* current number of bits in code */
 	int code;           /* len bits being decoded */
@@ -232,7 +757,7 @@ int CHuffman::decode(const struct huffman* h)
 	code = first = index = 0;
 	for (len = 1; len <= MAXBITS; len++)
 	{
-		code |= getBits(1);             /* get next bit */
+		code |= in.getBits(1);          /* get next bit */
 		count = h->count[len];
 
 		if (code - count < first)       /* if length len, return symbol */
@@ -248,6 +773,45 @@ int CHuffman::decode(const struct huffman* h)
 	return RANOUTOFCODES;                         /* ran out of codes */
 }
 
+/*
+* Decode a code from the stream using the lookup table built by buildTable().
+* Returns the same values as decodeCanonical().
+*
+* Format notes:
+*
+* - Since the first bit of a code is the first bit in the stream, which is
+*   the lowest bit of the bit buffer, the table is indexed by the codes in
+*   reversed bit order.  This is why no reversal is needed here.
+*
+* - The caller must have refilled the bit reader so that at least MAXBITS
+*   bits are available.  Running past the end of the input is detected by the
+*   caller through in.exhausted().
+*
+* - A code no longer than rootBits is resolved by a single lookup; its entry
+*   is repeated for every value of the bits that follow it.  A longer code
+*   first hits a link entry for its first rootBits bits, and the next bits
+*   then index the subtable that entry points to.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::decodeTable(const struct huffman* h)
+{
+	unsigned int bits = in.peek(MAXBITS);
+	const struct decodeEntry *entry = &h->table[bits & ((1 << h->rootBits) - 1)];
+
+	if (entry->op == TABLELINK)
+	{
+		entry = &h->table[entry->value + ((bits >> h->rootBits) & ((1 << entry->bits) - 1))];
+	}
+
+	if (entry->op != TABLESYMBOL)
+	{
+		return RANOUTOFCODES;           /* not a code of an incomplete set */
+	}
+
+	in.consume(entry->bits);
+	return entry->value;
+}
+
 /*
 * Process a fixed codes block.
 *
@@ -258,7 +822,8 @@ int CHuffman::decode(const struct huffman* h)
 *   benefit of custom codes for that block.  For fixed codes, no bits are
 *   spent on code descriptions.  Instead the code lengths for literal/length
 *   codes and distance codes are fixed.  The specific lengths for each symbol
-*   can be seen in the "for" loops below.
+*   are in fixedCodeLength() in FixedTables.h, where the compiler builds the
+*   tables from them, so all there is to do here is to point at those.
 *
 * - The literal/length code is complete, but has two symbols that are invalid
 *   and should result in an error if received.  This cannot be implemented
@@ -272,58 +837,14 @@ int CHuffman::decode(const struct huffman* h)
 *   length, this can be implemented as an incomplete code.  Then the invalid
 *   codes are detected while decoding.
 */
-void CHuffman::fixed(void)
+template <class Sink, class Window>
+void THuffman<Sink, Window>::fixed(void)
 {
-	static int virgin = 1;
-	static short lencnt[MAXBITS + 1], lensym[FIXLCODES];
-	static short distcnt[MAXBITS + 1], distsym[MAXDCODES];
-	static struct huffman lencode, distcode;
-
-	/* build fixed huffman tables if first call (may not be thread safe) */
-	if (virgin)
-	{
-		int symbol;
-		short lengths[FIXLCODES];
-
-		/* construct lencode and distcode */
-		lencode.count = lencnt;
-		lencode.symbol = lensym;
-		distcode.count = distcnt;
-		distcode.symbol = distsym;
-
-		/* literal/length table */
-		for (symbol = 0; symbol < 144; symbol++)
-		{
-			lengths[symbol] = 8;
-		}
-		for (; symbol < 256; symbol++)
-		{
-			lengths[symbol] = 9;
-		}
-		for (; symbol < 280; symbol++)
-		{
-			lengths[symbol] = 7;
-		}
-		for (; symbol < FIXLCODES; symbol++)
-		{
-			lengths[symbol] = 8;
-		}
-		construct(&lencode, lengths, FIXLCODES);
-
-		/* distance table */
-		for (symbol = 0; symbol < MAXDCODES; symbol++)
-		{
-			lengths[symbol] = 5;
-		}
-		construct(&distcode, lengths, MAXDCODES);
-
-		/* do this just once */
-		virgin = 0;
-	}
-
 	/* decode data until end-of-block code */
-//	return codes(s, &lencode, &distcode);
-	codes(&lencode, &distcode);
+	blockLencode = &fixedLencode;
+	blockDistcode = &fixedDistcode;
+	blockCode = NULL;
+	state = STATECODES;
 }
 
 /*
@@ -412,47 +933,53 @@ void CHuffman::fixed(void)
 *
 * - For reference, a "typical" size for the code description in a dynamic
 *   block is around 80 bytes.
+*
+* - Encoders often send the same code lengths for block after block.  The
+*   description still has to be read to find where the block's data starts,
+*   but the tables built from the lengths are kept for the last DYNCACHESIZE
+*   codes, and a block whose lengths match one of them reuses its tables.
 */
-int CHuffman::dynamic(void)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::dynamic(void)
 {
 	int err;
 	short lengths[MAXCODES];            /* descriptor code lengths */
-	short lencnt[MAXBITS + 1], lensym[MAXLCODES];         /* lencode memory */
-	short distcnt[MAXBITS + 1], distsym[MAXDCODES];       /* distcode memory */
-	struct huffman lencode, distcode;   /* length and distance codes */
 
 	/* permutation of code length codes */
-	static short order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
-
-	/* construct lencode and distcode */
-	lencode.count = lencnt;
-	lencode.symbol = lensym;
-	distcode.count = distcnt;
-	distcode.symbol = distsym;
-
-	int nlen = getBits(5) + 257;
-	int ndist = getBits(5) + 1;
-	int ncode = getBits(4) + 4;
+	static const short order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-	if (nlen > MAXLCODES || ndist > MAXDCODES)
-	{
-		error = BADCOUNTS;
-		return error;
-	}
+	/* The three counts take 14 bits. */
+	in.refill();
+	int nlen = in.getBits(5) + 257;
+	int ndist = in.getBits(5) + 1;
+	int ncode = in.getBits(4) + 4;
 
 	/* Read code length code lengths (really), missing lengths are zero. */
 	int index;
 	for (index = 0; index < ncode; index++)
 	{
-		lengths[order[index]] = getBits(3);
+		lengths[order[index]] = in.getBits(3);
 	}
-	for (; index < (sizeof(order)/sizeof(short)); index++)
+	for (; index < (int)(sizeof(order)/sizeof(short)); index++)
 	{
 		lengths[order[index]] = 0;
 	}
 
-	/* build huffman table for code lengths codes (use lencode temporarily) */
-	err = construct(&lencode, lengths, 19);
+	/* Here and below, running out of input is checked before anything
+	   that was read is judged, since it may just be the zero padding. */
+	if (in.exhausted())
+	{
+		return blockIncomplete();
+	}
+
+	if (nlen > MAXLCODES || ndist > MAXDCODES)
+	{
+		error = BADCOUNTS;
+		return error;
+	}
+
+	/* build huffman table for code lengths codes */
+	err = construct(&codeLencode, codeLencnt, codeLensym, lengths, 19);
 
 	/* require complete code set here */
 	if (err != 0)
@@ -460,6 +987,8 @@ int CHuffman::dynamic(void)
 		error = INCOMPLETECODESET;
 		return error;
 	}
+	buildTable(&codeLencode, codeLentab, CODEROOTBITS, ENOUGHCODES);
+	codeLencode.literals = NULL;
 
 	/* read length/literal and distance code length tables */
 	index = 0;
@@ -467,8 +996,30 @@ int CHuffman::dynamic(void)
 	{
 		int symbol;             /* decoded value */
 		int len;                /* last length to repeat */
+		int repeat = 0;         /* times to repeat */
+
+		/* One refill covers a seven bit code and up to seven extra bits. */
+		in.refill();
+
+		symbol = decode(&codeLencode);
+		if (symbol == 16)              /* repeat last length 3..6 times */
+		{
+			repeat = 3 + in.getBits(2);
+		}
+		else if (symbol == 17)          /* repeat zero 3..10 times */
+		{
+			repeat = 3 + in.getBits(3);
+		}
+		else if (symbol == 18)          /* repeat zero 11..138 times */
+		{
+			repeat = 11 + in.getBits(7);
+		}
+
+		if (in.exhausted())
+		{
+			return blockIncomplete();
+		}
 
-		symbol = decode(&lencode);
 		if (symbol < 0)
 		{
 			error = symbol;
@@ -482,7 +1033,7 @@ int CHuffman::dynamic(void)
 		else                           /* repeat instruction */
 		{
 			len = 0;                    /* assume repeating zeros */
-			if (symbol == 16)          /* repeat last length 3..6 times */
+			if (symbol == 16)
 			{
 				if (index == 0)
 				{
@@ -490,16 +1041,8 @@ int CHuffman::dynamic(void)
 					return error;
 				}
 				len = lengths[index - 1];       /* last length */
-				symbol = 3 + getBits(2);
-			}
-			else if (symbol == 17)      /* repeat zero 3..10 times */
-			{
-				symbol = 3 + getBits(3);
-			}
-			else                        /* == 18, repeat zero 11..138 times */
-			{
-				symbol = 11 + getBits(7);
 			}
+			symbol = repeat;
 
 			if (index + symbol > nlen + ndist)
 			{
@@ -521,31 +1064,136 @@ int CHuffman::dynamic(void)
 		return error;
 	}
 
+	/* use the tables of a recent block with the same code lengths */
+	unsigned long long key = signature(lengths, nlen, ndist);
+	struct DynamicCode *entry = &dynCodes[0];
+	dynUses++;
+	for (index = 0; index < DYNCACHESIZE; index++)
+	{
+		struct DynamicCode *cached = &dynCodes[index];
+		if (cached->signature == key && cached->nlen == nlen && cached->ndist == ndist &&
+			memcmp(cached->lengths, lengths, (nlen + ndist) * sizeof(short)) == 0)
+		{
+			cacheHits++;
+			cached->used = dynUses;
+			blockLencode = &cached->lencode;
+			blockDistcode = &cached->distcode;
+			blockCode = cached;
+			blockOutput = pLZ->getLength();
+			state = STATECODES;
+			return 0;
+		}
+		if (cached->used < entry->used)
+		{
+			entry = cached;
+		}
+	}
+
+	/* otherwise build them in place of the least recently used ones */
+	cacheMisses++;
+	entry->nlen = entry->ndist = 0;
+	entry->used = 0;
+	struct huffman &lencode = entry->lencode;
+	struct huffman &distcode = entry->distcode;
+
 	/* build huffman table for literal/length codes */
-	err = construct(&lencode, lengths, nlen);
+	err = construct(&lencode, entry->lencnt, entry->lensym, lengths, nlen);
 
 	if (err && (err < 0 || nlen != lencode.count[0] + lencode.count[1]))
 	{
 		error = INCOMPLETECODESINGLE;
 		return error;
 	}
+	buildTable(&lencode, entry->lentab, LENROOTBITS, ENOUGHLENS);
+	lencode.literals = NULL;                /* see blockLiterals() */
+	entry->literalPairs = literalPairs(lengths);
 
 	/* build huffman table for distance codes */
-	err = construct(&distcode, lengths + nlen, ndist);
+	err = construct(&distcode, entry->distcnt, entry->distsym, lengths + nlen, ndist);
 
 	if (err && (err < 0 || ndist != distcode.count[0] + distcode.count[1]))
 	{
 		error = INCOMPLETECODESINGLE2;
 		return error;
 	}
+	buildTable(&distcode, entry->disttab, DISTROOTBITS, ENOUGHDISTS);
+	distcode.literals = NULL;
+
+	/* only a complete entry can be found again */
+	memcpy(entry->lengths, lengths, (nlen + ndist) * sizeof(short));
+	entry->signature = key;
+	entry->nlen = nlen;
+	entry->ndist = ndist;
+	entry->used = dynUses;
 
 	/* decode data until end-of-block code */
-	return codes(&lencode, &distcode);
+	blockLencode = &lencode;
+	blockDistcode = &distcode;
+	blockCode = entry;
+	blockOutput = pLZ->getLength();
+	state = STATECODES;
+	return 0;
+}
+
+/*
+* Hash the code lengths of a dynamic block, and their two counts, into the
+* signature its tables are cached under.  This is FNV-1a over the lengths,
+* which are small enough to go in a byte at a time.
+*/
+template <class Sink, class Window>
+unsigned long long THuffman<Sink, Window>::signature(const short *lengths, int nlen, int ndist)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+
+	hash = (hash ^ (unsigned long long)nlen) * 0x100000001b3ULL;
+	hash = (hash ^ (unsigned long long)ndist) * 0x100000001b3ULL;
+	for (int index = 0; index < nlen + ndist; index++)
+	{
+		hash = (hash ^ (unsigned long long)lengths[index]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/*
+* Whether the literal code in lengths[0..255] decodes two literals in one
+* lookup of the multiple literal table often enough to use it.
+*
+* Notes:
+*
+* - A code of len bits is taken to come up 2^-len of the time, so two
+*   literals of lengths a and b follow each other 2^-(a + b) of the time.
+*   Adding that up over the pairs that fit in LITBITS, in units of
+*   2^-LITBITS, gives how often a lookup decodes at least two literals.
+*/
+template <class Sink, class Window>
+bool THuffman<Sink, Window>::literalPairs(const short *lengths)
+{
+	int count[LITBITS + 1] = { 0 };
+	long long pairs = 0;
+
+	for (int symbol = 0; symbol < 256; symbol++)
+	{
+		if (lengths[symbol] > 0 && lengths[symbol] < LITBITS)
+		{
+			count[lengths[symbol]]++;
+		}
+	}
+	for (int first = 1; first < LITBITS; first++)
+	{
+		for (int second = 1; first + second <= LITBITS; second++)
+		{
+			pairs += (long long)count[first] * count[second] << (LITBITS - first - second);
+		}
+	}
 
+	return pairs * LITERALPAIRS >= (1 << LITBITS);
 }
 
 /*
 * Decode literal/length and distance codes until an end-of-block code.
+* Returns 0 at the end of the block, NEEDINPUT or NEEDOUTPUT if it has to
+* stop before that, or a negative value for invalid data.
 *
 * Format notes:
 *
@@ -565,8 +1213,8 @@ int CHuffman::dynamic(void)
 *   by just a length symbol.  Lengths 11..257 are represented as a symbol and
 *   some number of extra bits that are added as an integer to the base length
 *   of the length symbol.  The number of extra bits is determined by the base
-*   length symbol.  These are in the static arrays below, lens[] for the base
-*   lengths and lext[] for the corresponding number of extra bits.
+*   length symbol.  These are in the arrays lengthBase[] for the base lengths
+*   and lengthExtra[] for the corresponding number of extra bits.
 *
 * - The reason that 258 gets its own symbol is that the longest length is used
 *   often in highly redundant files.  Note that 258 can also be coded as the
@@ -578,8 +1226,8 @@ int CHuffman::dynamic(void)
 *   there are many more possible distances (1..32768), so extra bits are added
 *   to a base value represented by the symbol.  The distances 1..4 get their
 *   own symbol, but the rest require extra bits.  The base distances and
-*   corresponding number of extra bits are below in the static arrays dist[]
-*   and dext[].
+*   corresponding number of extra bits are in the arrays distanceBase[] and
+*   distanceExtra[].
 *
 * - Literal bytes are simply written to the output.  A length/distance pair is
 *   an instruction to copy previously uncompressed bytes to the output.  The
@@ -599,33 +1247,143 @@ int CHuffman::dynamic(void)
 *   since though their behavior -is- defined for overlapping arrays, it is
 *   defined to do the wrong thing in this case.
 */
-int CHuffman::codes(const struct huffman* lencode, const struct huffman* distcode)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::codes(const struct huffman* lencode, const struct huffman* distcode)
 {
 	int symbol;         /* decoded symbol */
-	int len;            /* length for copy */
-	unsigned dist;      /* distance for copy */
-
-	static const short lens[29] = { /* Size base for length codes 257..285 */
-		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
-	static const short lext[29] = { /* Extra bits for length codes 257..285 */
-		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
-	static const short dists[30] = { /* Offset base for distance codes 0..29 */
-		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-		8193, 12289, 16385, 24577 };
-	static const short dext[30] = { /* Extra bits for distance codes 0..29 */
-		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-		7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-		12, 12, 13, 13 };
+	int len = 0;        /* length for copy */
+	int dsymbol = 0;    /* decoded distance symbol */
+	unsigned dist = 0;  /* distance for copy */
+	CBitReader saved;   /* reader state before the symbol */
+
+	/* Only use the multiple literal table in that mode, and only once the
+	   block has shown it is long enough to need it. */
+	blockLiterals();
+	const struct literalEntry *literals = decodeMode == MULTILITERALDECODE ? lencode->literals : NULL;
+	/* The fast loop needs lookup tables and a window of bytes. */
+	int fast = Window::DIRECTWRITE && decodeMode != CANONICALDECODE && lencode->table != NULL && distcode->table != NULL;
+#ifdef DECODESTATS
+	struct BlockStats *blockStats = stats.current();
+#endif
 
 	/* decode literals and length/distance pairs */
-	do 
+	for (;;)
 	{
+		/* Every symbol needs room for a whole match. */
+		if (pLZ->space() <= 0 && pLZ->slide() < 0)
+		{
+			return NEEDOUTPUT;          /* window full of undrained output */
+		}
+
+		/* Away from the end of the input, the fast loop decodes until it
+		   gets near that or the end of the window, and the checked loop
+		   below only does the rest. */
+		if (fast && in.bytesAvailable() >= FASTINPUT)
+		{
+			int ret = codesFast(lencode, distcode);
+			if (ret == 0)
+			{
+				break;                  /* end of block symbol */
+			}
+			if (ret != LEAVEFAST)
+			{
+				return ret;
+			}
+			if (literals == NULL && decodeMode == MULTILITERALDECODE)
+			{
+				blockLiterals();
+				literals = lencode->literals;
+			}
+			continue;
+		}
+
+		/* A single refill leaves at least 56 bits, which is enough for the
+		   longest literal/length code, its extra bits, the longest distance
+		   code and its extra bits (15 + 5 + 15 + 13 = 48), so nothing below
+		   needs to check the bit count again. */
+		in.refill();
+
+		/* The input can only run out in the middle of this symbol if the
+		   refill had to go byte by byte, and only then is it worth keeping
+		   a copy of the reader to back out to. */
+		int tail = in.bytesAvailable() < 8;
+		if (tail)
+		{
+			saved = in;
+		}
+
+		if (literals != NULL)
+		{
+			/* One lookup for up to three literals. */
+			const struct literalEntry *entry = &literals[in.peek(LITBITS)];
+			if (entry->count != 0 && tail)
+			{
+				in.consume(entry->bits);
+				if (in.exhausted())
+				{
+					return needInput(&saved);
+				}
+
+				pLZ->lits(entry->lit, entry->count);
+#ifdef DECODESTATS
+				blockStats->literals += entry->count;
+#endif
+				continue;
+			}
+
+			if (entry->count != 0)
+			{
+				/* Away from the end of the input, keep going for as long
+				   as the refill covers a whole lookup.  The bits are
+				   worked on in locals because the compiler has to assume
+				   that the byte stores into the window could change the
+				   reader, and would reload it after every one of them.
+				   The refill leaves at most 63 bits and a lookup can take
+				   as little as one, so this can run 63 times, but no
+				   lookup writes more bytes than the bits it uses: at most
+				   63 bytes, plus the 3 that lits() stores past them.  The
+				   MAXMATCH + COPYSLACK (274) bytes of slack after the
+				   window cover that, and have to go on covering it if
+				   either shrinks or the loop is made to take more bits. */
+				unsigned long long bits = in.bitBuffer;
+				int left = in.bitCount;
+				do
+				{
+					bits >>= entry->bits;
+					left -= entry->bits;
+					pLZ->lits(entry->lit, entry->count);
+#ifdef DECODESTATS
+					blockStats->literals += entry->count;
+#endif
+					entry = &literals[bits & ((1 << LITBITS) - 1)];
+				} while (entry->count != 0 && left >= LITBITS);
+
+				in.bitBuffer = bits;
+				in.bitCount = left;
+				continue;
+			}
+		}
+
 		symbol = decode(lencode);
+		if (symbol > 256 && symbol < 257 + 29)
+		{	/* length */
+			/* get and compute length */
+			len = lengthBase[symbol - 257] + in.peek(lengthExtra[symbol - 257]);
+			in.consume(lengthExtra[symbol - 257]);
+
+			/* get distance */
+			dsymbol = decode(distcode);
+			if (dsymbol >= 0)
+			{
+				dist = distanceBase[dsymbol] + in.peek(distanceExtra[dsymbol]);
+				in.consume(distanceExtra[dsymbol]);
+			}
+		}
 
-		unsigned short tmp = (unsigned short)symbol;
+		if (tail && in.exhausted())
+		{
+			return needInput(&saved);   /* ran out of input */
+		}
 
 		if (symbol < 0)
 		{
@@ -635,55 +1393,215 @@ int CHuffman::codes(const struct huffman* lencode, const struct huffman* distcod
 		if (symbol < 256) 
 		{	/* literal: symbol is the byte */
 			/* write out the literal */
-
-			// TODO: Output literal to LZ class.
 			pLZ->lit(symbol);
+#ifdef DECODESTATS
+			blockStats->literals++;
+#endif
 		}
 		else if (symbol > 256)
 		{	/* length */
-			/* get and compute length */
-			symbol -= 257;
-			if (symbol >= 29)
+			if (symbol >= 257 + 29)
 			{
 				return INVALIDFIXEDCODE;             /* invalid fixed code */
 			}
 
-			len = lens[symbol] + getBits(lext[symbol]);
-
-			/* get and check distance */
-			symbol = decode(distcode);
-
-			if (symbol < 0)
+			if (dsymbol < 0)
 			{
-				return symbol;          /* invalid symbol */
+				return dsymbol;         /* invalid symbol */
 			}
 
-			dist = dists[symbol] + getBits(dext[symbol]);
-
 			/* copy length bytes from distance bytes back */
-
-			// TODO: Output len bytes to destination
-
-			while (len--)
+			if (pLZ->copy(len, dist) < 0)
 			{
+				return DISTANCETOOFAR;  /* distance too far back */
 			}
+#ifdef DECODESTATS
+			blockStats->matches++;
+			blockStats->lengthSymbols[symbol - 257]++;
+			blockStats->distanceSymbols[dsymbol]++;
+#endif
 		}
 		else
 		{
-//			s->outcnt += len;
+			break;                      /* end of block symbol */
 		}
-	} 
-	while (symbol != 256);            /* end of block symbol */
+	}
 
 	/* done with a valid fixed or dynamic block */
+	state = STATEHEADER;
 	return 0;
 }
 
+/*
+* The inner loop of codes() for the part of a block that is not near the end
+* of the input or of the window.  Returns 0 at the end of the block, LEAVEFAST
+* when it gets near either end, or a negative value for invalid data.
+*
+* Notes:
+*
+* - The loop only goes round while at least FASTINPUT bytes of input have not
+*   been loaded, so every refill is a single eight-byte load and every bit it
+*   takes is real input.  A refill leaves at least 56 bits, which covers any
+*   symbol with all of its extra bits, so nothing is checked per code.
+*
+* - The output goes straight into the window through a local pointer, which
+*   is only checked against the end of the window once per symbol: there
+*   is room past that for a whole match, its over-wide stores and a run of
+*   multiple literal stores.  Distances are still checked, since they come
+*   from the data.
+*
+* - The bit buffer and both pointers are kept in locals and only written
+*   back at the end, so the byte stores into the window, which could alias
+*   anything, do not force them to be reloaded after every store.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::codesFast(const struct huffman* lencode, const struct huffman* distcode)
+{
+	const struct literalEntry *literals = decodeMode == MULTILITERALDECODE ? lencode->literals : NULL;
+	const struct decodeEntry *lentab = lencode->table;
+	const struct decodeEntry *disttab = distcode->table;
+	const unsigned int lenmask = (1U << lencode->rootBits) - 1;
+	const unsigned int distmask = (1U << distcode->rootBits) - 1;
+#ifdef DECODESTATS
+	struct BlockStats *blockStats = stats.current();
+#endif
+
+	unsigned long long bits = in.bitBuffer;
+	int left = in.bitCount;
+	const unsigned char *next = &in.dataIn[in.byteIndex];
+	const unsigned char *inLimit = &in.dataIn[in.byteLength - FASTINPUT];
+	unsigned char *out = pLZ->getCursor();
+	const unsigned char *outBase = pLZ->getBase();
+	const unsigned char *outLimit = pLZ->getLimit();
+	int ret = LEAVEFAST;
+
+	while (next <= inLimit && out < outLimit)
+	{
+		unsigned long long word;
+		memcpy(&word, next, 8);
+		bits |= word << left;
+		next += (63 - left) >> 3;
+		left |= 56;
+
+		/* The literal table gives literals, or the length symbol when its
+		   code fits, and only longer codes need the lookup table. */
+		int symbol = -1;
+		if (literals != NULL)
+		{
+			/* As many lookups of up to three literals as the bits cover. */
+			const struct literalEntry *entry = &literals[bits & ((1 << LITBITS) - 1)];
+			if (entry->count != 0)
+			{
+				do
+				{
+					bits >>= entry->bits;
+					left -= entry->bits;
+					memcpy(out, entry->lit, 3);
+					out += entry->count;
+#ifdef DECODESTATS
+					blockStats->literals += entry->count;
+#endif
+					entry = &literals[bits & ((1 << LITBITS) - 1)];
+				} while (entry->count != 0 && left >= LITBITS);
+				continue;
+			}
+			if (entry->bits != 0)
+			{
+				bits >>= entry->bits;
+				left -= entry->bits;
+				symbol = entry->symbol;
+			}
+		}
+
+		const struct decodeEntry *entry;
+		if (symbol < 0)
+		{
+			entry = &lentab[bits & lenmask];
+			if (entry->op == TABLELINK)
+			{
+				entry = &lentab[entry->value + ((bits >> lencode->rootBits) & ((1U << entry->bits) - 1))];
+			}
+			if (entry->op != TABLESYMBOL)
+			{
+				ret = RANOUTOFCODES;
+				break;
+			}
+			bits >>= entry->bits;
+			left -= entry->bits;
+
+			symbol = entry->value;
+			if (symbol < 256)
+			{
+				*out++ = (unsigned char)symbol;
+#ifdef DECODESTATS
+				blockStats->literals++;
+#endif
+				continue;
+			}
+		}
+		if (symbol == 256)
+		{
+			ret = 0;
+			break;
+		}
+		if (symbol >= 257 + 29)
+		{
+			ret = INVALIDFIXEDCODE;
+			break;
+		}
+
+		int extra = lengthExtra[symbol - 257];
+		int len = lengthBase[symbol - 257] + (int)(bits & ((1U << extra) - 1));
+		bits >>= extra;
+		left -= extra;
+
+		entry = &disttab[bits & distmask];
+		if (entry->op == TABLELINK)
+		{
+			entry = &disttab[entry->value + ((bits >> distcode->rootBits) & ((1U << entry->bits) - 1))];
+		}
+		if (entry->op != TABLESYMBOL)
+		{
+			ret = RANOUTOFCODES;
+			break;
+		}
+		bits >>= entry->bits;
+		left -= entry->bits;
+
+		int dsymbol = entry->value;
+		extra = distanceExtra[dsymbol];
+		unsigned int dist = distanceBase[dsymbol] + (unsigned int)(bits & ((1U << extra) - 1));
+		bits >>= extra;
+		left -= extra;
+
+		if (dist > (unsigned int)(out - outBase))
+		{
+			ret = DISTANCETOOFAR;
+			break;
+		}
+		TLZ<Sink>::copyMatch(out, len, dist);
+		out += len;
+#ifdef DECODESTATS
+		blockStats->matches++;
+		blockStats->lengthSymbols[symbol - 257]++;
+		blockStats->distanceSymbols[dsymbol]++;
+#endif
+	}
+
+	in.bitBuffer = bits;
+	in.bitCount = left;
+	in.byteIndex = next - in.dataIn;
+	pLZ->setCursor(out);
+
+	return ret;
+}
+
 /*
 * Given the list of code lengths length[0..n-1] representing a canonical
 * Huffman code for n symbols, construct the tables required to decode those
-* codes.  Those tables are the number of codes of each length, and the symbols
-* sorted by length, retaining their original order within each length.  The
+* codes.  Those tables are the number of codes of each length in count[], and
+* the symbols sorted by length, retaining their original order within each
+* length, in symbols[]; h is pointed at both.  The
 * return value is zero for a complete code set, negative for an over-
 * subscribed code set, and positive for an incomplete code set.  The tables
 * can be used if the return value is zero or positive, but they cannot be used
@@ -700,7 +1618,7 @@ int CHuffman::codes(const struct huffman* lencode, const struct huffman* distcod
 *
 * Assumption: for all i in 0..n-1, 0 <= length[i] <= MAXBITS
 * This is assured by the construction of the length arrays in dynamic() and
-* fixed() and is not verified by construct().
+* is not verified by construct().
 *
 * Format notes:
 *
@@ -711,23 +1629,27 @@ int CHuffman::codes(const struct huffman* lencode, const struct huffman* distcod
 * - Within a given code length, the symbols are kept in ascending order for
 *   the code bits definition.
 */
-int CHuffman::construct(struct huffman *h, const short *length, int n)
+template <class Sink, class Window>
+int THuffman<Sink, Window>::construct(struct huffman *h, short *count, short *symbols, const short *length, int n)
 {
 	int len, symbol, left;
 	short offs[MAXBITS + 1];      /* offsets in symbol table for each length */
 
+	h->count = count;
+	h->symbol = symbols;
+
 	/* count number of codes of each length */
 	for (len = 0; len <= MAXBITS; len++)
 	{
-		h->count[len] = 0;
+		count[len] = 0;
 	}
 
 	for (symbol = 0; symbol < n; symbol++)
 	{
-		(h->count[length[symbol]])++;   /* assumes lengths are within bounds */
+		(count[length[symbol]])++;   /* assumes lengths are within bounds */
 	}
 
-	if (h->count[0] == n) /* no codes! */
+	if (count[0] == n) /* no codes! */
 	{
 		return 0;                       /* complete, but decode() will fail */
 	}
@@ -737,7 +1659,7 @@ int CHuffman::construct(struct huffman *h, const short *length, int n)
 	for (len = 1; len <= MAXBITS; len++)
 	{
 		left <<= 1;                     /* one more bit, double codes left */
-		left -= h->count[len];          /* deduct count from possible codes */
+		left -= count[len];          /* deduct count from possible codes */
 		if (left < 0)
 		{
 			return left;                /* over-subscribed--return negative */
@@ -748,7 +1670,7 @@ int CHuffman::construct(struct huffman *h, const short *length, int n)
 	offs[1] = 0;
 	for (len = 1; len < MAXBITS; len++)
 	{
-		offs[len + 1] = offs[len] + h->count[len];
+		offs[len + 1] = offs[len] + count[len];
 	}
 
 	/*
@@ -758,9 +1680,271 @@ int CHuffman::construct(struct huffman *h, const short *length, int n)
 	for (symbol = 0; symbol < n; symbol++)
 	if (length[symbol] != 0)
 	{
-		h->symbol[offs[length[symbol]]++] = symbol;
+		symbols[offs[length[symbol]]++] = symbol;
 	}
 
 	/* return zero for complete set, positive for incomplete set */
 	return left;
 }
+
+/*
+* Build the lookup table used by decodeTable() from the count[] and symbol[]
+* arrays that construct() filled in.  table has room for size entries; the
+* primary table takes the first 1 << rootBits of them and subtables follow.
+* The return value is the number of entries used, or -1 if they do not fit,
+* in which case h->table is left NULL and decode() falls back to the
+* canonical decoder.
+*
+* Format notes:
+*
+* - The codes are generated in canonical order exactly as decodeCanonical()
+*   steps through them: the first code of each length is the last code of
+*   the previous length plus one with a zero bit appended.
+*
+* - Codes that share the same first rootBits bits are adjacent in canonical
+*   order, so each subtable is filled completely before the next one starts.
+*   A subtable is made just big enough for the codes with its prefix, which
+*   is found by counting how much of the code space the remaining lengths
+*   use up (the same method zlib uses).
+*
+* - Entries not reached by any code, which only happens for incomplete codes,
+*   are left as TABLEINVALID.
+*/
+template <class Sink, class Window>
+int THuffman<Sink, Window>::buildTable(struct huffman *h, struct decodeEntry *table, int rootBits, int size)
+{
+	int len;                        /* length of the current code */
+	int count;                      /* codes of this length left to place */
+	int index;                      /* index into h->symbol[] */
+	int code;                       /* current code, first bit highest */
+	int reversed;                   /* current code, first bit lowest */
+	int fill;                       /* table entry being filled */
+	int used;                       /* entries handed out so far */
+	int prefix;                     /* root bits of the current subtable */
+	int sub;                        /* offset of the current subtable */
+	int subBits;                    /* index bits of the current subtable */
+	int maxLen;                     /* longest code length in use */
+	int left;                       /* code space left for a subtable */
+	short remaining[MAXBITS + 1];   /* codes of each length not yet placed */
+
+	h->table = NULL;
+	h->rootBits = rootBits;
+
+	used = 1 << rootBits;
+	if (used > size)
+	{
+		return -1;
+	}
+
+	/* every bit pattern starts out invalid */
+	for (fill = 0; fill < used; fill++)
+	{
+		table[fill].value = 0;
+		table[fill].bits = 0;
+		table[fill].op = TABLEINVALID;
+	}
+
+	maxLen = 0;
+	for (len = 0; len <= MAXBITS; len++)
+	{
+		remaining[len] = h->count[len];
+		if (len > 0 && h->count[len] != 0)
+		{
+			maxLen = len;
+		}
+	}
+
+	code = index = sub = subBits = 0;
+	prefix = -1;
+	for (len = 1; len <= MAXBITS; len++)
+	{
+		for (count = h->count[len]; count > 0; count--)
+		{
+			/* reverse the code so it can index the table directly */
+			reversed = 0;
+			for (fill = 0; fill < len; fill++)
+			{
+				reversed |= ((code >> fill) & 1) << (len - 1 - fill);
+			}
+
+			if (len <= rootBits)
+			{
+				/* repeat the entry for every value of the bits after the code */
+				for (fill = reversed; fill < (1 << rootBits); fill += 1 << len)
+				{
+					table[fill].value = h->symbol[index];
+					table[fill].bits = (unsigned char)len;
+					table[fill].op = TABLESYMBOL;
+				}
+			}
+			else
+			{
+				if ((reversed & ((1 << rootBits) - 1)) != prefix)
+				{
+					/* start a new subtable, sized for the codes with this prefix */
+					prefix = reversed & ((1 << rootBits) - 1);
+					subBits = len - rootBits;
+					left = 1 << subBits;
+					while (subBits + rootBits < maxLen)
+					{
+						left -= remaining[subBits + rootBits];
+						if (left <= 0)
+						{
+							break;
+						}
+						subBits++;
+						left <<= 1;
+					}
+
+					sub = used;
+					used += 1 << subBits;
+					if (used > size)
+					{
+						return -1;
+					}
+					for (fill = sub; fill < used; fill++)
+					{
+						table[fill].value = 0;
+						table[fill].bits = 0;
+						table[fill].op = TABLEINVALID;
+					}
+
+					table[prefix].value = (unsigned short)sub;
+					table[prefix].bits = (unsigned char)subBits;
+					table[prefix].op = TABLELINK;
+				}
+
+				for (fill = reversed >> rootBits; fill < (1 << subBits); fill += 1 << (len - rootBits))
+				{
+					table[sub + fill].value = h->symbol[index];
+					table[sub + fill].bits = (unsigned char)len;
+					table[sub + fill].op = TABLESYMBOL;
+				}
+			}
+
+			remaining[len]--;
+			index++;
+			code++;
+		}
+		code <<= 1;
+	}
+
+	h->table = table;
+	return used;
+}
+
+/*
+* Build the multiple literal table for a literal/length code from its lookup
+* table.  literals has 1 << LITBITS entries.  If the lookup table could not
+* be built, h->literals is left NULL.
+*
+* Notes:
+*
+* - The first pass finds, for every LITBITS-bit index, the literal its bits
+*   start with, if that literal's code is no longer than LITBITS.  The bits
+*   above the index are taken as zero, which gives the right symbol for any
+*   code that fits.  Where the bits start with a length or end-of-block code
+*   that fits, the entry keeps that symbol instead, so that a match costs
+*   one lookup whether or not the literal table is in use.
+*
+* - The second pass appends the literal that the remaining bits start with,
+*   as long as the codes still fit, and then a third the same way.  Those
+*   remaining bits are index >> bits, which is a smaller index, so going
+*   from the top down means it still holds its single literal.
+*/
+template <class Sink, class Window>
+void THuffman<Sink, Window>::buildLiteralTable(struct huffman *h, struct literalEntry *literals)
+{
+	int index, next, count;
+	const struct decodeEntry *entry;
+
+	h->literals = NULL;
+	if (h->table == NULL)
+	{
+		return;
+	}
+
+	/* single literals */
+	for (index = 0; index < (1 << LITBITS); index++)
+	{
+		entry = &h->table[index & ((1 << h->rootBits) - 1)];
+		if (entry->op == TABLELINK)
+		{
+			entry = &h->table[entry->value + ((index >> h->rootBits) & ((1 << entry->bits) - 1))];
+		}
+
+		literals[index].count = 0;
+		literals[index].bits = 0;
+		literals[index].symbol = 0;
+		if (entry->op == TABLESYMBOL && entry->bits <= LITBITS)
+		{
+			literals[index].bits = entry->bits;
+			if (entry->value < 256)
+			{
+				literals[index].count = 1;
+				literals[index].lit[0] = (unsigned char)entry->value;
+			}
+			else
+			{
+				literals[index].symbol = entry->value;
+			}
+		}
+	}
+
+	/* add the literals that follow */
+	for (index = (1 << LITBITS) - 1; index >= 0; index--)
+	{
+		struct literalEntry *first = &literals[index];
+		struct literalEntry single = *first;
+
+		for (count = 1; first->count == count && count < MAXLITERALS; count++)
+		{
+			/* next == index only for index 0, which is being changed */
+			next = index >> first->bits;
+			const struct literalEntry *follow = next == index ? &single : &literals[next];
+			if (follow->count == 0 || first->bits + follow->bits > LITBITS)
+			{
+				break;
+			}
+
+			first->lit[count] = follow->lit[0];
+			first->bits = (unsigned char)(first->bits + follow->bits);
+			first->count++;
+		}
+	}
+
+	h->literals = literals;
+}
+
+/*
+* In MULTILITERALDECODE, build the multiple literal table of the current
+* dynamic block once the block has produced LITERALTABLEAFTER bytes, if its
+* code has enough short literals (see literalPairs()) and the table was not
+* already built when the code was last used.  The fixed code's table is
+* built in at compile time and always used.
+*
+* Notes:
+*
+* - The decoder leaves the fast loop at least once for every window of
+*   output, which is where codes() calls this, so a long block changes over
+*   within about two windows and a short one never pays for the table.
+*/
+template <class Sink, class Window>
+void THuffman<Sink, Window>::blockLiterals(void)
+{
+	if (decodeMode == MULTILITERALDECODE && blockCode != NULL && blockCode->lencode.literals == NULL &&
+		blockCode->literalPairs && pLZ->getLength() - blockOutput >= LITERALTABLEAFTER)
+	{
+		buildLiteralTable(&blockCode->lencode, blockCode->littab);
+	}
+}
+
+/* The outputs the decoder is built for. */
+template class THuffman<CIO>;
+template class THuffman<CMemorySink>;
+template class THuffman<CFileSink>;
+template class THuffman<CNullSink>;
+template class THuffman<CCallbackSink>;
+
+/* The speculative decoder of TParallelInflate. */
+template class THuffman<CNullSink, CMarkerLZ>;
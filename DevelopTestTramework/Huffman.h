@@ -2,6 +2,11 @@
 
 #include "LZ.h"
 #include "CIO.h"
+#include "BitReader.h"
+#include "structs.h"
+#ifdef DECODESTATS
+#include "DecodeStats.h"
+#endif
 
 /* Types of blocks. */
 #define STORED 0
@@ -20,6 +25,11 @@
 #define INCOMPLETECODESINGLE 8
 #define INCOMPLETECODESINGLE2 9
 #define INVALIDFIXEDCODE -11
+#define DISTANCETOOFAR -12
+#define BADBLOCKTYPE -13
+#define CRCMISMATCH -14
+#define LENGTHMISMATCH -15
+#define ADLERMISMATCH -23
 
 
 
@@ -32,30 +42,327 @@
 #define MAXDCODES 30					/* maximum number of distance codes */
 #define MAXCODES (MAXLCODES+MAXDCODES)	/* maximum codes lengths to read */
 #define FIXLCODES 288					/* number of fixed literal/length codes */
+#define LENGTHCODES 29					/* length symbols, 257..285 */
 
-class CHuffman
+/* Base values and extra bits of the length and distance symbols. */
+extern const short lengthBase[LENGTHCODES], lengthExtra[LENGTHCODES];
+extern const short distanceBase[MAXDCODES], distanceExtra[MAXDCODES];
+
+/*
+	Sizes of the lookup tables used by the table-driven decoder. The primary
+	table is indexed by LENROOTBITS or DISTROOTBITS bits, codes that are longer
+	than that continue in subtables. ENOUGHLENS and ENOUGHDISTS are the largest
+	number of entries that any permitted code can need for those root sizes
+	(the same bounds zlib uses). The code length code is at most seven bits
+	long so it always fits in a single table.
+*/
+#define LENROOTBITS 9
+#define DISTROOTBITS 6
+#define CODEROOTBITS 7
+#define ENOUGHLENS 852
+#define ENOUGHDISTS 592
+#define ENOUGHCODES (1 << CODEROOTBITS)
+
+/*
+	Width of the multiple literal table. Up to three literals whose codes add
+	up to no more than LITBITS bits are decoded with a single lookup.
+*/
+#define LITBITS 11
+#define MAXLITERALS 3
+
+/*
+	When a dynamic block uses the multiple literal table. It has to have
+	produced LITERALTABLEAFTER bytes of output first, since building the
+	table costs about as much as decoding a few thousand symbols, which a
+	short block never earns back. And its code has to put two literals in
+	one lookup at least once in LITERALPAIRS lookups, as far as the code
+	lengths tell: otherwise the table decodes one literal at a time like the
+	lookup table, only from more memory, and is slower.
+*/
+#define LITERALTABLEAFTER 32768
+#define LITERALPAIRS 16
+
+/*
+	Number of dynamic codes each decoder keeps the tables of, so that a
+	block that repeats the code lengths of a recent block does not build
+	them again.
+*/
+#define DYNCACHESIZE 4
+
+/* Kinds of lookup table entries. */
+#define TABLESYMBOL 0
+#define TABLELINK 1
+#define TABLEINVALID 2
+
+/* Decoding modes. */
+#define CANONICALDECODE 0
+#define TABLEDECODE 1
+#define MULTILITERALDECODE 2
+
+/* What follows the deflate data. */
+#define FORMATRAW 0						/* nothing */
+#define FORMATGZIP 1					/* the gzip trailer, CRC-32 and ISIZE */
+#define FORMATZLIB 2					/* the zlib trailer, Adler-32 */
+
+/* Where the decoder is between calls. */
+#define STATEHEADER 0					/* next is a block header */
+#define STATESTORED 1					/* inside a stored block */
+#define STATECODES 2					/* inside a fixed or dynamic block */
+#define STATEDONE 3						/* the last block has been decoded */
+#define STATETRAILER 4					/* next is the trailer */
+
+/*
+	Called before each block header with the bit offset of the header in the
+	input, the number of bytes of output so far, and the history window (up
+	to WINDOWSIZE bytes of the most recent output).
+*/
+typedef void (*BlockCallback)(void *context, long long bit, long long output, const unsigned char *history, int historyLength);
+
+/* Reasons for returning before the end of the stream. */
+#define NEEDINPUT 20
+#define NEEDOUTPUT 21
+#define LEAVEFAST 22					/* the fast loop got near the end of the input or window */
+
+/*
+	The fast loop of codes() runs while a refill can always load eight whole
+	bytes of input, so it never checks for the end of the input per symbol.
+*/
+#define FASTINPUT 8
+
+/*
+	The decoding tables of one dynamic code, and the code lengths they were
+	built from. signature is a hash of the lengths that rules out most other
+	codes without comparing them.
+*/
+struct DynamicCode
+{
+	unsigned long long signature;
+	int nlen, ndist;					/* 0 while the entry is empty or being built */
+	long long used;						/* when it was last used, for replacing the oldest */
+	bool literalPairs;					/* the code is worth a multiple literal table */
+	short lengths[MAXLCODES + MAXDCODES];
+	short lencnt[MAXBITS + 1], lensym[MAXLCODES];
+	short distcnt[MAXBITS + 1], distsym[MAXDCODES];
+	struct decodeEntry lentab[ENOUGHLENS], disttab[ENOUGHDISTS];
+	struct literalEntry littab[1 << LITBITS];
+	struct huffman lencode, distcode;
+};
+
+/*
+	The decoder. Sink is the output policy (see Sinks.h), the same as for the
+	TLZ window it writes to, so every kind of output gets its own copy of the
+	decoding loop with the window calls inlined and no run-time dispatch.
+	Window is the history window, which is only something other than TLZ for
+	the speculative decoding done by the parallel decoder (see CMarkerLZ).
+*/
+template <class Sink, class Window = TLZ<Sink> >
+class THuffman
 {
 public:
-	CHuffman(CLZ* pLZ,CIO *pCIO);
-	~CHuffman();
+	THuffman(Window* pLZ, Sink *pSink);
+	~THuffman();
 
 	int getBits(int need);
-	void decompress(unsigned char *compressedData, int dataSize);
+	void decompress(const unsigned char *compressedData, size_t dataSize);
+
+	int decodeRange(const unsigned char *data, size_t size, long long startBit, long long stopBit);
+	int probe(const unsigned char *data, size_t size, long long bit);
+
+	/// <summary>
+	/// Bit offset in the input where decodeRange() stopped: the header of
+	/// the block it did not decode, or the end of the last block.
+	/// </summary>
+	long long stoppedAt() const
+	{
+		return in.bitPosition();
+	}
+
+	/// <summary>
+	/// True if the last block of the stream has been decoded.
+	/// </summary>
+	bool sawLast() const
+	{
+		return last != 0 && state == STATEDONE;
+	}
+
+	/// <summary>
+	/// Sets a function to call before each block header, or NULL.
+	/// </summary>
+	void setBlockCallback(BlockCallback callback, void *context)
+	{
+		blockCallback = callback;
+		blockContext = context;
+	}
+
+	void beginStream(void);
+	void beginStream(const unsigned char *data, size_t size, long long bit);
+	int feed(const unsigned char *chunk, int size);
+	void endInput(void);
+	int drain(unsigned char *out, int size);
+	int next(const unsigned char **span);
+
+	/// <summary>
+	/// The input fed with feed() that the decoder has not used, which once
+	/// the stream is finished is whatever came after it. Returns its length.
+	/// </summary>
+	size_t unusedInput(const unsigned char **data) const
+	{
+		*data = in.dataIn + in.byteIndex - in.bytesBuffered();
+		return in.bytesAvailable() + in.bytesBuffered();
+	}
+
+	/// <summary>
+	/// True once the whole stream has been decoded and drained.
+	/// </summary>
+	bool finished() const
+	{
+		return state == STATEDONE && pLZ->pending() == 0;
+	}
+
+	/// <summary>
+	/// Selects the lookup table decoder that also decodes several literals
+	/// at a time (the default), the lookup table decoder on its own, or the
+	/// bit-at-a-time canonical decoder, which is kept as a reference to test
+	/// against.
+	/// </summary>
+	void setDecodeMode(int mode)
+	{
+		decodeMode = mode;
+	}
 
-	int bytesIn, byteLength, byteIndex, bitBuffer, bitCount, error;
-	unsigned char *dataIn;
+	/// <summary>
+	/// Selects what follows the deflate data, FORMATRAW (the default),
+	/// FORMATGZIP or FORMATZLIB, whose trailer is then checked against the
+	/// output.
+	/// </summary>
+	void setFormat(int format)
+	{
+		this->format = format;
+	}
+
+	/// <summary>
+	/// Sets the preset dictionary that back-references may reach into before
+	/// the output starts, or NULL for none, from the next stream on. At most
+	/// WINDOWSIZE bytes of it are used, and it must stay in place until the
+	/// stream starts.
+	/// </summary>
+	void setDictionary(const unsigned char *dictionary, int length)
+	{
+		pLZ->setDictionary(dictionary, length);
+	}
+
+	/// <summary>
+	/// Number of bytes of the input passed to decompress() that have been
+	/// decoded, counting a byte that was partly used. Once a FORMATGZIP
+	/// stream is finished this is where its trailer ends.
+	/// </summary>
+	size_t inputUsed() const
+	{
+		return in.byteIndex - in.bytesBuffered();
+	}
+
+	/// <summary>
+	/// Number of dynamic blocks whose code tables were found in the cache,
+	/// since the decoder was made.
+	/// </summary>
+	long long getCacheHits() const
+	{
+		return cacheHits;
+	}
+
+	/// <summary>
+	/// Number of dynamic blocks whose code tables had to be built.
+	/// </summary>
+	long long getCacheMisses() const
+	{
+		return cacheMisses;
+	}
+
+	/// <summary>
+	/// Number of bytes of output since the stream started.
+	/// </summary>
+	long long outputLength() const
+	{
+		return pLZ->getLength();
+	}
+
+	int error;
+	CBitReader in;
+
+#ifdef DECODESTATS
+	/* Per block counts and times of what has been decoded. */
+	CDecodeStats stats;
+#endif
 
 private:
-	unsigned int getTwoByteValue(unsigned char *data);
-	void stored(void);
+	unsigned int getTwoByteValue(const unsigned char *data);
+	int inflate(void);
+	int block(void);
+	int needInput(const CBitReader *restart);
+	int blockIncomplete(void);
+	int stored(void);
+	int storedData(void);
+	int trailer(void);
+	int checkKind(void) const;
 	int dynamic(void);
 	void fixed(void);
 	int decode(const struct huffman* h);
+	int decodeCanonical(const struct huffman* h);
+	int decodeTable(const struct huffman* h);
 	int codes(const struct huffman* lencode, const struct huffman* distcode);
-	int construct(struct huffman *h, const short *length, int n);
+	int codesFast(const struct huffman* lencode, const struct huffman* distcode);
+	int construct(struct huffman *h, short *count, short *symbols, const short *length, int n);
+	int buildTable(struct huffman *h, struct decodeEntry *table, int rootBits, int size);
+	void buildLiteralTable(struct huffman *h, struct literalEntry *literals);
+	void blockLiterals(void);
+	static unsigned long long signature(const short *lengths, int nlen, int ndist);
+	static bool literalPairs(const short *lengths);
+#ifdef DECODESTATS
+	void endBlockStats(long long started);
+#endif
 
-	CLZ* pLZ;
-	CIO* pCIO;
+	Window* pLZ;
+	Sink* pSink;
+	int decodeMode;
+	int format;
+
+	long long stopBit;					/* decodeRange() stops at a block starting here or later */
+	BlockCallback blockCallback;
+	void *blockContext;
+
+	/* Decoder state that has to survive a return for more input or output. */
+	int state;							/* STATEHEADER, STATESTORED, ... */
+	int last;							/* the current block is the last one */
+	int storedLeft;						/* bytes of the stored block still to copy */
+	int inputFinal;						/* no more input will come */
+	CBitReader blockStart;				/* reader state at the current block header */
+	const struct huffman *blockLencode;	/* codes of the current block */
+	const struct huffman *blockDistcode;
+	struct DynamicCode *blockCode;		/* cache entry of the current dynamic block, else NULL */
+	long long blockOutput;				/* output before the current block */
+
+	/* Code of the code lengths of the current dynamic block. */
+	short codeLencnt[MAXBITS + 1], codeLensym[19];
+	struct decodeEntry codeLentab[ENOUGHCODES];
+	struct huffman codeLencode;
+
+	/* Tables of the most recent dynamic codes, the current one among them. */
+	struct DynamicCode *dynCodes;
+	long long dynUses;					/* dynamic blocks decoded, the clock of used */
+	long long cacheHits, cacheMisses;
+
+	/* Input passed to feed() that has not been decoded yet. */
+	unsigned char *streamBuffer;
+	int streamCapacity;
 
 };
 
+/* The decoder for the run-time configured CIO output. */
+typedef THuffman<CIO> CHuffman;
+
+/* Instantiated in Huffman.cpp. */
+extern template class THuffman<CIO>;
+extern template class THuffman<CMemorySink>;
+extern template class THuffman<CFileSink>;
+extern template class THuffman<CNullSink>;
+extern template class THuffman<CCallbackSink>;
@@ -1,16 +1,289 @@
 #include "stdafx.h"
 #include "LZ.h"
 
-CLZ::CLZ()
+template <class Sink>
+TLZ<Sink>::TLZ()
 {
+	pSink = NULL;
+	hold = false;
+	check = CHECKNONE;
+	dictionary = NULL;
+	dictionaryLength = 0;
+	ownWindow = new unsigned char[LZBUFFERSIZE];
+	window = ownWindow;
+	limit = WINDOWSIZE * 2;
+	inPlace = false;
+	reset();
 }
 
-CLZ::~CLZ()
+template <class Sink>
+TLZ<Sink>::~TLZ()
 {
+	delete [] ownWindow;
 }
 
-int CLZ::lit(unsigned short symbol)
+/*
+* Write the output of the next stream straight into buffer, which has room
+* for size bytes, instead of the window's own buffer, or go back to that with
+* NULL.  Set it before the reset() that starts the stream.  The output is
+* still flushed to the sink as usual, from where it lies in buffer.
+*
+* Notes:
+*
+* - The last MAXMATCH + COPYSLACK bytes of buffer are only room for the
+*   over-wide stores of copy(), so that much more than the output is needed.
+*   If the output does not fit, decoding stops with OUTPUTBUFFERFULL.
+*
+* - Each reset() starts the output at the start of buffer again, after the
+*   dictionary if one is set, so a buffer holds one stream.
+*/
+template <class Sink>
+void TLZ<Sink>::setOutputBuffer(unsigned char *buffer, int size)
 {
-	unsigned char d = (unsigned char)symbol;
-	return pCIO->output(&d, 1);
+	if (buffer != NULL)
+	{
+		window = buffer;
+		/* a symbol may start where there is still that much room */
+		limit = size - (MAXMATCH + COPYSLACK) + 1;
+		if (limit < 0)
+		{
+			limit = 0;
+		}
+		inPlace = true;
+	}
+	else
+	{
+		window = ownWindow;
+		limit = WINDOWSIZE * 2;
+		inPlace = false;
+	}
+	pos = flushed = 0;
 }
+
+/// <summary>
+/// Forgets the history, ready for a new stream, and starts it with the
+/// dictionary if one was set.
+/// </summary>
+template <class Sink>
+void TLZ<Sink>::reset(void)
+{
+	pos = flushed = 0;
+	if (dictionary != NULL)
+	{
+		/* history only: it is not output */
+		memcpy(window, dictionary, dictionaryLength);
+		pos = flushed = dictionaryLength;
+	}
+	checkValue = check == CHECKADLER32 ? 1 : 0;
+	total = 0;
+}
+
+/*
+* The check value of all of the output since reset(), including what has not
+* been flushed yet.  Output is added to the check value as it leaves the
+* window, since every byte leaves through flush(), drain() or take() exactly
+* once.
+*/
+template <class Sink>
+unsigned int TLZ<Sink>::getCheck(void) const
+{
+	if (check == CHECKCRC32)
+	{
+		return CCrc32::update(checkValue, &window[flushed], pos - flushed);
+	}
+	if (check == CHECKADLER32)
+	{
+		return CAdler32::update(checkValue, &window[flushed], pos - flushed);
+	}
+
+	return 0;
+}
+
+/* Add count bytes at data, which are about to leave the window, to the check. */
+template <class Sink>
+void TLZ<Sink>::addCheck(const unsigned char *data, int count)
+{
+	if (check == CHECKCRC32)
+	{
+		checkValue = CCrc32::update(checkValue, data, count);
+	}
+	else if (check == CHECKADLER32)
+	{
+		checkValue = CAdler32::update(checkValue, data, count);
+	}
+	total += count;
+}
+
+/*
+* Hand everything written since the last flush to the output.  Returns the
+* value from the output() of the sink, or 0 when there was nothing to write or the
+* output is being held for drain().
+*/
+template <class Sink>
+int TLZ<Sink>::flush(void)
+{
+	int ret = 0;
+
+	if (hold)
+	{
+		return 0;
+	}
+
+	addCheck(&window[flushed], pos - flushed);
+	if (pos > flushed && pSink != NULL)
+	{
+		ret = pSink->output(&window[flushed], pos - flushed);
+	}
+	flushed = pos;
+
+	return ret;
+}
+
+/*
+* Copy up to size bytes of held output to out.  Returns the number of bytes
+* copied.
+*/
+template <class Sink>
+int TLZ<Sink>::drain(unsigned char *out, int size)
+{
+	int count = pos - flushed;
+
+	if (count > size)
+	{
+		count = size;
+	}
+
+	memcpy(out, &window[flushed], count);
+	addCheck(&window[flushed], count);
+	flushed += count;
+
+	return count;
+}
+
+/*
+* Give out all of the held output in place: *data is set to where it is in
+* the window and the number of bytes is returned.  The bytes stay where they
+* are as history, and so stay valid until the next write to the window,
+* which may slide() them away.
+*/
+template <class Sink>
+int TLZ<Sink>::take(const unsigned char **data)
+{
+	int count = pos - flushed;
+
+	*data = &window[flushed];
+	addCheck(&window[flushed], count);
+	flushed = pos;
+
+	return count;
+}
+
+/*
+* Make room at the end of the buffer.  Everything is flushed, then the most
+* recent WINDOWSIZE bytes are moved to the start of the buffer where they
+* stay available for back-references.  When output is being held, this
+* fails and returns -1 if more than WINDOWSIZE bytes have not been drained
+* yet, since those would be lost.  Writing into a buffer from
+* setOutputBuffer(), there is nothing to slide, and a full buffer fails the
+* same way.
+*/
+template <class Sink>
+int TLZ<Sink>::slide(void)
+{
+	if (pos < limit)
+	{
+		return 0;
+	}
+
+	flush();
+	if (inPlace || pos - flushed > WINDOWSIZE)
+	{
+		return -1;
+	}
+
+	memmove(window, &window[pos - WINDOWSIZE], WINDOWSIZE);
+	flushed -= pos - WINDOWSIZE;
+	pos = WINDOWSIZE;
+
+	return 0;
+}
+
+/*
+* Copy len bytes from dist bytes back in the output.  Returns 0, or -1 if
+* the distance reaches back before the start of the output.  space() must be
+* above zero; the buffer has room for a whole match after that.
+*
+* Notes:
+*
+* - Until the first slide() the window starts at the start of the output, or
+*   of the dictionary, and after it there are always WINDOWSIZE bytes of
+*   history before pos, so comparing dist with pos is enough to reject
+*   distances that are too far.
+*
+* - The copy is made with eight or sixteen byte loads and stores and may
+*   write up to COPYSLACK bytes past the end of the match.  Those bytes are
+*   inside the buffer and are overwritten by whatever comes next.
+*
+* - When dist is at least the width of a store, every load only reads bytes
+*   that were already written, so a plain forward copy in chunks handles
+*   overlapped matches correctly.
+*
+* - For shorter distances the repeating pattern is expanded into an eight
+*   byte word once, and that word is stored repeatedly.  Each store advances
+*   by the largest multiple of dist that fits in eight bytes so the pattern
+*   stays in phase.  Runs of a single byte (dist 1) and of four byte values
+*   (dist 4), which are common, advance a full eight bytes per store.
+*/
+template <class Sink>
+int TLZ<Sink>::copy(int len, unsigned int dist)
+{
+	if ((int)dist > pos)
+	{
+		return -1;
+	}
+
+	copyMatch(&window[pos], len, dist);
+	pos += len;
+
+	return 0;
+}
+
+/*
+* Copy the contents of a stored block into the window.  The block can be
+* longer than the free space, so it goes in as many pieces as needed.
+* Returns the number of bytes stored, which is less than len only if output
+* is being held and the window filled up, or the buffer from
+* setOutputBuffer() is full.
+*/
+template <class Sink>
+int TLZ<Sink>::store(const unsigned char *data, int len)
+{
+	int done = 0;
+
+	while (done < len)
+	{
+		if (slide() < 0)
+		{
+			break;
+		}
+
+		int count = limit - pos;
+		if (count > len - done)
+		{
+			count = len - done;
+		}
+
+		memcpy(&window[pos], &data[done], count);
+		pos += count;
+		done += count;
+	}
+
+	return done;
+}
+
+/* The outputs the decoder is built for. */
+template class TLZ<CIO>;
+template class TLZ<CMemorySink>;
+template class TLZ<CFileSink>;
+template class TLZ<CNullSink>;
+template class TLZ<CCallbackSink>;
@@ -1,19 +1,258 @@
 #pragma once
+#include <memory.h>
 #include "CIO.h"
+#include "Sinks.h"
+#include "Crc32.h"
+#include "Adler32.h"
 
-class CLZ
+/*
+	Sizes of the history window. A distance can reach back at most WINDOWSIZE
+	bytes, and a match is at most MAXMATCH bytes long. The buffer holds two
+	windows so that the older one only has to be moved down once for every
+	WINDOWSIZE bytes of output, plus room for a whole match and for the
+	over-wide stores made by copy().
+*/
+#define WINDOWSIZE 32768
+#define MAXMATCH 258
+#define COPYSLACK 16
+#define LZBUFFERSIZE (2 * WINDOWSIZE + MAXMATCH + COPYSLACK)
+
+/* Errors */
+#define OUTPUTBUFFERFULL -29	/* the buffer given to setOutputBuffer() is too small */
+
+/* Check values the window can keep over its output. */
+#define CHECKNONE 0
+#define CHECKCRC32 1
+#define CHECKADLER32 2
+
+/*
+	History window and back-reference engine. Sink is the output policy the
+	window flushes to (see Sinks.h); it is a template argument so that the
+	decoder compiled for each kind of output has no run-time dispatch in it.
+
+	By default the window is a buffer of its own of LZBUFFERSIZE bytes, which
+	it flushes and slides as it fills, so decoding takes the same memory
+	however long the output is. With setOutputBuffer() it writes the output
+	straight into a buffer big enough for all of it instead, and never
+	slides, which saves moving the history down but needs memory for the
+	whole output.
+*/
+template <class Sink>
+class TLZ
 {
 public:
-	CLZ();
-	~CLZ();
+	TLZ();
+	~TLZ();
+
+	void setIO(Sink* pSink)
+	{
+		this->pSink = pSink;
+	}
+
+	/// <summary>
+	/// When holding, flush() leaves the output in the window until drain()
+	/// takes it, instead of giving it to pSink.
+	/// </summary>
+	void setHold(bool hold)
+	{
+		this->hold = hold;
+	}
+
+	/// <summary>
+	/// Number of bytes that can still be written before slide() is needed.
+	/// lit() and copy() may only be called while this is above zero.
+	/// </summary>
+	int space() const
+	{
+		return limit - pos;
+	}
+
+	/// <summary>
+	/// Number of bytes written but not yet flushed or drained.
+	/// </summary>
+	int pending() const
+	{
+		return pos - flushed;
+	}
+
+	/// <summary>
+	/// Writes one literal byte to the window.
+	/// </summary>
+	int lit(unsigned short symbol)
+	{
+		window[pos++] = (unsigned char)symbol;
+		return 1;
+	}
+
+	/// <summary>
+	/// Writes count (1 to 3) literal bytes to the window. Three bytes are
+	/// always stored, which the slack after the window allows, so that the
+	/// copy does not depend on count.
+	/// </summary>
+	void lits(const unsigned char *literals, int count)
+	{
+		memcpy(&window[pos], literals, 3);
+		pos += count;
+	}
+
+	void setOutputBuffer(unsigned char *buffer, int size);
+
+	/// <summary>
+	/// Selects the check value kept over the output, CHECKNONE, CHECKCRC32
+	/// or CHECKADLER32. Set it before the reset() that starts the stream.
+	/// </summary>
+	void setCheck(int check)
+	{
+		this->check = check;
+	}
+
+	unsigned int getCheck(void) const;
+
+	/// <summary>
+	/// Sets up to WINDOWSIZE bytes that back-references may reach into
+	/// before the first byte of output, or NULL for none. Used from the
+	/// next reset() on; the bytes are copied then.
+	/// </summary>
+	void setDictionary(const unsigned char *dictionary, int length)
+	{
+		this->dictionary = dictionary;
+		dictionaryLength = length;
+	}
+
+	/// <summary>
+	/// The most recent output, up to WINDOWSIZE bytes of it, which is what
+	/// later back-references can reach. Returns its length.
+	/// </summary>
+	int history(const unsigned char **data) const
+	{
+		int length = pos < WINDOWSIZE ? pos : WINDOWSIZE;
+		*data = &window[pos - length];
+		return length;
+	}
+
+	/// <summary>
+	/// Number of bytes written since the last reset(), including those not
+	/// yet flushed.
+	/// </summary>
+	long long getLength(void) const
+	{
+		return total + (pos - flushed);
+	}
+
+	/// <summary>
+	/// Writes the len bytes that start dist bytes before out to out, with
+	/// stores that may run up to COPYSLACK bytes past the end. The distance
+	/// must already have been checked. See copy() for how it works.
+	/// </summary>
+	static void copyMatch(unsigned char *out, int len, unsigned int dist)
+	{
+		const unsigned char *from = out - dist;
+
+		if (dist >= 16)
+		{
+			do
+			{
+				memcpy(out, from, 16);
+				out += 16;
+				from += 16;
+				len -= 16;
+			}
+			while (len > 0);
+		}
+		else if (dist >= 8)
+		{
+			do
+			{
+				memcpy(out, from, 8);
+				out += 8;
+				from += 8;
+				len -= 8;
+			}
+			while (len > 0);
+		}
+		else
+		{
+			unsigned char pattern[8];
+			int step = 8 - 8 % dist;
+
+			for (int index = 0; index < 8; index++)
+			{
+				pattern[index] = from[index % dist];
+			}
+
+			do
+			{
+				memcpy(out, pattern, 8);
+				out += step;
+				len -= step;
+			}
+			while (len > 0);
+		}
+	}
 
-	void setIO(CIO* pCIO)
+	/*
+		Direct writes, for the decoder's fast loop, which keeps the output
+		position in a register instead of going through lit() and copy().
+		It writes from getCursor() on as long as it starts each symbol below
+		getLimit(), never reaches back before getBase(), and hands the new
+		position back with setCursor().
+	*/
+	enum { DIRECTWRITE = 1 };
+
+	unsigned char *getCursor()
+	{
+		return &window[pos];
+	}
+
+	const unsigned char *getBase() const
+	{
+		return window;
+	}
+
+	const unsigned char *getLimit() const
 	{
-		this->pCIO = pCIO;
+		return &window[limit];
 	}
 
-	int lit(unsigned short symbol);
+	void setCursor(unsigned char *cursor)
+	{
+		pos = (int)(cursor - window);
+	}
+
+	int copy(int len, unsigned int dist);
+	int store(const unsigned char *data, int len);
+	int flush(void);
+	int drain(unsigned char *out, int size);
+	int take(const unsigned char **data);
+	int slide(void);
+	void reset(void);
+
+	Sink *pSink;
 
-	CIO *pCIO;
+private:
+	void addCheck(const unsigned char *data, int count);
+
+	unsigned char *window;	/* history followed by output not yet flushed */
+	unsigned char *ownWindow;	/* the LZBUFFERSIZE window allocated here */
+	int limit;				/* slide() is needed from here on */
+	bool inPlace;			/* window is the caller's buffer for the whole output */
+	int pos;				/* where the next byte goes */
+	int flushed;			/* bytes before this have been given out */
+	bool hold;				/* keep output for drain() rather than pSink */
+	int check;				/* CHECKNONE or CHECKCRC32 */
+	unsigned int checkValue;	/* check value of the flushed output */
+	long long total;		/* bytes flushed since reset() */
+	const unsigned char *dictionary;	/* copied in front of the output by reset() */
+	int dictionaryLength;
 };
 
+/* The window for the run-time configured CIO output. */
+typedef TLZ<CIO> CLZ;
+
+/* Instantiated in LZ.cpp. */
+extern template class TLZ<CIO>;
+extern template class TLZ<CMemorySink>;
+extern template class TLZ<CFileSink>;
+extern template class TLZ<CNullSink>;
+extern template class TLZ<CCallbackSink>;
+
@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile()
+{
+	pData = NULL;
+	length = 0;
+	mapped = false;
+#ifdef _WIN32
+	hFile = hMapping = NULL;
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+	close();
+}
+
+/*
+* Map the file at filePath.  options is a combination of MAPPOPULATE and
+* MAPHUGEPAGES; both are hints and are ignored where they are not
+* supported.  Returns 0, or -1 if the file could not be opened.
+*
+* Notes:
+*
+* - The whole input is read once from front to back, so the kernel is told
+*   to read ahead aggressively and to drop pages behind the reader.
+*
+* - MAPPOPULATE faults the whole file in during open(), which trades a
+*   slower start for no page faults while decoding.
+*/
+int CMappedFile::open(const char *filePath, int options)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return -1;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && (unsigned long long)fileSize.QuadPart <= (size_t)-1)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (view != NULL)
+			{
+				hFile = file;
+				hMapping = mapping;
+				pData = (unsigned char *)view;
+				length = (size_t)fileSize.QuadPart;
+				mapped = true;
+				return 0;
+			}
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = ::open(filePath, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+		(unsigned long long)info.st_size <= (size_t)-1)
+	{
+		int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		if (options & MAPPOPULATE)
+		{
+			flags |= MAP_POPULATE;
+		}
+#endif
+		void *view = mmap(NULL, (size_t)info.st_size, PROT_READ, flags, fd, 0);
+		if (view != MAP_FAILED)
+		{
+			madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+			if (options & MAPHUGEPAGES)
+			{
+				madvise(view, (size_t)info.st_size, MADV_HUGEPAGE);
+			}
+#endif
+			/* The mapping keeps the file open on its own. */
+			::close(fd);
+			pData = (unsigned char *)view;
+			length = (size_t)info.st_size;
+			mapped = true;
+			return 0;
+		}
+	}
+	::close(fd);
+#endif
+
+	/* Empty files, pipes and anything else that cannot be mapped. */
+	return readAll(filePath);
+}
+
+/*
+* Fallback for files that cannot be mapped: read the whole file into an
+* allocated buffer.  Returns 0, or -1 on failure.
+*/
+int CMappedFile::readAll(const char *filePath)
+{
+	FILE *fp = fopen(filePath, "rb");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+
+	size_t capacity = 0;
+	for (;;)
+	{
+		if (length == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 65536;
+			unsigned char *grown = (unsigned char *)realloc(pData, capacity);
+			if (grown == NULL)
+			{
+				fclose(fp);
+				close();
+				return -1;
+			}
+			pData = grown;
+		}
+
+		size_t got = fread(&pData[length], 1, capacity - length, fp);
+		if (got == 0)
+		{
+			break;
+		}
+		length += got;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/// <summary>
+/// Unmaps or frees the file contents.
+/// </summary>
+void CMappedFile::close(void)
+{
+	if (mapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(pData);
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		hFile = hMapping = NULL;
+#else
+		munmap(pData, length);
+#endif
+	}
+	else
+	{
+		free(pData);
+	}
+
+	pData = NULL;
+	length = 0;
+	mapped = false;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+
+/* Options for CMappedFile::open(). */
+#define MAPSEQUENTIAL 0		/* plain mapping, read front to back */
+#define MAPPOPULATE 1		/* fault every page in up front */
+#define MAPHUGEPAGES 2		/* ask for huge pages where the system allows it */
+
+/*
+	Read-only view of a whole file that the decoder can read from directly.
+	The file is memory mapped, so there is no copy from the page cache into
+	the heap. If the file cannot be mapped (a pipe, for example), it is read
+	into memory instead and the rest of the program does not see the
+	difference.
+*/
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	int open(const char *filePath, int options);
+	void close(void);
+
+	/// <summary>
+	/// Address of the first byte of the file.
+	/// </summary>
+	const unsigned char *data() const
+	{
+		return pData;
+	}
+
+	/// <summary>
+	/// Length of the file in bytes.
+	/// </summary>
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	int readAll(const char *filePath);
+
+	unsigned char *pData;
+	size_t length;
+	bool mapped;		/* pData is a mapping rather than a heap copy */
+#ifdef _WIN32
+	void *hFile;
+	void *hMapping;
+#endif
+};
@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#include <string.h>
+#include "MarkerLZ.h"
+
+CMarkerLZ::CMarkerLZ()
+{
+	capacity = MARKERINITIALSIZE;
+	output = new unsigned short[capacity + MAXMATCH + COPYSLACK];
+	kind = WINDOWMARKERS;
+	known = NULL;
+	reset();
+}
+
+CMarkerLZ::~CMarkerLZ()
+{
+	delete [] output;
+}
+
+/// <summary>
+/// Says what comes before the output: markers, the WINDOWSIZE bytes at
+/// window, or nothing. Takes effect at the next reset().
+/// </summary>
+void CMarkerLZ::setWindow(int kind, const unsigned char *window)
+{
+	this->kind = kind;
+	known = window;
+}
+
+/*
+* Start a new piece.  The window in front of the output is filled with the
+* known bytes, or with one marker for each of its positions.
+*/
+void CMarkerLZ::reset(void)
+{
+	for (int i = 0; i < WINDOWSIZE; i++)
+	{
+		output[i] = kind == WINDOWKNOWN ? known[i] : (unsigned short)(MARKERBASE + i);
+	}
+	pos = WINDOWSIZE;
+}
+
+/*
+* Make more room by doubling the buffer.  Nothing is ever dropped, since the
+* whole piece is needed once its markers are resolved.  Returns 0, or -1 if
+* the piece cannot get any larger.
+*/
+int CMarkerLZ::slide(void)
+{
+	if (pos < capacity)
+	{
+		return 0;
+	}
+
+	if (capacity > (1 << 30))
+	{
+		return -1;
+	}
+
+	int grown = capacity * 2;
+	unsigned short *buffer = new unsigned short[grown + MAXMATCH + COPYSLACK];
+	memcpy(buffer, output, pos * sizeof(unsigned short));
+	delete [] output;
+	output = buffer;
+	capacity = grown;
+
+	return 0;
+}
+
+/*
+* Copy len values from dist back.  Markers are copied like bytes, which is
+* the whole point.  Returns 0, or -1 if dist reaches back before the window,
+* or before the output at the start of the stream.
+*/
+int CMarkerLZ::copy(int len, unsigned int dist)
+{
+	if ((int)dist > pos - (kind == WINDOWNONE ? WINDOWSIZE : 0))
+	{
+		return -1;
+	}
+
+	unsigned short *out = &output[pos];
+	const unsigned short *from = out - dist;
+	pos += len;
+
+	if ((int)dist >= len)
+	{
+		memcpy(out, from, len * sizeof(unsigned short));
+	}
+	else
+	{
+		/* overlapped: repeat the last dist values */
+		while (len-- > 0)
+		{
+			*out++ = *from++;
+		}
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Stores the contents of a stored block. Returns len.
+/// </summary>
+int CMarkerLZ::store(const unsigned char *data, int len)
+{
+	int done = 0;
+
+	while (done < len)
+	{
+		if (slide() < 0)
+		{
+			break;
+		}
+
+		int count = capacity - pos;
+		if (count > len - done)
+		{
+			count = len - done;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			output[pos + i] = data[done + i];
+		}
+		pos += count;
+		done += count;
+	}
+
+	return done;
+}
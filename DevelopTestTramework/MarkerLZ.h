@@ -0,0 +1,161 @@
+#pragma once
+#include "LZ.h"
+
+/*
+	Values in the output of a CMarkerLZ. Below MARKERBASE a value is a byte
+	of output. From MARKERBASE on it stands for byte value - MARKERBASE of
+	the WINDOWSIZE bytes that came before the start of the decoding, which
+	are not known yet.
+*/
+#define MARKERBASE 256
+#define MARKERINITIALSIZE (1 << 22)
+
+/* What comes before the output of a CMarkerLZ. */
+#define WINDOWMARKERS 0		/* unknown bytes, written out as markers */
+#define WINDOWKNOWN 1		/* bytes given to setWindow() */
+#define WINDOWNONE 2		/* nothing: this is the start of the stream */
+
+/*
+	History window for speculative decoding, used in place of TLZ by the
+	parallel decoder. It keeps the whole output of a piece of the stream as
+	16-bit values so that bytes copied from before the start of the piece
+	can be written as markers and resolved once the preceding output is
+	known. The output is never flushed; the buffer grows instead.
+
+	It has the same members as TLZ that THuffman uses, so that the decoder
+	can be instantiated with it.
+*/
+class CMarkerLZ
+{
+public:
+	CMarkerLZ();
+	~CMarkerLZ();
+
+	void setIO(CNullSink *pSink)
+	{
+	}
+
+	void setHold(bool hold)
+	{
+	}
+
+	void setCheck(int check)
+	{
+	}
+
+	unsigned int getCheck(void) const
+	{
+		return 0;
+	}
+
+	void setDictionary(const unsigned char *dictionary, int length)
+	{
+	}
+
+	/* The output is not bytes, so the decoder's fast loop, which writes
+	   bytes straight into a TLZ window, is never used with this. */
+	enum { DIRECTWRITE = 0 };
+
+	unsigned char *getCursor()
+	{
+		return NULL;
+	}
+
+	const unsigned char *getBase() const
+	{
+		return NULL;
+	}
+
+	const unsigned char *getLimit() const
+	{
+		return NULL;
+	}
+
+	void setCursor(unsigned char *cursor)
+	{
+	}
+
+	/// <summary>
+	/// Number of values of output since reset().
+	/// </summary>
+	long long getLength(void) const
+	{
+		return pos - WINDOWSIZE;
+	}
+
+	int pending() const
+	{
+		return 0;
+	}
+
+	int flush(void)
+	{
+		return 0;
+	}
+
+	int drain(unsigned char *out, int size)
+	{
+		return 0;
+	}
+
+	int take(const unsigned char **data)
+	{
+		*data = NULL;
+		return 0;
+	}
+
+	int history(const unsigned char **data) const
+	{
+		*data = NULL;
+		return 0;
+	}
+
+	/// <summary>
+	/// Number of values that can be written before slide() is needed.
+	/// </summary>
+	int space() const
+	{
+		return capacity - pos;
+	}
+
+	/// <summary>
+	/// Writes one literal byte.
+	/// </summary>
+	int lit(unsigned short symbol)
+	{
+		output[pos++] = symbol;
+		return 1;
+	}
+
+	/// <summary>
+	/// Writes count (1 to 3) literal bytes. Three values are always stored.
+	/// </summary>
+	void lits(const unsigned char *literals, int count)
+	{
+		output[pos] = literals[0];
+		output[pos + 1] = literals[1];
+		output[pos + 2] = literals[2];
+		pos += count;
+	}
+
+	int copy(int len, unsigned int dist);
+	int store(const unsigned char *data, int len);
+	int slide(void);
+	void reset(void);
+	void setWindow(int kind, const unsigned char *window);
+
+	/// <summary>
+	/// The output since reset(), getLength() values.
+	/// </summary>
+	const unsigned short *data() const
+	{
+		return &output[WINDOWSIZE];
+	}
+
+private:
+	unsigned short *output;		/* the window, then the output */
+	int capacity;				/* values that fit before the slack */
+	int pos;					/* where the next value goes */
+	int kind;					/* WINDOWMARKERS, WINDOWKNOWN or WINDOWNONE */
+	const unsigned char *known;	/* the window for WINDOWKNOWN */
+};
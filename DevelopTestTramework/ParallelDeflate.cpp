@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include <string.h>
+#include <thread>
+#include "ParallelDeflate.h"
+#include "Crc32.h"
+
+template <class Sink>
+TParallelDeflate<Sink>::TParallelDeflate(Sink *pSink, int threads, int level)
+{
+	this->pSink = pSink;
+	this->threads = threads > 0 ? threads : 1;
+	this->level = level;
+	chunkSize = PARALLELDEFLATECHUNK;
+	error = 0;
+	totalOut = 0;
+
+	pieces = new struct DeflatePiece[this->threads];
+	for (int t = 0; t < this->threads; t++)
+	{
+		pieces[t].out = NULL;
+		pieces[t].outLength = pieces[t].outCapacity = 0;
+		pieces[t].pSink = new CCallbackSink(collect, &pieces[t]);
+		pieces[t].pDeflate = new CPieceDeflate(pieces[t].pSink, level);
+	}
+}
+
+template <class Sink>
+TParallelDeflate<Sink>::~TParallelDeflate()
+{
+	for (int t = 0; t < threads; t++)
+	{
+		delete pieces[t].pDeflate;
+		delete pieces[t].pSink;
+		delete [] pieces[t].out;
+	}
+	delete [] pieces;
+}
+
+/*
+* Compress size bytes of data to the sink as one gzip member.  Returns 0 or
+* an error, which is also left in error.
+*
+* Notes:
+*
+* - Each round hands one piece to each thread, the first on this thread,
+*   and then writes the compressed pieces in order.  The pieces are the same
+*   size, so the threads take about as long as each other.
+*
+* - The CRC of the whole input is the CRCs of the pieces combined, which
+*   costs a few multiplications per piece instead of a pass over the data.
+*/
+template <class Sink>
+int TParallelDeflate<Sink>::compress(const unsigned char *data, size_t size)
+{
+	unsigned char header[GZIPHEADERSIZE];
+	unsigned int crc = 0;
+	size_t offset = 0;
+
+	error = 0;
+	totalOut = 0;
+
+	CPieceDeflate::gzipHeader(header, level);
+	error = write(header, GZIPHEADERSIZE);
+
+	bool done = false;
+	while (!done && error == 0)
+	{
+		/* Cut the next pieces.  Empty input still makes one, empty, piece. */
+		int count = 0;
+		while (count < threads && !done)
+		{
+			struct DeflatePiece *piece = &pieces[count++];
+			piece->offset = offset;
+			piece->data = &data[offset];
+			piece->length = size - offset < chunkSize ? size - offset : chunkSize;
+			offset += piece->length;
+			piece->last = done = offset == size;
+		}
+
+		std::thread *workers = new std::thread[count];
+		for (int t = 1; t < count; t++)
+		{
+			workers[t] = std::thread(compressPiece, &pieces[t]);
+		}
+		compressPiece(&pieces[0]);
+		for (int t = 1; t < count; t++)
+		{
+			workers[t].join();
+		}
+		delete [] workers;
+
+		for (int t = 0; t < count && error == 0; t++)
+		{
+			struct DeflatePiece *piece = &pieces[t];
+			if (piece->error != 0)
+			{
+				error = piece->error;
+				break;
+			}
+
+			crc = CCrc32::combine(crc, piece->crc, (long long)piece->length);
+			error = write(piece->out, piece->outLength);
+		}
+	}
+
+	if (error == 0)
+	{
+		unsigned char trailer[8];
+		for (int n = 0; n < 4; n++)
+		{
+			trailer[n] = (unsigned char)(crc >> (n * 8));
+			trailer[4 + n] = (unsigned char)((unsigned long long)size >> (n * 8));
+		}
+		error = write(trailer, sizeof(trailer));
+	}
+	if (error == 0)
+	{
+		int ret = pSink->flush();
+		if (ret < 0)
+		{
+			error = ret;
+		}
+	}
+
+	return error;
+}
+
+/// <summary>
+/// Passes length bytes to the sink, in pieces it can take. Returns 0 or
+/// the sink's error.
+/// </summary>
+template <class Sink>
+int TParallelDeflate<Sink>::write(unsigned char *data, size_t length)
+{
+	for (size_t written = 0; written < length; )
+	{
+		int count = length - written > (1 << 30) ? (1 << 30) : (int)(length - written);
+		int ret = pSink->output(&data[written], count);
+		if (ret < 0)
+		{
+			return ret;
+		}
+		written += count;
+	}
+
+	totalOut += length;
+	return 0;
+}
+
+/*
+* Thread body: compress one piece, with the input before it as the
+* dictionary, into the piece's own buffer.
+*/
+template <class Sink>
+void TParallelDeflate<Sink>::compressPiece(struct DeflatePiece *piece)
+{
+	CPieceDeflate *deflate = piece->pDeflate;
+	size_t history = piece->offset < WINDOWSIZE ? piece->offset : WINDOWSIZE;
+
+	piece->outLength = 0;
+	deflate->reset();
+	if (history > 0)
+	{
+		deflate->setDictionary(&piece->data[-(long long)history], (int)history);
+	}
+	piece->error = deflate->compress(piece->data, piece->length, piece->last ? DEFLATEFINISH : DEFLATESYNC);
+	piece->crc = CCrc32::update(0, piece->data, piece->length);
+}
+
+/*
+* Sink callback: append compressed bytes to the piece's buffer, at least
+* doubling it when it is full.
+*/
+template <class Sink>
+int TParallelDeflate<Sink>::collect(void *context, const unsigned char *data, int size)
+{
+	struct DeflatePiece *piece = (struct DeflatePiece *)context;
+
+	if (piece->outLength + size > piece->outCapacity)
+	{
+		size_t capacity = piece->outCapacity == 0 ? DEFLATEOUTSIZE : piece->outCapacity * 2;
+		while (capacity < piece->outLength + size)
+		{
+			capacity *= 2;
+		}
+		unsigned char *grown = new unsigned char[capacity];
+		if (piece->outLength > 0)
+		{
+			memcpy(grown, piece->out, piece->outLength);
+		}
+		delete [] piece->out;
+		piece->out = grown;
+		piece->outCapacity = capacity;
+	}
+
+	memcpy(&piece->out[piece->outLength], data, size);
+	piece->outLength += size;
+	return size;
+}
+
+template class TParallelDeflate<CIO>;
+template class TParallelDeflate<CMemorySink>;
+template class TParallelDeflate<CFileSink>;
+template class TParallelDeflate<CNullSink>;
+template class TParallelDeflate<CCallbackSink>;
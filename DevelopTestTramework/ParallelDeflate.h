@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Deflate.h"
+
+/* Bytes of input per piece that one thread compresses. */
+#define PARALLELDEFLATECHUNK (1 << 20)
+
+/* The encoder each thread runs, collecting its output in memory. */
+typedef TDeflate<CCallbackSink> CPieceDeflate;
+
+/*
+	One piece of the input, as compressed by one thread.
+*/
+struct DeflatePiece
+{
+	const unsigned char *data;	/* the input of the piece */
+	size_t length;
+	size_t offset;				/* where it starts in the whole input */
+	bool last;					/* the piece ends the stream */
+	unsigned char *out;			/* the compressed piece */
+	size_t outLength, outCapacity;
+	unsigned int crc;			/* CRC-32 of the input of the piece */
+	int error;
+	CCallbackSink *pSink;
+	CPieceDeflate *pDeflate;
+};
+
+/*
+	Compresses to a single gzip member with several threads, the way pigz
+	does.
+
+	The input is cut into pieces of PARALLELDEFLATECHUNK bytes, and each
+	thread compresses one piece as a raw deflate stream of its own, with the
+	WINDOWSIZE bytes of input before the piece as a preset dictionary so
+	matches still reach back across the cut. Every piece except the last
+	ends with DEFLATESYNC, which leaves it on a byte boundary after an empty
+	stored block and without a final block, so the pieces can just be
+	written one after the other and read as one deflate stream. The CRC-32
+	of each piece is computed by its thread too, and the CRCs are combined
+	for the trailer.
+
+	The output is the same as compressing the pieces in order with a single
+	encoder that syncs after each one, so any inflater decodes it, and it
+	is a little larger than a single stream from the lost matches at the
+	start of each piece and the sync blocks.
+*/
+template <class Sink>
+class TParallelDeflate
+{
+public:
+	TParallelDeflate(Sink *pSink, int threads, int level);
+	~TParallelDeflate();
+
+	int compress(const unsigned char *data, size_t size);
+
+	/// <summary>
+	/// Sets the number of input bytes per piece.
+	/// </summary>
+	void setChunkSize(size_t chunkSize)
+	{
+		this->chunkSize = chunkSize > 0 ? chunkSize : PARALLELDEFLATECHUNK;
+	}
+
+	/// <summary>
+	/// Bytes of compressed output written by the last compress().
+	/// </summary>
+	long long getTotalOut() const
+	{
+		return totalOut;
+	}
+
+	int error;
+
+private:
+	int write(unsigned char *data, size_t length);
+
+	static void compressPiece(struct DeflatePiece *piece);
+	static int collect(void *context, const unsigned char *data, int size);
+
+	Sink *pSink;
+	int threads;
+	int level;
+	size_t chunkSize;
+	struct DeflatePiece *pieces;
+	long long totalOut;
+};
+
+/* Instantiated in ParallelDeflate.cpp. */
+extern template class TParallelDeflate<CIO>;
+extern template class TParallelDeflate<CMemorySink>;
+extern template class TParallelDeflate<CFileSink>;
+extern template class TParallelDeflate<CNullSink>;
+extern template class TParallelDeflate<CCallbackSink>;
@@ -0,0 +1,378 @@
+#include "stdafx.h"
+#include <string.h>
+#include <thread>
+#include "ParallelInflate.h"
+#include "Crc32.h"
+
+template <class Sink>
+TParallelInflate<Sink>::TParallelInflate(Sink *pSink, int threads)
+{
+	this->pSink = pSink;
+	this->threads = threads > 0 ? threads : 1;
+	chunkSize = PARALLELCHUNKSIZE;
+	error = 0;
+	piecesUsed = piecesRedone = 0;
+
+	pieces = new struct ParallelPiece[this->threads];
+	for (int t = 0; t < this->threads; t++)
+	{
+		pieces[t].pWindow = new CMarkerLZ();
+		pieces[t].pDecoder = new CMarkerHuffman(pieces[t].pWindow, NULL);
+		pieces[t].bytes = NULL;
+	}
+}
+
+template <class Sink>
+TParallelInflate<Sink>::~TParallelInflate()
+{
+	for (int t = 0; t < threads; t++)
+	{
+		delete pieces[t].pDecoder;
+		delete pieces[t].pWindow;
+		delete [] pieces[t].bytes;
+	}
+	delete [] pieces;
+}
+
+/*
+* Decompress every member of the gzip file in data to the sink.  Returns 0
+* or an error, which is also left in error.  Like TGZip, bytes after the
+* last member that do not start another member are ignored.
+*/
+template <class Sink>
+int TParallelInflate<Sink>::decompress(const unsigned char *data, size_t size)
+{
+	size_t offset = 0;
+	int members = 0;
+
+	error = 0;
+	piecesUsed = piecesRedone = 0;
+
+	while (offset < size)
+	{
+		if (members > 0 && (size - offset < 2 || data[offset] != GZIPID1 || data[offset + 1] != GZIPID2))
+		{
+			break;
+		}
+
+		size_t end;
+		error = member(data, size, offset, &end);
+		if (error != 0)
+		{
+			return error;
+		}
+
+		members++;
+		offset = end;
+	}
+
+	if (members == 0)
+	{
+		error = NOTGZIP;
+	}
+	else if (pSink != NULL)
+	{
+		pSink->flush();
+	}
+
+	return error;
+}
+
+/*
+* Decompress the member at offset and check its trailer.  Sets end to the
+* offset after the member and returns 0, or returns an error.
+*/
+template <class Sink>
+int TParallelInflate<Sink>::member(const unsigned char *data, size_t size, size_t offset, size_t *end)
+{
+	struct GZipMember header;
+	int ret = TGZip<Sink>::parseHeader(data, size, offset, &header);
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	/* A BGZF member says where it ends, which keeps the threads inside it. */
+	size_t limit = size;
+	if (header.blockSize != 0 && header.blockSize <= size - offset)
+	{
+		limit = offset + header.blockSize;
+	}
+	const unsigned char *deflate = &data[header.dataOffset];
+	size_t length = limit - header.dataOffset;
+
+	position = 0;
+	total = 0;
+	crc = 0;
+
+	int done = 0;
+	while (!done)
+	{
+		ret = round(deflate, length, &done);
+		if (ret != 0)
+		{
+			return ret;
+		}
+	}
+
+	/* The trailer is at the next byte boundary (see THuffman::trailer()). */
+	size_t trailer = (size_t)((position + 7) >> 3);
+	if (length - trailer < 8)
+	{
+		return DATAEND;
+	}
+
+	const unsigned char *check = &deflate[trailer];
+	unsigned int expected = check[0] | (check[1] << 8) | (check[2] << 16) | ((unsigned int)check[3] << 24);
+	unsigned int isize = check[4] | (check[5] << 8) | (check[6] << 16) | ((unsigned int)check[7] << 24);
+	if (expected != crc)
+	{
+		return CRCMISMATCH;
+	}
+	if (isize != (unsigned int)total)
+	{
+		return LENGTHMISMATCH;
+	}
+
+	*end = header.dataOffset + trailer + 8;
+	return 0;
+}
+
+/*
+* Decode one piece per thread, put them in order, and write their output.
+* Sets done once the last block of the stream has been written.  Returns 0
+* or an error.
+*
+* Notes:
+*
+* - A piece that was decoded from a block start that turns out not to be
+*   where the piece before it ended is decoded again here, on this thread,
+*   with the window known.  That is also what happens to a piece where no
+*   block start was found at all, for instance one inside a single stored
+*   or fixed block, which the search does not look for.
+*
+* - A block can run on past the end of the next piece or more.  Pieces that
+*   end up entirely behind the output so far are skipped.
+*/
+template <class Sink>
+int TParallelInflate<Sink>::round(const unsigned char *deflate, size_t length, int *done)
+{
+	long long next = (long long)((position >> 3) / chunkSize + 1);
+	long long bits = (long long)length * 8;
+
+	roundData = deflate;
+	roundLength = length;
+	roundPieces = 0;
+	for (int t = 0; t < threads; t++)
+	{
+		struct ParallelPiece *piece = &pieces[t];
+		long long from = t == 0 ? position : (next + t - 1) * (long long)chunkSize * 8;
+		if (t > 0 && from >= bits)
+		{
+			break;
+		}
+
+		piece->startBit = from;
+		piece->stopBit = (next + t) * (long long)chunkSize * 8;
+		piece->used = false;
+		roundPieces++;
+	}
+
+	/* Decode every piece at once, the first one on this thread. */
+	std::thread *workers = new std::thread[roundPieces];
+	for (int t = 1; t < roundPieces; t++)
+	{
+		workers[t] = std::thread(speculate, this, t);
+	}
+	speculate(this, 0);
+	for (int t = 1; t < roundPieces; t++)
+	{
+		workers[t].join();
+	}
+
+	/* Put the pieces in order and pass the window along. */
+	int used = 0;
+	for (int t = 0; t < roundPieces && !*done; t++)
+	{
+		struct ParallelPiece *piece = &pieces[t];
+
+		if (piece->startBit != position)
+		{
+			if (position >= piece->stopBit)
+			{
+				continue;
+			}
+			redo(piece);
+			piecesRedone++;
+		}
+		else if (t > 0)
+		{
+			piecesUsed++;
+		}
+
+		if (piece->error != 0)
+		{
+			delete [] workers;
+			return piece->error;
+		}
+
+		passWindow(piece);
+		piece->used = true;
+		used = t + 1;
+		position = piece->endBit;
+		total += piece->pWindow->getLength();
+		*done = piece->last;
+	}
+
+	/* Fill in the markers and compute the CRCs, again all at once. */
+	for (int t = 1; t < used; t++)
+	{
+		if (pieces[t].used)
+		{
+			workers[t] = std::thread(resolve, &pieces[t]);
+		}
+	}
+	if (pieces[0].used)
+	{
+		resolve(&pieces[0]);
+	}
+	for (int t = 1; t < used; t++)
+	{
+		if (pieces[t].used)
+		{
+			workers[t].join();
+		}
+	}
+	delete [] workers;
+
+	/* Write the output in order. */
+	for (int t = 0; t < used; t++)
+	{
+		struct ParallelPiece *piece = &pieces[t];
+		if (!piece->used)
+		{
+			continue;
+		}
+
+		crc = CCrc32::combine(crc, piece->crc, piece->length);
+		for (long long written = 0; written < piece->length && pSink != NULL; )
+		{
+			int count = piece->length - written > (1 << 30) ? (1 << 30) : (int)(piece->length - written);
+			if (pSink->output(&piece->bytes[written], count) < 0)
+			{
+				return OUTPUTWRITEFAILED;
+			}
+			written += count;
+		}
+
+		delete [] piece->bytes;
+		piece->bytes = NULL;
+	}
+
+	return 0;
+}
+
+/*
+* Thread body: decode piece index of the round.  The first piece starts
+* where the output so far ends and knows its window.  Every other piece
+* looks for a block start from its first bit on and decodes from the first
+* one that it can decode without an error up to the end of the piece.
+*/
+template <class Sink>
+void TParallelInflate<Sink>::speculate(TParallelInflate *self, int index)
+{
+	struct ParallelPiece *piece = &self->pieces[index];
+	CMarkerHuffman *decoder = piece->pDecoder;
+	const unsigned char *data = self->roundData;
+	size_t length = self->roundLength;
+
+	if (index == 0)
+	{
+		piece->pWindow->setWindow(self->total == 0 ? WINDOWNONE : WINDOWKNOWN, self->window);
+		piece->error = decoder->decodeRange(data, length, piece->startBit, piece->stopBit);
+		piece->endBit = decoder->stoppedAt();
+		piece->last = decoder->sawLast();
+		return;
+	}
+
+	piece->pWindow->setWindow(WINDOWMARKERS, NULL);
+	long long bits = (long long)length * 8;
+	for (long long bit = piece->startBit; bit < piece->stopBit && bit < bits; bit++)
+	{
+		if (decoder->probe(data, length, bit) != 0)
+		{
+			continue;
+		}
+
+		piece->error = decoder->decodeRange(data, length, bit, piece->stopBit);
+		if (piece->error == 0)
+		{
+			piece->startBit = bit;
+			piece->endBit = decoder->stoppedAt();
+			piece->last = decoder->sawLast();
+			return;
+		}
+	}
+
+	piece->startBit = -1;
+}
+
+/*
+* Decode piece again from where the output so far ends, with the window
+* known.
+*/
+template <class Sink>
+void TParallelInflate<Sink>::redo(struct ParallelPiece *piece)
+{
+	piece->pWindow->setWindow(total == 0 ? WINDOWNONE : WINDOWKNOWN, window);
+	piece->startBit = position;
+	piece->error = piece->pDecoder->decodeRange(roundData, roundLength, position, piece->stopBit);
+	piece->endBit = piece->pDecoder->stoppedAt();
+	piece->last = piece->pDecoder->sawLast();
+}
+
+/*
+* Keep the window the piece starts with for resolve(), and move the window
+* on to the end of the piece.  Only the last WINDOWSIZE values of the piece
+* have to be resolved for that.
+*/
+template <class Sink>
+void TParallelInflate<Sink>::passWindow(struct ParallelPiece *piece)
+{
+	const unsigned short *out = piece->pWindow->data();
+	long long length = piece->pWindow->getLength();
+	int keep = length < WINDOWSIZE ? (int)length : WINDOWSIZE;
+
+	memcpy(piece->window, window, WINDOWSIZE);
+	memmove(window, &window[keep], WINDOWSIZE - keep);
+	out += length - keep;
+	for (int i = 0; i < keep; i++)
+	{
+		window[WINDOWSIZE - keep + i] = out[i] < MARKERBASE ? (unsigned char)out[i] : piece->window[out[i] - MARKERBASE];
+	}
+}
+
+/*
+* Thread body: replace the markers in the output of piece with the bytes of
+* the window before it, and compute the CRC-32 of the result.
+*/
+template <class Sink>
+void TParallelInflate<Sink>::resolve(struct ParallelPiece *piece)
+{
+	const unsigned short *out = piece->pWindow->data();
+
+	piece->length = piece->pWindow->getLength();
+	piece->bytes = new unsigned char[piece->length > 0 ? piece->length : 1];
+	for (long long i = 0; i < piece->length; i++)
+	{
+		piece->bytes[i] = out[i] < MARKERBASE ? (unsigned char)out[i] : piece->window[out[i] - MARKERBASE];
+	}
+	piece->crc = CCrc32::update(0, piece->bytes, (size_t)piece->length);
+}
+
+/* The outputs the parallel decoder is built for. */
+template class TParallelInflate<CIO>;
+template class TParallelInflate<CMemorySink>;
+template class TParallelInflate<CFileSink>;
+template class TParallelInflate<CNullSink>;
+template class TParallelInflate<CCallbackSink>;
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Huffman.h"
+#include "MarkerLZ.h"
+#include "GZip.h"
+
+/*
+	Compressed bytes per piece of the stream that one thread decodes. Each
+	piece holds its whole output as 16-bit values until it is resolved, so
+	this also sets the memory used per thread.
+*/
+#define PARALLELCHUNKSIZE (4 << 20)
+
+/* The speculative decoder. */
+typedef THuffman<CNullSink, CMarkerLZ> CMarkerHuffman;
+extern template class THuffman<CNullSink, CMarkerLZ>;
+
+/*
+	One piece of the stream, as decoded by one thread.
+*/
+struct ParallelPiece
+{
+	long long startBit;		/* block the decoding started at, or -1 if none was found */
+	long long stopBit;		/* decoding stops at the first block from here on */
+	long long endBit;		/* where it did stop */
+	int error;				/* from the decoder */
+	bool last;				/* it ended with the last block of the stream */
+	CMarkerLZ *pWindow;		/* the output, with markers */
+	CMarkerHuffman *pDecoder;
+	unsigned char window[WINDOWSIZE];	/* resolved output before the piece */
+	unsigned char *bytes;	/* resolved output */
+	long long length;
+	unsigned int crc;
+	bool used;				/* part of the output of this round */
+};
+
+/*
+	Decompresses a gzip file with several threads, even when it is a single
+	deflate stream.
+
+	Each member is cut into pieces of PARALLELCHUNKSIZE compressed bytes. The
+	first piece of a round starts where the output so far ends, but every
+	other thread first has to find where a block starts in its piece, by
+	trying every bit position until one holds a dynamic block header that
+	passes all the checks the decoder makes. It then decodes from there,
+	without knowing the 32K of output that come before, by writing any byte
+	copied from before its start as a marker for that position (CMarkerLZ).
+
+	The pieces are then put in order. A piece is used if it starts exactly
+	where the one before it stopped, which means the sequential decoder
+	would have decoded the same blocks; otherwise it is decoded again from
+	the right place. The windows are passed along, which only needs the last
+	32K of each piece, and then the threads fill in the markers of their own
+	piece and compute its CRC, and the CRCs are combined to check the
+	trailer. This is how pugz and rapidgzip work.
+*/
+template <class Sink>
+class TParallelInflate
+{
+public:
+	TParallelInflate(Sink *pSink, int threads);
+	~TParallelInflate();
+
+	int decompress(const unsigned char *data, size_t size);
+
+	/// <summary>
+	/// Sets the number of compressed bytes per piece.
+	/// </summary>
+	void setChunkSize(size_t chunkSize)
+	{
+		this->chunkSize = chunkSize;
+	}
+
+	/// <summary>
+	/// Number of pieces whose speculative decoding was used, and number that
+	/// had to be decoded again because the block start that was found for
+	/// them was not where the piece before them ended.
+	/// </summary>
+	long long getPiecesUsed() const
+	{
+		return piecesUsed;
+	}
+
+	long long getPiecesRedone() const
+	{
+		return piecesRedone;
+	}
+
+	int error;
+
+private:
+	int member(const unsigned char *data, size_t size, size_t offset, size_t *end);
+	int round(const unsigned char *deflate, size_t length, int *done);
+	void redo(struct ParallelPiece *piece);
+	void passWindow(struct ParallelPiece *piece);
+
+	static void speculate(TParallelInflate *self, int index);
+	static void resolve(struct ParallelPiece *piece);
+
+	Sink *pSink;
+	int threads;
+	size_t chunkSize;
+	struct ParallelPiece *pieces;
+
+	/* The round being decoded. */
+	const unsigned char *roundData;
+	size_t roundLength;
+	int roundPieces;
+
+	/* The member being decoded. */
+	long long position;		/* bit where the output so far ends */
+	unsigned char window[WINDOWSIZE];	/* the last WINDOWSIZE bytes of it */
+	long long total;		/* bytes of output */
+	unsigned int crc;		/* CRC-32 of the output */
+
+	long long piecesUsed, piecesRedone;
+};
+
+/* Instantiated in ParallelInflate.cpp. */
+extern template class TParallelInflate<CIO>;
+extern template class TParallelInflate<CMemorySink>;
+extern template class TParallelInflate<CFileSink>;
+extern template class TParallelInflate<CNullSink>;
+extern template class TParallelInflate<CCallbackSink>;
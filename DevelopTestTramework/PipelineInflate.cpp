@@ -0,0 +1,592 @@
+#include "stdafx.h"
+#include <string.h>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "PipelineInflate.h"
+#include "GZip.h"
+#include "Zlib.h"
+
+CChunkRing::CChunkRing(int slots, int chunkSize)
+{
+	this->slots = slots;
+	this->chunkSize = chunkSize;
+	chunks = new struct PipeChunk[slots];
+	for (int n = 0; n < slots; n++)
+	{
+		chunks[n].data = new unsigned char[chunkSize];
+		chunks[n].length = 0;
+		chunks[n].last = false;
+	}
+	written = 0;
+	read = 0;
+}
+
+CChunkRing::~CChunkRing()
+{
+	for (int n = 0; n < slots; n++)
+	{
+		delete [] chunks[n].data;
+	}
+	delete [] chunks;
+}
+
+/*
+* Wait for writeSlot() to give a slot.  Returns it, or NULL once *stopping
+* is set, which whoever sets it follows with wake().
+*
+* Notes:
+*
+* - The sleeper checks the counters with lock held and the committer takes
+*   lock after storing its counter and before notifying, so a commit cannot
+*   fall between the check and the sleep and be missed.
+*/
+struct PipeChunk *CChunkRing::waitWrite(const std::atomic<bool> *stopping)
+{
+	struct PipeChunk *chunk;
+
+	for (int spin = 0; spin < PIPESPINS; spin++)
+	{
+		if ((chunk = writeSlot()) != NULL || *stopping)
+		{
+			return chunk;
+		}
+		std::this_thread::yield();
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	while ((chunk = writeSlot()) == NULL && !*stopping)
+	{
+		changed.wait(guard);
+	}
+	return chunk;
+}
+
+/*
+* Wait for readSlot() to give a chunk, the same way.
+*/
+struct PipeChunk *CChunkRing::waitRead(const std::atomic<bool> *stopping)
+{
+	struct PipeChunk *chunk;
+
+	for (int spin = 0; spin < PIPESPINS; spin++)
+	{
+		if ((chunk = readSlot()) != NULL || *stopping)
+		{
+			return chunk;
+		}
+		std::this_thread::yield();
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	while ((chunk = readSlot()) == NULL && !*stopping)
+	{
+		changed.wait(guard);
+	}
+	return chunk;
+}
+
+/// <summary>
+/// Wakes a side sleeping in waitWrite() or waitRead() to look again.
+/// </summary>
+void CChunkRing::wake()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	changed.notify_all();
+}
+
+CPipelineInflate::CPipelineInflate()
+{
+	error = 0;
+	chunkSize = PIPECHUNKSIZE;
+	inFd = outFd = -1;
+	inRing = outRing = NULL;
+	stopping = false;
+	readError = writeError = 0;
+	bytesWritten = 0;
+
+	pSink = new CNullSink();
+	pLZ = new TLZ<CNullSink>();
+	pHuffman = new THuffman<CNullSink>(pLZ, pSink);
+	format = FORMATRAW;
+	streams = 0;
+	inputEnded = false;
+	pending = NULL;
+	pendingLength = pendingCapacity = 0;
+	outChunk = NULL;
+}
+
+CPipelineInflate::~CPipelineInflate()
+{
+	delete pHuffman;
+	delete pLZ;
+	delete pSink;
+	delete [] pending;
+}
+
+/*
+* Decompress the file at inPath to a new file at outPath.  Returns 0 or an
+* error, which is also left in error.
+*/
+int CPipelineInflate::decompress(const char *inPath, const char *outPath)
+{
+#ifdef _WIN32
+	int in = _open(inPath, _O_RDONLY | _O_BINARY);
+	int out = in < 0 ? -1 : _open(outPath, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int in = ::open(inPath, O_RDONLY);
+	int out = in < 0 ? -1 : ::open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+
+	if (in < 0 || out < 0)
+	{
+		error = in < 0 ? PIPEREADFAILED : PIPEWRITEFAILED;
+	}
+	else
+	{
+		decompress(in, out);
+	}
+
+#ifdef _WIN32
+	if (in >= 0)
+	{
+		_close(in);
+	}
+	if (out >= 0 && _close(out) != 0 && error == 0)
+	{
+		error = PIPEWRITEFAILED;
+	}
+#else
+	if (in >= 0)
+	{
+		::close(in);
+	}
+	if (out >= 0 && ::close(out) != 0 && error == 0)
+	{
+		error = PIPEWRITEFAILED;
+	}
+#endif
+
+	return error;
+}
+
+/*
+* Decompress everything that can be read from inFd and write it to outFd.
+* The reader and writer stages run on threads of their own while this
+* thread decodes.  Returns 0 or an error, which is also left in error.
+*
+* Notes:
+*
+* - When the decoder is done, the writer is left to write out the last
+*   chunk before anything is stopped.  Only then is the reader told to stop,
+*   since it may still be waiting to hand over input after the end of the
+*   stream that nothing will take.
+*/
+int CPipelineInflate::decompress(int inFd, int outFd)
+{
+	this->inFd = inFd;
+	this->outFd = outFd;
+	stopping = false;
+	readError = writeError = 0;
+	bytesWritten = 0;
+	streams = 0;
+	inputEnded = false;
+	pendingLength = 0;
+	outChunk = NULL;
+
+	inRing = new CChunkRing(PIPESLOTS, chunkSize);
+	outRing = new CChunkRing(PIPESLOTS, chunkSize);
+	std::thread reader(readStage, this);
+	std::thread writer(writeStage, this);
+
+	error = decode();
+	if (error == 0)
+	{
+		/* an empty last chunk if the last one was full */
+		error = output(NULL, 0);
+	}
+	if (error == 0)
+	{
+		outChunk->last = true;
+		outRing->commitWrite();
+	}
+	else
+	{
+		stop();
+	}
+	writer.join();
+	stop();
+	reader.join();
+
+	if (error == 0 && writeError != 0)
+	{
+		error = writeError;
+	}
+
+	delete inRing;
+	delete outRing;
+	inRing = outRing = NULL;
+
+	return error;
+}
+
+/*
+* The decoder stage: take the input chunks, decode each stream in them and
+* pass the output on.  Returns 0 or an error.
+*
+* Notes:
+*
+* - Between streams the input goes into pending until there is enough of it
+*   to parse the next header.  Whatever the decoder was fed after the end of
+*   a stream goes back into pending for the next one.
+*
+* - As with TGZip, a gzip file is as many members as follow each other,
+*   and anything after the last one that does not start like a member is
+*   ignored.  A zlib or raw stream is the whole file.
+*/
+int CPipelineInflate::decode(void)
+{
+	bool inStream = false;
+
+	for (;;)
+	{
+		struct PipeChunk *chunk;
+
+		if (!inStream)
+		{
+			if (streams > 0 && format != FORMATGZIP)
+			{
+				break;
+			}
+			if (pendingLength >= 2 || inputEnded)
+			{
+				if (streams > 0 && (pendingLength < 2 || pending[0] != GZIPID1 || pending[1] != GZIPID2))
+				{
+					break;              /* the end, or bytes after the last member */
+				}
+
+				int ret = startStream();
+				if (ret == 0)
+				{
+					inStream = true;
+					continue;
+				}
+				if (ret != NEEDINPUT)
+				{
+					return ret;
+				}
+				if (inputEnded)
+				{
+					return DATAEND;     /* cut off in the header */
+				}
+			}
+
+			chunk = nextInput();
+			if (chunk == NULL)
+			{
+				return readError != 0 ? readError : PIPEWRITEFAILED;
+			}
+			inputEnded = chunk->last;
+			append(chunk->data, chunk->length);
+			inRing->commitRead();
+			continue;
+		}
+
+		/* Pass on everything the input so far decodes to. */
+		const unsigned char *span;
+		int count;
+		while ((count = pHuffman->next(&span)) > 0)
+		{
+			int ret = output(span, count);
+			if (ret != 0)
+			{
+				return ret;
+			}
+		}
+		if (pHuffman->error != 0)
+		{
+			return pHuffman->error;
+		}
+
+		if (pHuffman->finished())
+		{
+			const unsigned char *rest;
+			size_t restLength = pHuffman->unusedInput(&rest);
+			pendingLength = 0;
+			append(rest, restLength);
+			inStream = false;
+			continue;
+		}
+
+		if (inputEnded)
+		{
+			return DATAEND;
+		}
+
+		chunk = nextInput();
+		if (chunk == NULL)
+		{
+			return readError != 0 ? readError : PIPEWRITEFAILED;
+		}
+		inputEnded = chunk->last;
+		if (chunk->length > 0)
+		{
+			pHuffman->feed(chunk->data, chunk->length);
+		}
+		if (inputEnded)
+		{
+			pHuffman->endInput();
+		}
+		inRing->commitRead();
+	}
+
+	return streams > 0 ? 0 : DATAEND;
+}
+
+/*
+* Parse the header of the next stream from pending and start the decoder on
+* the data after it.  Returns 0, NEEDINPUT if the header is not all there
+* yet, or the error in the header.  A zlib stream that needs a dictionary is
+* NEEDDICTIONARY, since there is no way to give one here.
+*/
+int CPipelineInflate::startStream(void)
+{
+	size_t offset = 0;
+	int ret = 0;
+
+	if (streams == 0)
+	{
+		format = CZlib::detect(pending, pendingLength);
+	}
+
+	if (format == FORMATGZIP)
+	{
+		struct GZipMember member;
+		ret = TGZip<CNullSink>::parseHeader(pending, pendingLength, 0, &member);
+		if (ret == 0)
+		{
+			offset = member.dataOffset;
+		}
+	}
+	else if (format == FORMATZLIB)
+	{
+		struct ZlibHeader header;
+		ret = TZlib<CNullSink>::parseHeader(pending, pendingLength, &header);
+		if (ret == 0)
+		{
+			ret = header.hasDictionary ? NEEDDICTIONARY : 0;
+			offset = header.dataOffset;
+		}
+	}
+
+	if (ret == DATAEND)
+	{
+		return NEEDINPUT;
+	}
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	pHuffman->setFormat(format);
+	pHuffman->beginStream();
+	if (pendingLength > offset)
+	{
+		pHuffman->feed(&pending[offset], (int)(pendingLength - offset));
+	}
+	if (inputEnded)
+	{
+		pHuffman->endInput();
+	}
+	pendingLength = 0;
+	streams++;
+
+	return 0;
+}
+
+/*
+* Copy decoded bytes into output chunks, passing each one on to the writer
+* as it fills up.  A length of 0 just makes sure there is a chunk to end the
+* output with.  Returns 0, or PIPEWRITEFAILED if the writer has stopped.
+*/
+int CPipelineInflate::output(const unsigned char *data, int length)
+{
+	do
+	{
+		if (outChunk == NULL)
+		{
+			outChunk = outRing->waitWrite(&stopping);
+			if (outChunk == NULL)
+			{
+				return writeError != 0 ? writeError : PIPEWRITEFAILED;
+			}
+			outChunk->length = 0;
+			outChunk->last = false;
+		}
+		if (length == 0)
+		{
+			break;
+		}
+
+		int count = chunkSize - outChunk->length;
+		if (count > length)
+		{
+			count = length;
+		}
+		memcpy(&outChunk->data[outChunk->length], data, count);
+		outChunk->length += count;
+		data += count;
+		length -= count;
+
+		if (outChunk->length == chunkSize)
+		{
+			outRing->commitWrite();
+			outChunk = NULL;
+		}
+	}
+	while (length > 0);
+
+	return 0;
+}
+
+/*
+* Wait for the next input chunk.  Returns NULL if another stage failed
+* first.  The caller hands the slot back with commitRead().
+*/
+struct PipeChunk *CPipelineInflate::nextInput(void)
+{
+	return inRing->waitRead(&stopping);
+}
+
+/*
+* Tell every stage to give up, waking any that are asleep on a ring.
+*/
+void CPipelineInflate::stop(void)
+{
+	stopping = true;
+	inRing->wake();
+	outRing->wake();
+}
+
+/*
+* Add length bytes to pending, growing it to at least double when needed.
+* Returns 0.
+*/
+int CPipelineInflate::append(const unsigned char *data, size_t length)
+{
+	if (pendingLength + length > pendingCapacity)
+	{
+		size_t capacity = pendingCapacity == 0 ? 4096 : pendingCapacity * 2;
+		while (capacity < pendingLength + length)
+		{
+			capacity *= 2;
+		}
+		unsigned char *grown = new unsigned char[capacity];
+		if (pendingLength > 0)
+		{
+			memcpy(grown, pending, pendingLength);
+		}
+		delete [] pending;
+		pending = grown;
+		pendingCapacity = capacity;
+	}
+
+	if (length > 0)
+	{
+		memcpy(&pending[pendingLength], data, length);
+		pendingLength += length;
+	}
+	return 0;
+}
+
+/*
+* The reader stage: fill input chunks from inFd until the end of the file.
+* Every chunk but the last is full.
+*/
+void CPipelineInflate::readStage(CPipelineInflate *self)
+{
+	for (;;)
+	{
+		struct PipeChunk *chunk = self->inRing->waitWrite(&self->stopping);
+		if (chunk == NULL)
+		{
+			return;
+		}
+
+		int length = 0;
+		bool end = false;
+		while (length < self->chunkSize)
+		{
+#ifdef _WIN32
+			int got = _read(self->inFd, &chunk->data[length], self->chunkSize - length);
+#else
+			int got = (int)::read(self->inFd, &chunk->data[length], self->chunkSize - length);
+#endif
+			if (got < 0)
+			{
+				self->readError = PIPEREADFAILED;
+				self->stop();
+				return;
+			}
+			if (got == 0)
+			{
+				end = true;
+				break;
+			}
+			length += got;
+		}
+
+		chunk->length = length;
+		chunk->last = end;
+		self->inRing->commitWrite();
+		if (end)
+		{
+			return;
+		}
+	}
+}
+
+/*
+* The writer stage: write out output chunks until the last one.
+*/
+void CPipelineInflate::writeStage(CPipelineInflate *self)
+{
+	for (;;)
+	{
+		struct PipeChunk *chunk = self->outRing->waitRead(&self->stopping);
+		if (chunk == NULL)
+		{
+			return;
+		}
+
+		int done = 0;
+		while (done < chunk->length)
+		{
+#ifdef _WIN32
+			int put = _write(self->outFd, &chunk->data[done], chunk->length - done);
+#else
+			int put = (int)::write(self->outFd, &chunk->data[done], chunk->length - done);
+#endif
+			if (put <= 0)
+			{
+				self->writeError = PIPEWRITEFAILED;
+				self->stop();
+				return;
+			}
+			done += put;
+		}
+		self->bytesWritten += chunk->length;
+
+		bool last = chunk->last;
+		self->outRing->commitRead();
+		if (last)
+		{
+			return;
+		}
+	}
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "Huffman.h"
+
+/* Bytes in each chunk that goes between the stages. */
+#define PIPECHUNKSIZE (1 << 20)
+
+/* Chunks in each ring, which bounds the memory a pipeline uses. */
+#define PIPESLOTS 4
+
+/* Times a stage looks again for a chunk or a free slot before it sleeps. */
+#define PIPESPINS 64
+
+/* Errors */
+#define PIPEREADFAILED -27		/* the input file could not be opened or read */
+#define PIPEWRITEFAILED -28		/* the output file could not be opened or written */
+
+/*
+	A chunk of input or output on its way from one stage to the next.
+*/
+struct PipeChunk
+{
+	unsigned char *data;
+	int length;
+	bool last;					/* nothing follows this chunk */
+};
+
+/*
+	A ring of fixed-size chunks between exactly one producer thread and one
+	consumer thread. Handing over a chunk takes no lock: the producer fills
+	the slot writeSlot() gives it and publishes it with commitWrite(), the
+	consumer takes it from readSlot() and hands the slot back with
+	commitRead(). Each counter is only stored by its own side, with release
+	order, so the other side sees the chunk before it sees the slot change
+	hands.
+
+	A side that finds the ring full or empty waits in waitWrite() or
+	waitRead(), which look again a few times and then sleep until the other
+	side commits, so a stage that is waiting on a slower one does not keep
+	a core busy.
+*/
+class CChunkRing
+{
+public:
+	CChunkRing(int slots, int chunkSize);
+	~CChunkRing();
+
+	/// <summary>
+	/// The slot the producer fills next, or NULL if the ring is full.
+	/// </summary>
+	struct PipeChunk *writeSlot()
+	{
+		size_t at = written.load(std::memory_order_relaxed);
+		if (at - read.load(std::memory_order_acquire) == (size_t)slots)
+		{
+			return NULL;
+		}
+		return &chunks[at % slots];
+	}
+
+	/// <summary>
+	/// Publishes the slot from writeSlot() to the consumer.
+	/// </summary>
+	void commitWrite()
+	{
+		written.store(written.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		wake();
+	}
+
+	/// <summary>
+	/// The chunk the consumer takes next, or NULL if the ring is empty.
+	/// </summary>
+	struct PipeChunk *readSlot()
+	{
+		size_t at = read.load(std::memory_order_relaxed);
+		if (written.load(std::memory_order_acquire) == at)
+		{
+			return NULL;
+		}
+		return &chunks[at % slots];
+	}
+
+	/// <summary>
+	/// Gives the slot from readSlot() back to the producer.
+	/// </summary>
+	void commitRead()
+	{
+		read.store(read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		wake();
+	}
+
+	struct PipeChunk *waitWrite(const std::atomic<bool> *stopping);
+	struct PipeChunk *waitRead(const std::atomic<bool> *stopping);
+	void wake();
+
+	/// <summary>
+	/// Bytes in each chunk.
+	/// </summary>
+	int getChunkSize() const
+	{
+		return chunkSize;
+	}
+
+private:
+	struct PipeChunk *chunks;
+	int slots;
+	int chunkSize;
+	std::atomic<size_t> written;	/* chunks published, stored by the producer */
+	unsigned char padding[64];		/* keeps the two counters on separate cache lines */
+	std::atomic<size_t> read;		/* chunks taken, stored by the consumer */
+	std::mutex lock;				/* only for sleeping on changed */
+	std::condition_variable changed;	/* a commit or wake() happened */
+};
+
+/*
+	Decompresses a file to a file in three stages that run at the same
+	time: a reader thread reads the input in chunks, the calling thread
+	decodes them, and a writer thread writes out the output chunks the
+	decoder fills. The stages pass chunks through two CChunkRings, so the
+	disk reads and writes overlap the decoding, and the wall time tends
+	towards the slowest stage rather than the sum of them.
+
+	The input can be a gzip file, which may have several members, a zlib
+	stream without a preset dictionary, or raw deflate data (see
+	TZlib::detect()). The decoder is fed each input chunk as it arrives and
+	the output is taken from its window with next(), so neither the input
+	nor the output is ever held whole in memory.
+*/
+class CPipelineInflate
+{
+public:
+	CPipelineInflate();
+	~CPipelineInflate();
+
+	int decompress(const char *inPath, const char *outPath);
+	int decompress(int inFd, int outFd);
+
+	/// <summary>
+	/// Sets the size of the chunks, from the next decompress() on.
+	/// </summary>
+	void setChunkSize(int chunkSize)
+	{
+		this->chunkSize = chunkSize > 0 ? chunkSize : PIPECHUNKSIZE;
+	}
+
+	/// <summary>
+	/// Bytes of output written by the last decompress().
+	/// </summary>
+	long long getBytesWritten() const
+	{
+		return bytesWritten;
+	}
+
+	int error;
+
+private:
+	int decode(void);
+	int startStream(void);
+	int output(const unsigned char *data, int length);
+	struct PipeChunk *nextInput(void);
+	int append(const unsigned char *data, size_t length);
+	void stop(void);
+
+	static void readStage(CPipelineInflate *self);
+	static void writeStage(CPipelineInflate *self);
+
+	int chunkSize;
+	int inFd, outFd;
+	CChunkRing *inRing, *outRing;
+	std::atomic<bool> stopping;		/* a stage failed, so the others give up */
+	int readError, writeError;
+	long long bytesWritten;
+
+	/* The decoder stage. */
+	TLZ<CNullSink> *pLZ;
+	CNullSink *pSink;
+	THuffman<CNullSink> *pHuffman;
+	int format;						/* of the input, once known */
+	int streams;					/* streams (gzip members) started */
+	bool inputEnded;				/* the last input chunk has been taken */
+	unsigned char *pending;			/* input not given to the decoder yet */
+	size_t pendingLength, pendingCapacity;
+	struct PipeChunk *outChunk;		/* the output chunk being filled */
+};
@@ -0,0 +1,498 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include "SeekIndex.h"
+#include "GZip.h"
+#include "Crc32.h"
+#include "Deflate.h"
+
+CSeekIndex::CSeekIndex()
+{
+	checkpoints = NULL;
+	checkpointCount = checkpointCapacity = 0;
+	windows = NULL;
+	windowsLength = windowsCapacity = 0;
+	length = 0;
+	span = SEEKSPAN;
+	buildData = NULL;
+	memberBit = memberOutput = lastOutput = 0;
+}
+
+CSeekIndex::~CSeekIndex()
+{
+	clear();
+}
+
+/// <summary>
+/// Forgets all the checkpoints.
+/// </summary>
+void CSeekIndex::clear(void)
+{
+	delete [] checkpoints;
+	delete [] windows;
+	checkpoints = NULL;
+	checkpointCount = checkpointCapacity = 0;
+	windows = NULL;
+	windowsLength = windowsCapacity = 0;
+	length = 0;
+}
+
+/*
+* Decode the whole gzip file in data and record a checkpoint at the start of
+* every member and then at the first block header after each span bytes of
+* output.  Returns 0 or the error that stopped the decoding.
+*
+* Notes:
+*
+* - Checkpoints can only be at block headers, so they are span bytes apart
+*   or a little more, up to the output of one block.  zlib makes blocks of
+*   some tens of kilobytes, but a block can be as long as the encoder likes.
+*
+* - Members are walked as TGZip::decompress() does, including ignoring the
+*   bytes after the last one, but each one is decoded here so that its
+*   position in the file is known to onBlock().
+*/
+int CSeekIndex::build(const unsigned char *data, size_t size, long long span)
+{
+	TLZ<CNullSink> lz;
+	CNullSink sink;
+	lz.setIO(&sink);
+	THuffman<CNullSink> huffman(&lz, &sink);
+	TGZip<CNullSink> gzip(&huffman);
+	struct GZipMember member;
+	size_t offset = 0;
+	int error;
+
+	clear();
+	this->span = span;
+	buildData = data;
+	huffman.setBlockCallback(onBlock, this);
+
+	while (offset < size)
+	{
+		if (offset > 0 && (size - offset < 2 || data[offset] != GZIPID1 || data[offset + 1] != GZIPID2))
+		{
+			break;
+		}
+
+		error = TGZip<CNullSink>::parseHeader(data, size, offset, &member);
+		if (error == 0)
+		{
+			memberBit = (long long)member.dataOffset * 8;
+			memberOutput = length;
+			member.outputOffset = length;
+			error = gzip.decompressMember(data, size, &member);
+		}
+		if (error != 0)
+		{
+			clear();
+			return error;
+		}
+
+		length += member.outputLength;
+		offset = member.endOffset;
+	}
+
+	buildData = NULL;
+	return 0;
+}
+
+/*
+* Called by the decoder in build() before each block header.  bit and output
+* count from the start of the member.
+*/
+void CSeekIndex::onBlock(void *context, long long bit, long long output, const unsigned char *history, int historyLength)
+{
+	CSeekIndex *index = (CSeekIndex *)context;
+
+	bit += index->memberBit;
+	output += index->memberOutput;
+	if (output == index->memberOutput && historyLength == 0 && bit == index->memberBit)
+	{
+		/* The member starts with an empty window. */
+		index->addCheckpoint(bit, output, index->buildData[bit >> 3], history, 0);
+	}
+	else if (output - index->lastOutput >= index->span)
+	{
+		index->addCheckpoint(bit, output, index->buildData[bit >> 3], history, historyLength);
+	}
+}
+
+/// <summary>
+/// Adds a checkpoint and a copy of its window, growing the lists as needed.
+/// </summary>
+void CSeekIndex::addCheckpoint(long long bit, long long output, unsigned char byte, const unsigned char *window, int windowLength)
+{
+	if (checkpointCount == checkpointCapacity)
+	{
+		int capacity = checkpointCapacity == 0 ? 64 : checkpointCapacity * 2;
+		struct SeekCheckpoint *grown = new struct SeekCheckpoint[capacity];
+		if (checkpointCount > 0)
+		{
+			memcpy(grown, checkpoints, checkpointCount * sizeof(struct SeekCheckpoint));
+		}
+		delete [] checkpoints;
+		checkpoints = grown;
+		checkpointCapacity = capacity;
+	}
+
+	if (windowsLength + windowLength > windowsCapacity)
+	{
+		size_t capacity = windowsCapacity == 0 ? WINDOWSIZE * 16 : windowsCapacity * 2;
+		while (capacity < windowsLength + windowLength)
+		{
+			capacity *= 2;
+		}
+		unsigned char *grown = new unsigned char[capacity];
+		if (windowsLength > 0)
+		{
+			memcpy(grown, windows, windowsLength);
+		}
+		delete [] windows;
+		windows = grown;
+		windowsCapacity = capacity;
+	}
+
+	struct SeekCheckpoint *checkpoint = &checkpoints[checkpointCount++];
+	checkpoint->output = output;
+	checkpoint->bit = bit;
+	checkpoint->byte = byte;
+	checkpoint->windowLength = windowLength;
+	checkpoint->windowOffset = windowsLength;
+	if (windowLength > 0)
+	{
+		memcpy(&windows[windowsLength], window, windowLength);
+	}
+	windowsLength += windowLength;
+	lastOutput = output;
+}
+
+/// <summary>
+/// Index of the last checkpoint at or before offset in the output.
+/// </summary>
+int CSeekIndex::find(long long offset) const
+{
+	int low = 0, high = checkpointCount - 1;
+
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+		if (checkpoints[middle].output <= offset)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return low;
+}
+
+/*
+* Read up to outLength bytes of the output of the gzip file in data, starting
+* at offset, into out.  Returns the number of bytes read, which is less than
+* outLength only at the end of the output, or a negative error.  The file has
+* to be the one the index was built for; BADINDEX is returned if a checkpoint
+* does not match it.
+*
+* Notes:
+*
+* - Decoding starts at the nearest checkpoint at or before offset, with its
+*   window as the dictionary, and the output up to offset is decoded and
+*   thrown away.
+*
+* - A range can run on into the next member.  That member starts at its own
+*   checkpoint, which has an empty window, since the members are separate
+*   streams.  The trailers are not checked; build() already did.
+*/
+int CSeekIndex::read(const unsigned char *data, size_t size, long long offset, unsigned char *out, int outLength)
+{
+	TLZ<CNullSink> lz;
+	CNullSink sink;
+	lz.setIO(&sink);
+	THuffman<CNullSink> huffman(&lz, &sink);
+	unsigned char skip[WINDOWSIZE];
+	int done = 0;
+
+	if (checkpointCount == 0 || offset < 0 || offset >= length)
+	{
+		return 0;
+	}
+
+	int index = find(offset);
+	long long position = checkpoints[index].output;
+	while (done < outLength)
+	{
+		const struct SeekCheckpoint *checkpoint = &checkpoints[index];
+		if ((size_t)(checkpoint->bit >> 3) >= size || data[checkpoint->bit >> 3] != checkpoint->byte)
+		{
+			return BADINDEX;
+		}
+
+		lz.setDictionary(&windows[checkpoint->windowOffset], checkpoint->windowLength);
+		huffman.beginStream(data, size, checkpoint->bit);
+
+		while (position < offset && huffman.error == 0)
+		{
+			long long wanted = offset - position;
+			int count = huffman.drain(skip, wanted < (long long)sizeof(skip) ? (int)wanted : (int)sizeof(skip));
+			if (count == 0)
+			{
+				break;
+			}
+			position += count;
+		}
+
+		while (done < outLength && huffman.error == 0)
+		{
+			int count = huffman.drain(&out[done], outLength - done);
+			if (count == 0)
+			{
+				break;
+			}
+			done += count;
+			position += count;
+		}
+
+		if (huffman.error < 0)
+		{
+			return huffman.error;
+		}
+		if (done == outLength)
+		{
+			break;
+		}
+		if (!huffman.finished())
+		{
+			/* The file ends before the index says it does. */
+			return BADINDEX;
+		}
+
+		/* Go on with the next member, if there is one. */
+		do
+		{
+			index++;
+		}
+		while (index < checkpointCount && checkpoints[index].windowLength != 0);
+		if (index == checkpointCount || checkpoints[index].output != position)
+		{
+			break;
+		}
+	}
+
+	return done;
+}
+
+/* Little-endian integers of the sidecar file. */
+static void putNumber(unsigned char *to, unsigned long long value, int bytes)
+{
+	for (int n = 0; n < bytes; n++)
+	{
+		to[n] = (unsigned char)(value >> (n * 8));
+	}
+}
+
+static unsigned long long getNumber(const unsigned char *from, int bytes)
+{
+	unsigned long long value = 0;
+
+	for (int n = bytes - 1; n >= 0; n--)
+	{
+		value = (value << 8) | from[n];
+	}
+
+	return value;
+}
+
+/* Where collect() puts what it is given. */
+struct SeekBuffer
+{
+	unsigned char *data;
+	int length;
+	int capacity;
+};
+
+/*
+* CCallbackSink callback that appends to a SeekBuffer.  Returns -1 if it
+* would not fit.
+*/
+static int collect(void *context, const unsigned char *data, int size)
+{
+	struct SeekBuffer *buffer = (struct SeekBuffer *)context;
+
+	if (size > buffer->capacity - buffer->length)
+	{
+		return -1;
+	}
+	memcpy(&buffer->data[buffer->length], data, size);
+	buffer->length += size;
+
+	return size;
+}
+
+/// <summary>
+/// A CRC-32 of the start of the gzip file, to tell whether a sidecar file
+/// belongs to it.
+/// </summary>
+unsigned int CSeekIndex::identify(const unsigned char *data, size_t size)
+{
+	return CCrc32::update(0, data, size < SEEKIDBYTES ? size : SEEKIDBYTES);
+}
+
+/*
+* Write the index to a sidecar file.  data and size are the gzip file it was
+* built for.  Returns 0 or INDEXFILE.
+*
+* Format notes:
+*
+* - A header of SEEKHEADERSIZE bytes: the magic number, the version, the
+*   number of checkpoints and the CRC-32 of the first SEEKIDBYTES of the gzip
+*   file, four bytes each, then the size of the gzip file, the length of its
+*   output and the span, eight bytes each.  All numbers are little-endian.
+*
+* - Then each checkpoint: its output offset and its bit offset, eight bytes
+*   each, the byte the block header starts in, the window length in two
+*   bytes, the length of the deflated window in four, and the window as raw
+*   deflate data at SEEKLEVEL.
+*/
+int CSeekIndex::save(const char *filePath, const unsigned char *data, size_t size) const
+{
+	unsigned char header[SEEKHEADERSIZE];
+	unsigned char record[SEEKRECORDSIZE];
+	FILE *fp = fopen(filePath, "wb");
+	int error = 0;
+
+	if (fp == NULL)
+	{
+		return INDEXFILE;
+	}
+
+	/* Stored blocks add 5 bytes in 64K, so a window always fits. */
+	struct SeekBuffer compressed;
+	compressed.capacity = WINDOWSIZE + WINDOWSIZE / 8 + 1024;
+	compressed.data = new unsigned char[compressed.capacity];
+	CCallbackSink sink(collect, &compressed);
+	TDeflate<CCallbackSink> deflate(&sink, SEEKLEVEL);
+
+	putNumber(&header[0], SEEKMAGIC, 4);
+	putNumber(&header[4], SEEKVERSION, 4);
+	putNumber(&header[8], checkpointCount, 4);
+	putNumber(&header[12], identify(data, size), 4);
+	putNumber(&header[16], size, 8);
+	putNumber(&header[24], length, 8);
+	putNumber(&header[32], span, 8);
+	if (fwrite(header, 1, sizeof(header), fp) != sizeof(header))
+	{
+		error = INDEXFILE;
+	}
+
+	for (int n = 0; n < checkpointCount && error == 0; n++)
+	{
+		const struct SeekCheckpoint *checkpoint = &checkpoints[n];
+		compressed.length = 0;
+		deflate.reset();
+		if (deflate.compress(&windows[checkpoint->windowOffset], checkpoint->windowLength, DEFLATEFINISH) != 0)
+		{
+			error = INDEXFILE;
+			break;
+		}
+
+		putNumber(&record[0], checkpoint->output, 8);
+		putNumber(&record[8], checkpoint->bit, 8);
+		record[16] = checkpoint->byte;
+		putNumber(&record[17], checkpoint->windowLength, 2);
+		putNumber(&record[19], compressed.length, 4);
+		if (fwrite(record, 1, sizeof(record), fp) != sizeof(record) ||
+			fwrite(compressed.data, 1, compressed.length, fp) != (size_t)compressed.length)
+		{
+			error = INDEXFILE;
+		}
+	}
+	delete [] compressed.data;
+
+	if (fclose(fp) != 0)
+	{
+		error = INDEXFILE;
+	}
+
+	return error;
+}
+
+/*
+* Read an index written by save().  data and size are the gzip file it is
+* meant for.  Returns 0, INDEXFILE if the file cannot be read or is not an
+* index, or BADINDEX if it was built for a different gzip file.  The index is
+* left empty on an error.  An index of an older version is INDEXFILE, so
+* the caller builds it again.
+*/
+int CSeekIndex::load(const char *filePath, const unsigned char *data, size_t size)
+{
+	unsigned char header[SEEKHEADERSIZE];
+	unsigned char record[SEEKRECORDSIZE];
+	unsigned char window[WINDOWSIZE];
+	FILE *fp = fopen(filePath, "rb");
+	int error = 0;
+
+	clear();
+	if (fp == NULL)
+	{
+		return INDEXFILE;
+	}
+
+	int capacity = WINDOWSIZE + WINDOWSIZE / 8 + 1024;
+	unsigned char *compressed = new unsigned char[capacity];
+	struct SeekBuffer inflated;
+	inflated.data = window;
+	inflated.capacity = WINDOWSIZE;
+	TLZ<CCallbackSink> lz;
+	CCallbackSink sink(collect, &inflated);
+	THuffman<CCallbackSink> huff(&lz, &sink);
+	huff.setFormat(FORMATRAW);
+
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+		getNumber(&header[0], 4) != SEEKMAGIC || getNumber(&header[4], 4) != SEEKVERSION)
+	{
+		error = INDEXFILE;
+	}
+	else if (getNumber(&header[12], 4) != identify(data, size) || getNumber(&header[16], 8) != size)
+	{
+		error = BADINDEX;
+	}
+
+	int count = error == 0 ? (int)getNumber(&header[8], 4) : 0;
+	for (int n = 0; n < count && error == 0; n++)
+	{
+		int windowLength, compressedLength;
+		if (fread(record, 1, sizeof(record), fp) != sizeof(record) ||
+			(windowLength = (int)getNumber(&record[17], 2)) < 0 || windowLength > WINDOWSIZE ||
+			(compressedLength = (int)getNumber(&record[19], 4)) <= 0 || compressedLength > capacity ||
+			fread(compressed, 1, compressedLength, fp) != (size_t)compressedLength)
+		{
+			error = INDEXFILE;
+			break;
+		}
+
+		inflated.length = 0;
+		huff.decompress(compressed, compressedLength);
+		if (huff.error != 0 || inflated.length != windowLength)
+		{
+			error = INDEXFILE;
+			break;
+		}
+		addCheckpoint((long long)getNumber(&record[8], 8), (long long)getNumber(&record[0], 8), record[16], window, windowLength);
+	}
+	fclose(fp);
+	delete [] compressed;
+
+	if (error != 0)
+	{
+		clear();
+		return error;
+	}
+
+	length = (long long)getNumber(&header[24], 8);
+	span = (long long)getNumber(&header[32], 8);
+	return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Huffman.h"
+#include "structs.h"
+
+/* Default bytes of output between checkpoints. */
+#define SEEKSPAN (1 << 20)
+
+/* Sidecar file identification. */
+#define SEEKMAGIC 0x58495a47	/* "GZIX" */
+#define SEEKVERSION 2
+#define SEEKIDBYTES 65536		/* bytes at the start of the file whose CRC identifies it */
+#define SEEKHEADERSIZE 40
+#define SEEKRECORDSIZE 23		/* per checkpoint, before its window */
+#define SEEKLEVEL 6				/* compression level of the windows */
+
+/* Errors */
+#define BADINDEX -20			/* the index does not belong to the file */
+#define INDEXFILE -21			/* the sidecar file could not be read or written */
+
+/*
+	Random access into a gzip file. Deflate can only be decoded from the
+	start, but a block can be decoded from its header on if the 32K of output
+	before it are known, since that is as far as a back-reference can reach.
+	So one pass over the file records a checkpoint every span bytes of
+	output: where a block header is in the input, and the output window at
+	that point. Reading any range then decodes from the nearest checkpoint
+	before it, which is at most about span bytes of work, instead of from
+	the start of the file. This is zlib's zran.c.
+
+	The checkpoints are saved to and loaded from a sidecar file, so the pass
+	over the file only has to be made once. Each one stores only the window
+	it actually has, which is less than 32K near the start of a member, and
+	stores it deflated, as zran.c does, which keeps the sidecar to a few
+	kilobytes per checkpoint.
+*/
+class CSeekIndex
+{
+public:
+	CSeekIndex();
+	~CSeekIndex();
+
+	int build(const unsigned char *data, size_t size, long long span);
+	int read(const unsigned char *data, size_t size, long long offset, unsigned char *out, int outLength);
+
+	int save(const char *filePath, const unsigned char *data, size_t size) const;
+	int load(const char *filePath, const unsigned char *data, size_t size);
+
+	/// <summary>
+	/// Number of checkpoints in the index.
+	/// </summary>
+	int getCheckpointCount() const
+	{
+		return checkpointCount;
+	}
+
+	/// <summary>
+	/// Bytes of output of the whole file.
+	/// </summary>
+	long long getLength() const
+	{
+		return length;
+	}
+
+private:
+	static void onBlock(void *context, long long bit, long long output, const unsigned char *history, int historyLength);
+	static unsigned int identify(const unsigned char *data, size_t size);
+
+	void clear(void);
+	void addCheckpoint(long long bit, long long output, unsigned char byte, const unsigned char *window, int windowLength);
+	int find(long long offset) const;
+
+	struct SeekCheckpoint *checkpoints;
+	int checkpointCount, checkpointCapacity;
+	unsigned char *windows;		/* the windows of all the checkpoints, one after the other */
+	size_t windowsLength, windowsCapacity;
+	long long length;
+	long long span;
+
+	/* Set while build() decodes a member. */
+	const unsigned char *buildData;
+	long long memberBit;		/* first bit of the member's deflate data */
+	long long memberOutput;		/* output before the member */
+	long long lastOutput;		/* output at the last checkpoint */
+};
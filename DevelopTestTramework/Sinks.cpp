@@ -0,0 +1,35 @@
+#include "stdafx.h"
+#include "Sinks.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+* Write all of data to the file descriptor, retrying after short writes.
+* Returns size, or SINKWRITEFAILED.
+*/
+int CFileSink::output(unsigned char *data, int size)
+{
+	int done = 0;
+
+	while (done < size)
+	{
+#ifdef _WIN32
+		int written = _write(fd, &data[done], size - done);
+#else
+		int written = (int)write(fd, &data[done], size - done);
+#endif
+		if (written <= 0)
+		{
+			error = SINKWRITEFAILED;
+			return SINKWRITEFAILED;
+		}
+		done += written;
+	}
+
+	bytesWritten += size;
+	return size;
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <memory.h>
+
+/*
+	Output policies for TLZ and THuffman. Each one is a class with
+
+		int output(unsigned char *data, int size);
+		int flush(void);
+
+	like CIO, which is the policy that is configured at run time. The window
+	only calls output() when it flushes, with up to a window's worth of data
+	at a time, and since the policy is a template argument the call is bound
+	at compile time and usually inlined.
+*/
+
+/* Errors */
+#define SINKFULL -1				/* CMemorySink ran out of room */
+#define SINKWRITEFAILED -3		/* CFileSink could not write */
+#define SINKREFUSED -4			/* the CCallbackSink callback returned an error */
+
+/*
+	Output to a fixed block of memory supplied by the caller.
+*/
+class CMemorySink
+{
+public:
+	CMemorySink(unsigned char *pOutBuffer, long long size)
+	{
+		this->pOutBuffer = pOutBuffer;
+		this->size = size;
+		length = 0;
+		error = 0;
+	}
+
+	int output(unsigned char *data, int size)
+	{
+		if (size > this->size - length)
+		{
+			error = SINKFULL;
+			return SINKFULL;
+		}
+
+		memcpy(&pOutBuffer[length], data, size);
+		length += size;
+		return size;
+	}
+
+	int flush(void)
+	{
+		return error;
+	}
+
+	long long getBytesWritten() const
+	{
+		return length;
+	}
+
+	int getError() const
+	{
+		return error;
+	}
+
+private:
+	unsigned char *pOutBuffer;
+	long long size;
+	long long length;
+	int error;
+};
+
+/*
+	Output to an open file descriptor. The window already collects the output
+	into large pieces, so each flush goes straight to write() with no second
+	buffer.
+*/
+class CFileSink
+{
+public:
+	CFileSink(int fd)
+	{
+		this->fd = fd;
+		bytesWritten = 0;
+		error = 0;
+	}
+
+	int output(unsigned char *data, int size);
+
+	int flush(void)
+	{
+		return error;
+	}
+
+	long long getBytesWritten() const
+	{
+		return bytesWritten;
+	}
+
+	int getError() const
+	{
+		return error;
+	}
+
+private:
+	int fd;
+	long long bytesWritten;
+	int error;
+};
+
+/*
+	Output that is thrown away and only counted, for measuring the decoder
+	on its own or finding the size of the uncompressed data.
+*/
+class CNullSink
+{
+public:
+	CNullSink()
+	{
+		bytesWritten = 0;
+	}
+
+	int output(unsigned char *data, int size)
+	{
+		bytesWritten += size;
+		return size;
+	}
+
+	int flush(void)
+	{
+		return 0;
+	}
+
+	long long getBytesWritten() const
+	{
+		return bytesWritten;
+	}
+
+	int getError() const
+	{
+		return 0;
+	}
+
+private:
+	long long bytesWritten;
+};
+
+/*
+	Output passed to a function. The callback gets the context pointer, the
+	data and its size, and returns a negative value to report an error.
+*/
+typedef int (*SinkCallback)(void *context, const unsigned char *data, int size);
+
+class CCallbackSink
+{
+public:
+	CCallbackSink(SinkCallback callback, void *context)
+	{
+		this->callback = callback;
+		this->context = context;
+		bytesWritten = 0;
+		error = 0;
+	}
+
+	int output(unsigned char *data, int size)
+	{
+		if (callback(context, data, size) < 0)
+		{
+			error = SINKREFUSED;
+			return SINKREFUSED;
+		}
+
+		bytesWritten += size;
+		return size;
+	}
+
+	int flush(void)
+	{
+		return error;
+	}
+
+	long long getBytesWritten() const
+	{
+		return bytesWritten;
+	}
+
+	int getError() const
+	{
+		return error;
+	}
+
+private:
+	SinkCallback callback;
+	void *context;
+	long long bytesWritten;
+	int error;
+};
@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "Zlib.h"
+#include "GZip.h"
+#include "Adler32.h"
+
+template <class Sink>
+TZlib<Sink>::TZlib(THuffman<Sink> *pHuffman)
+{
+	this->pHuffman = pHuffman;
+	error = 0;
+	dictionary = NULL;
+	dictionaryLength = 0;
+	endOffset = 0;
+}
+
+/*
+* Decompress the zlib stream in data to the decoder's output and check its
+* trailer.  Returns 0 or an error, which is also left in error.
+*
+* Notes:
+*
+* - A dictionary is only used if the header asks for one, and then it has
+*   to be the one whose Adler-32 the header gives.  Only its last
+*   WINDOWSIZE bytes can be reached by a back-reference, so only those are
+*   given to the window.
+*
+* - The window is given the dictionary for this stream only, so the decoder
+*   can go on to decode other streams without it.
+*/
+template <class Sink>
+int TZlib<Sink>::decompress(const unsigned char *data, size_t size)
+{
+	struct ZlibHeader header;
+
+	endOffset = 0;
+	error = parseHeader(data, size, &header);
+	if (error != 0)
+	{
+		return error;
+	}
+
+	if (header.hasDictionary)
+	{
+		if (dictionary == NULL)
+		{
+			error = NEEDDICTIONARY;
+			return error;
+		}
+		if (CAdler32::update(1, dictionary, dictionaryLength) != header.dictionaryId)
+		{
+			error = DICTIONARYMISMATCH;
+			return error;
+		}
+
+		int length = dictionaryLength < WINDOWSIZE ? dictionaryLength : WINDOWSIZE;
+		pHuffman->setDictionary(&dictionary[dictionaryLength - length], length);
+	}
+
+	pHuffman->setFormat(FORMATZLIB);
+	pHuffman->decompress(&data[header.dataOffset], size - header.dataOffset);
+	pHuffman->setDictionary(NULL, 0);
+	error = pHuffman->error;
+	if (error == 0)
+	{
+		endOffset = header.dataOffset + pHuffman->inputUsed();
+	}
+
+	return error;
+}
+
+/*
+* Parse the zlib header at the start of data into header.  Returns 0,
+* DATAEND if it is cut off, NOTZLIB or BADMETHOD.
+*
+* Format notes:
+*
+* - The first byte (CMF) is the compression method in the low four bits,
+*   which is 8 for deflate, and in the high four bits CINFO, the log2 of
+*   the window size minus eight, which is at most 7 (32K).
+*
+* - The second byte (FLG) has FCHECK in the low five bits, which makes CMF
+*   and FLG, as a 16-bit number most significant byte first, a multiple of
+*   31.  Then comes FDICT, and FLEVEL in the top two bits.
+*
+* - With FDICT set, the Adler-32 of the dictionary follows, most significant
+*   byte first.
+*/
+template <class Sink>
+int TZlib<Sink>::parseHeader(const unsigned char *data, size_t size, struct ZlibHeader *header)
+{
+	if (size < 2)
+	{
+		return DATAEND;
+	}
+
+	int cmf = data[0];
+	int flg = data[1];
+	if (((cmf << 8) | flg) % 31 != 0)
+	{
+		return NOTZLIB;
+	}
+	if ((cmf & 0x0f) != ZLIBDEFLATE || (cmf >> 4) > ZLIBMAXINFO)
+	{
+		return BADMETHOD;
+	}
+
+	header->windowBits = (cmf >> 4) + 8;
+	header->level = flg >> 6;
+	header->hasDictionary = (flg & ZLIBFDICT) != 0;
+	header->dictionaryId = 0;
+	header->dataOffset = 2;
+
+	if (header->hasDictionary)
+	{
+		if (size < 6)
+		{
+			return DATAEND;
+		}
+		header->dictionaryId = ((unsigned int)data[2] << 24) | ((unsigned int)data[3] << 16) | (data[4] << 8) | data[5];
+		header->dataOffset = 6;
+	}
+
+	return 0;
+}
+
+/*
+* Work out whether data is a gzip file, a zlib stream or raw deflate data.
+* Returns FORMATGZIP, FORMATZLIB or FORMATRAW.
+*
+* Notes:
+*
+* - Raw deflate data can never start with the gzip identification bytes,
+*   since 0x1f would be a block of the reserved type 3.
+*
+* - It can start with something that passes the zlib header checks: a
+*   stored block that is not the last one, with the right bits after it.
+*   That is a 1 in 31 chance on top of the compression method for such a
+*   stream, and a raw stream that does it has to be decoded with the format
+*   set by the caller rather than detected.
+*/
+template <class Sink>
+int TZlib<Sink>::detect(const unsigned char *data, size_t size)
+{
+	struct ZlibHeader header;
+
+	if (size >= 2 && data[0] == GZIPID1 && data[1] == GZIPID2)
+	{
+		return FORMATGZIP;
+	}
+	if (parseHeader(data, size, &header) == 0)
+	{
+		return FORMATZLIB;
+	}
+
+	return FORMATRAW;
+}
+
+/* The outputs the container is built for. */
+template class TZlib<CIO>;
+template class TZlib<CMemorySink>;
+template class TZlib<CFileSink>;
+template class TZlib<CNullSink>;
+template class TZlib<CCallbackSink>;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Huffman.h"
+
+/* Compression method and largest window of a zlib stream. */
+#define ZLIBDEFLATE 8
+#define ZLIBMAXINFO 7			/* CINFO, a window of 2^(CINFO + 8) bytes */
+
+/* Header flags (FLG). */
+#define ZLIBFDICT 0x20			/* a preset dictionary id follows */
+
+/* Errors */
+#define NOTZLIB -24
+#define NEEDDICTIONARY -25		/* the stream was made with a dictionary and none was set */
+#define DICTIONARYMISMATCH -26	/* the dictionary set is not the one the stream was made with */
+
+/* What the header of a zlib stream says. */
+struct ZlibHeader
+{
+	int windowBits;				/* log2 of the window the compressor used */
+	int level;					/* FLEVEL, 0 (fastest) to 3 (best), informational only */
+	int hasDictionary;			/* FDICT */
+	unsigned int dictionaryId;	/* Adler-32 of the dictionary */
+	size_t dataOffset;			/* where the deflate data starts */
+};
+
+/*
+	The zlib container (RFC 1950), which is what HTTP "deflate", PNG IDAT
+	and most libraries' compress() produce: a two-byte header, perhaps the
+	id of a preset dictionary, the deflate data, and the Adler-32 of the
+	output. The Adler-32 is kept by the window as the output leaves it, the
+	same way as the CRC-32 of gzip, so checking it takes no second pass.
+
+	detect() tells the three formats the front end accepts apart, so the
+	caller can pick TGZip, TZlib, or THuffman on its own for raw deflate.
+*/
+template <class Sink>
+class TZlib
+{
+public:
+	TZlib(THuffman<Sink> *pHuffman);
+
+	int decompress(const unsigned char *data, size_t size);
+
+	static int parseHeader(const unsigned char *data, size_t size, struct ZlibHeader *header);
+	static int detect(const unsigned char *data, size_t size);
+
+	/// <summary>
+	/// Sets the preset dictionary for streams whose header asks for one, or
+	/// NULL for none. It must stay in place while decompress() runs.
+	/// </summary>
+	void setDictionary(const unsigned char *dictionary, int length)
+	{
+		this->dictionary = dictionary;
+		dictionaryLength = length;
+	}
+
+	/// <summary>
+	/// Where the last stream decompress() decoded ends in its input, after
+	/// the trailer. Anything after that is not part of it.
+	/// </summary>
+	size_t getEndOffset() const
+	{
+		return endOffset;
+	}
+
+	int error;
+
+private:
+	THuffman<Sink> *pHuffman;
+	const unsigned char *dictionary;
+	int dictionaryLength;
+	size_t endOffset;
+};
+
+/* The container for the run-time configured CIO output. */
+typedef TZlib<CIO> CZlib;
+
+/* Instantiated in Zlib.cpp. */
+extern template class TZlib<CIO>;
+extern template class TZlib<CMemorySink>;
+extern template class TZlib<CFileSink>;
+extern template class TZlib<CNullSink>;
+extern template class TZlib<CCallbackSink>;
@@ -7,10 +7,14 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 
 #include <stdio.h>
+#ifdef _WIN32
 #include <tchar.h>
+#endif
 
 
 
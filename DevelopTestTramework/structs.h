@@ -13,6 +13,95 @@ struct GZipHeader
 };
 #pragma pack()
 
+/*
+* Where one member of a gzip file is and what its header says.  Offsets are
+* from the start of the file.  The optional fields are left in the file and
+* only located here; the name and comment are zero-terminated there.
+*/
+struct GZipMember
+{
+	size_t offset;			/* first byte of the header */
+	size_t dataOffset;		/* first byte of the deflate data */
+	size_t endOffset;		/* byte after the trailer, 0 until it is known */
+	unsigned int mtime;		/* modification time, 0 if not given */
+	unsigned char flags;	/* FTEXT, FHCRC, FEXTRA, FNAME and FCOMMENT */
+	unsigned char extraFlags;
+	unsigned char os;
+	size_t extraOffset;		/* FEXTRA field contents, 0 if absent */
+	unsigned int extraLength;
+	size_t nameOffset;		/* FNAME, 0 if absent */
+	size_t commentOffset;	/* FCOMMENT, 0 if absent */
+	unsigned int blockSize;	/* whole member size from a BGZF extra field, or 0 */
+	long long outputOffset;	/* where the member's output starts */
+	long long outputLength;	/* bytes of output, once decoded */
+};
+
+/*
+* A point in a gzip file where decoding can start again: a block header, and
+* the output before it that later back-references can reach.  The window is
+* held by the index, at windowOffset in its window buffer.
+*/
+struct SeekCheckpoint
+{
+	long long output;		/* bytes of output of the whole file before the block */
+	long long bit;			/* the block header, in bits from the start of the file */
+	unsigned char byte;		/* the byte the header starts in, to check the file */
+	int windowLength;		/* 0 at the start of a member, at most WINDOWSIZE */
+	size_t windowOffset;
+};
+
+/*
+* What the decoder saw in one block, collected when it is built with
+* DECODESTATS.  Matches are counted by their length symbol (257..285) and
+* distance symbol (0..29), which are the ranges the extra bits refine.
+*/
+struct BlockStats
+{
+	int type;							/* STORED, FIXED or DYNAMIC */
+	int last;
+	long long bit;						/* the block header, in bits from the start of the input */
+	long long bits;						/* compressed size including the header, 0 if the block did not end */
+	long long output;					/* output before the block */
+	long long outputLength;
+	long long literals;
+	long long matches;
+	long long tableNanoseconds;			/* reading the header and building the tables */
+	long long decodeNanoseconds;		/* decoding or copying the contents */
+	unsigned int lengthSymbols[29];
+	unsigned int distanceSymbols[30];
+};
+
+/*
+* One entry of a table-driven Huffman decoder.  The primary table is indexed
+* by the next rootBits bits of the stream.  An entry either holds a symbol and
+* the total length of its code, links to a subtable for codes longer than
+* rootBits (value is the subtable offset and bits the number of bits that
+* index it), or marks a bit pattern that is not a valid code.
+*/
+struct decodeEntry
+{
+	unsigned short value;	/* symbol, or offset of the subtable */
+	unsigned char bits;		/* code length, or number of subtable index bits */
+	unsigned char op;		/* TABLESYMBOL, TABLELINK or TABLEINVALID */
+};
+
+/*
+* One entry of the multiple literal table.  It is indexed by the next LITBITS
+* bits of the stream and holds the one to three literals whose codes fit
+* completely in those bits, one after the other, and the total length of
+* their codes.  count is zero if the bits do not start with a literal short
+* enough to fit.  Then, if they start with a length or end-of-block code that
+* fits, symbol is that symbol and bits its length, so the decoder needs no
+* second lookup for it; otherwise bits is zero.
+*/
+struct literalEntry
+{
+	unsigned char count;	/* number of literals, 0..3 */
+	unsigned char bits;		/* total length of their codes, or of symbol's */
+	unsigned char lit[3];	/* the literals in stream order */
+	unsigned short symbol;	/* with count zero, a symbol of 256 or more */
+};
+
 /*
 * Huffman code decoding tables.  count[1..MAXBITS] is the number of symbols of
 * each length, which for a canonical code are stepped through in order.
@@ -22,8 +111,11 @@ struct GZipHeader
 */
 struct huffman
 {
-	short *count;       /* number of symbols of each length */
-	short *symbol;      /* canonically ordered symbols */
+	const short *count;       /* number of symbols of each length */
+	const short *symbol;      /* canonically ordered symbols */
+	const struct decodeEntry *table;	/* lookup table built from count[] and symbol[], or NULL */
+	int rootBits;             /* number of bits that index the primary lookup table */
+	const struct literalEntry *literals;	/* multiple literal table, or NULL */
 };
 
 #endif